@@ -0,0 +1,289 @@
+/////////////////////////////////////////////////////////////////////////////
+// Copyright  by W. T. Block, all rights reserved
+/////////////////////////////////////////////////////////////////////////////
+#pragma once
+#include "stdafx.h"
+#include <math.h>
+
+/////////////////////////////////////////////////////////////////////////////
+// this class tunes the number of files in flight to the throughput of the
+// storage, which is the number of bytes the finished files moved over a
+// window of files divided by the length of the window. Starting from the
+// fewest files, the limit climbs one file per window while each file added
+// raises the throughput by at least half of its share, and settles on the
+// last limit that did. A settled limit probes one file above and one file
+// below in turn every few windows, keeps a step down that holds the
+// throughput, and so follows the knee of the storage both ways. A window
+// whose throughput collapses cuts the limit by a quarter and searches
+// down from there. The caller serializes the calls.
+class CAdaptiveLimit
+{
+	// protected definitions
+protected:
+	// a window whose throughput falls below this share of the throughput
+	// of the settled limit cuts the limit
+	static inline double GetCollapse()
+	{
+		return 0.75;
+	}
+
+	// windows a settled limit holds before it probes
+	static inline int GetHoldWindows()
+	{
+		return 8;
+	}
+
+	// the shortest window in seconds
+	static inline double GetMinWindow()
+	{
+		return 0.25;
+	}
+
+	// protected data
+protected:
+	// the files allowed in flight
+	int m_nLimit;
+
+	// the fewest files allowed in flight
+	int m_nMinimum;
+
+	// the most files allowed in flight
+	int m_nMaximum;
+
+	// files finished in the window
+	int m_nSamples;
+
+	// bytes moved by the files finished in the window
+	ULONGLONG m_ullBytes;
+
+	// start of the window in seconds
+	double m_dStart;
+
+	// the limit that last held its throughput
+	int m_nSettled;
+
+	// throughput of the settled limit in bytes per second, zero until
+	// the first window
+	double m_dSettled;
+
+	// throughput of the previous window in bytes per second
+	double m_dPrevious;
+
+	// one to climb, minus one to descend, zero while settled
+	int m_nDirection;
+
+	// windows the settled limit has held
+	int m_nHeld;
+
+	// the next probe goes up rather than down
+	bool m_bProbeUp;
+
+	// protected methods
+protected:
+	// settle on the given limit
+	void Settle( int nLimit )
+	{
+		m_nLimit = nLimit;
+		m_nSettled = nLimit;
+		m_nDirection = 0;
+		m_nHeld = 0;
+	}
+
+	// public properties
+public:
+	// the files allowed in flight
+	inline int GetLimit()
+	{
+		return m_nLimit;
+	}
+	// the files allowed in flight
+	__declspec( property( get = GetLimit ) )
+		int Limit;
+
+	// public methods
+public:
+	// start again with the given bounds from the fewest files in flight
+	void Reset( int nMinimum, int nMaximum, double dNow )
+	{
+		m_nMinimum = max( nMinimum, 1 );
+		m_nMaximum = max( nMaximum, m_nMinimum );
+		m_nLimit = m_nMinimum;
+		m_nSamples = 0;
+		m_ullBytes = 0;
+		m_dStart = dNow;
+		m_nSettled = m_nMinimum;
+		m_dSettled = 0;
+		m_dPrevious = 0;
+		m_nDirection = 1;
+		m_nHeld = 0;
+		m_bProbeUp = false;
+	}
+
+	// add the bytes read and written by a finished file at the given time
+	// in seconds and return true if the limit changed
+	bool Add( ULONGLONG ullBytes, double dNow )
+	{
+		m_nSamples++;
+		m_ullBytes += ullBytes;
+
+		// a window spans at least two files per slot so the throughput is
+		// taken with the limit fully used
+		if ( m_nSamples < m_nLimit * 2 || dNow - m_dStart < GetMinWindow() )
+		{
+			return false;
+		}
+
+		const double dThroughput = m_ullBytes / ( dNow - m_dStart );
+		const double dPrevious = m_dPrevious;
+		m_nSamples = 0;
+		m_ullBytes = 0;
+		m_dStart = dNow;
+		m_dPrevious = dThroughput;
+
+		const int nLimit = m_nLimit;
+		if ( dThroughput < m_dSettled * GetCollapse() )
+		{
+			Settle( max( m_nLimit * 3 / 4, m_nMinimum ) );
+			m_dSettled = dThroughput;
+			m_nDirection = m_nLimit > m_nMinimum ? -1 : 0;
+
+		} else if ( m_nDirection > 0 )
+		{
+			// the file added must earn at least half of its share
+			if ( dThroughput > m_dSettled * ( 1 + 0.5 / m_nLimit ) )
+			{
+				m_dSettled = dThroughput;
+				m_nSettled = m_nLimit;
+				if ( m_nLimit < m_nMaximum )
+				{
+					m_nLimit++;
+
+				} else
+				{
+					Settle( m_nLimit );
+				}
+
+			} else
+			{
+				Settle( m_nSettled );
+			}
+
+		} else if ( m_nDirection < 0 )
+		{
+			// the file removed may cost no more than half of its share
+			if ( dThroughput >= dPrevious * ( 1 - 0.5 / ( m_nLimit + 1 ) ) )
+			{
+				m_dSettled = dThroughput;
+				m_nSettled = m_nLimit;
+				if ( m_nLimit > m_nMinimum )
+				{
+					m_nLimit--;
+
+				} else
+				{
+					Settle( m_nLimit );
+				}
+
+			} else
+			{
+				Settle( m_nSettled );
+			}
+
+		} else
+		{
+			m_dSettled = dThroughput;
+			if ( ++m_nHeld >= GetHoldWindows() && m_nMinimum < m_nMaximum )
+			{
+				m_nHeld = 0;
+				m_bProbeUp = !m_bProbeUp;
+				if ( ( m_bProbeUp && m_nLimit < m_nMaximum ) || m_nLimit == m_nMinimum )
+				{
+					m_nLimit++;
+					m_nDirection = 1;
+
+				} else
+				{
+					m_nLimit--;
+					m_nDirection = -1;
+				}
+			}
+		}
+
+		return m_nLimit != nLimit;
+	}
+
+#ifdef _DEBUG
+	// run the limit against a simulated storage of one megabyte files
+	// whose throughput grows with the files in flight up to the given
+	// knee and, when thrashing, falls off beyond it. Returns false if the
+	// limit does not settle within one file of the knee.
+	static bool Converges( int nKnee, bool bThrash, CAdaptiveLimit& limit, double& dNow )
+	{
+		const ULONGLONG ullMegabyte = 1024 * 1024;
+		int nLowest = INT_MAX;
+		int nHighest = 0;
+		for ( int nFile = 0; nFile < 20000; nFile++ )
+		{
+			const int nLimit = limit.Limit;
+			double dRate = 10.0 * ullMegabyte * min( nLimit, nKnee );
+			if ( bThrash && nLimit > nKnee )
+			{
+				dRate *= sqrt( (double)nKnee / nLimit );
+			}
+			dNow += ullMegabyte / dRate;
+			limit.Add( ullMegabyte, dNow );
+
+			// the last quarter is taken as settled
+			if ( nFile >= 15000 )
+			{
+				nLowest = min( nLowest, limit.Limit );
+				nHighest = max( nHighest, limit.Limit );
+			}
+		}
+
+		return nLowest >= max( nKnee - 1, 1 ) && nHighest <= nKnee + 1;
+	}
+
+	// check the limit finds the knee of a simulated storage from the
+	// fewest files and follows a knee that moves down, and return the
+	// number of checks that failed. Only run when asked for with
+	// --self-test.
+	static int SelfTest()
+	{
+		int value = 0;
+		for ( const int nKnee : { 1, 2, 6, 20 } )
+		{
+			for ( const bool bThrash : { false, true } )
+			{
+				CAdaptiveLimit limit;
+				double dNow = 0;
+				limit.Reset( 1, 32, dNow );
+				if ( !Converges( nKnee, bThrash, limit, dNow ) )
+				{
+					value++;
+				}
+			}
+		}
+
+		for ( const bool bThrash : { false, true } )
+		{
+			CAdaptiveLimit limit;
+			double dNow = 0;
+			limit.Reset( 1, 32, dNow );
+			if ( !Converges( 20, bThrash, limit, dNow ) || !Converges( 4, bThrash, limit, dNow ) )
+			{
+				value++;
+			}
+		}
+
+		return value;
+	}
+#endif
+
+	// public construction
+public:
+	CAdaptiveLimit()
+	{
+		Reset( 1, 1, 0 );
+	}
+};
@@ -0,0 +1,295 @@
+/////////////////////////////////////////////////////////////////////////////
+// Copyright  by W. T. Block, all rights reserved
+/////////////////////////////////////////////////////////////////////////////
+#pragma once
+#include "stdafx.h"
+#include <vector>
+
+using namespace std;
+
+/////////////////////////////////////////////////////////////////////////////
+// this class hands out the header and staging buffers used to read and
+// write the images. Each thread keeps the buffers it released in free
+// lists by size class and hands them out again for the next file, so once
+// a worker has seen a few files it no longer allocates any I/O buffers. The
+// buffers smaller than the 64 KB granularity of the virtual memory manager
+// come from the heap and the others straight from the virtual memory
+// manager, and all of them may be carved from a large page slab when the
+// user holds the privilege to lock pages. The pool only holds the I/O
+// buffers and a file is not free of heap allocations: it still allocates
+// the task that carries it to a worker, the entries of each IFD it reads,
+// the CString temporaries of its pathnames, dates and output, the XMP
+// packet of a JPEG file and the text of an XMP sidecar.
+class CBufferPool
+{
+	// protected definitions
+protected:
+	// the smallest size class is 4 KB and the largest 512 KB
+	enum { MIN_SHIFT = 12, CLASSES = 8 };
+
+	// the buffers below this size come from the heap, since the virtual
+	// memory manager reserves 64 KB of address space for each allocation
+	enum { HEAP_LIMIT = 64 * 1024 };
+
+	// the buffers of one thread
+	typedef struct tagThreadCache
+	{
+		// released buffers of each size class
+		vector<BYTE*> m_Free[ CLASSES ];
+
+		// buffers allocated on their own which are freed with the thread
+		vector<BYTE*> m_Owned;
+
+		// buffers allocated from the heap which are freed with the thread
+		vector<BYTE*> m_Heap;
+
+		// large page slab the buffers are carved from, if any
+		BYTE* m_pSlab;
+
+		// size of the slab
+		size_t m_nSlab;
+
+		// bytes of the slab handed out
+		size_t m_nUsed;
+
+		// the large page slab could not be allocated, which is not tried
+		// again for every buffer
+		bool m_bSlabFailed;
+
+		// allocate a buffer of the given size from the slab, the heap or
+		// on its own
+		BYTE* Allocate( size_t nSize )
+		{
+			if ( GetLargePages() && m_pSlab == nullptr && !m_bSlabFailed )
+			{
+				m_nSlab = ::GetLargePageMinimum();
+				m_pSlab = (BYTE*)::VirtualAlloc
+				(
+					NULL, m_nSlab, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES,
+					PAGE_READWRITE
+				);
+				m_nUsed = 0;
+				m_bSlabFailed = m_pSlab == nullptr;
+			}
+
+			InterlockedIncrement( &GetAllocationCount() );
+
+			if ( m_pSlab != nullptr && m_nUsed + nSize <= m_nSlab )
+			{
+				BYTE* value = m_pSlab + m_nUsed;
+				m_nUsed += nSize;
+				return value;
+			}
+
+			if ( nSize < HEAP_LIMIT )
+			{
+				BYTE* value = (BYTE*)::HeapAlloc( ::GetProcessHeap(), 0, nSize );
+				if ( value != nullptr )
+				{
+					m_Heap.push_back( value );
+				}
+				return value;
+			}
+
+			BYTE* value = (BYTE*)::VirtualAlloc
+			(
+				NULL, nSize, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE
+			);
+			if ( value != nullptr )
+			{
+				m_Owned.push_back( value );
+			}
+			return value;
+		}
+
+		tagThreadCache()
+		{
+			m_pSlab = nullptr;
+			m_nSlab = 0;
+			m_nUsed = 0;
+			m_bSlabFailed = false;
+		}
+		~tagThreadCache()
+		{
+			for ( BYTE* pBuffer : m_Owned )
+			{
+				::VirtualFree( pBuffer, 0, MEM_RELEASE );
+			}
+			for ( BYTE* pBuffer : m_Heap )
+			{
+				::HeapFree( ::GetProcessHeap(), 0, pBuffer );
+			}
+			if ( m_pSlab != nullptr )
+			{
+				::VirtualFree( m_pSlab, 0, MEM_RELEASE );
+			}
+		}
+
+	} THREAD_CACHE;
+
+	// protected methods
+protected:
+	// the buffers of the calling thread
+	static THREAD_CACHE& GetCache()
+	{
+		static thread_local THREAD_CACHE value;
+		return value;
+	}
+
+	// the buffers are backed by large pages
+	static bool& GetLargePages()
+	{
+		static bool value = false;
+		return value;
+	}
+
+	// number of buffers allocated by every thread
+	static volatile LONG& GetAllocationCount()
+	{
+		static volatile LONG value = 0;
+		return value;
+	}
+
+	// public methods
+public:
+	/////////////////////////////////////////////////////////////////////////
+	// back the buffers allocated from now on with large pages, which needs
+	// the lock pages in memory privilege. Returns false if the privilege
+	// is not held or large pages are not supported.
+	static bool EnableLargePages()
+	{
+		if ( ::GetLargePageMinimum() == 0 )
+		{
+			return false;
+		}
+
+		HANDLE hToken = NULL;
+		if ( !::OpenProcessToken
+		(
+			::GetCurrentProcess(), TOKEN_ADJUST_PRIVILEGES | TOKEN_QUERY, &hToken
+		) )
+		{
+			return false;
+		}
+
+		TOKEN_PRIVILEGES tp = { 0 };
+		tp.PrivilegeCount = 1;
+		tp.Privileges[ 0 ].Attributes = SE_PRIVILEGE_ENABLED;
+		bool value =
+			::LookupPrivilegeValue( NULL, SE_LOCK_MEMORY_NAME, &tp.Privileges[ 0 ].Luid ) &&
+			::AdjustTokenPrivileges( hToken, FALSE, &tp, 0, NULL, NULL ) &&
+			::GetLastError() == ERROR_SUCCESS;
+		::CloseHandle( hToken );
+
+		GetLargePages() = value;
+		return value;
+	}
+
+	// number of buffers allocated by every thread, which stops growing
+	// once the workers reuse their buffers
+	static LONG GetAllocations()
+	{
+		return GetAllocationCount();
+	}
+
+	// hand out a buffer of at least the given size and return its size
+	// class which is -1 for a buffer larger than the largest class
+	static BYTE* Acquire( size_t nSize, int& nClass )
+	{
+		nClass = 0;
+		while ( nClass < CLASSES && ( (size_t)1 << ( MIN_SHIFT + nClass ) ) < nSize )
+		{
+			nClass++;
+		}
+
+		if ( nClass == CLASSES )
+		{
+			nClass = -1;
+			InterlockedIncrement( &GetAllocationCount() );
+			return (BYTE*)::VirtualAlloc
+			(
+				NULL, nSize, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE
+			);
+		}
+
+		THREAD_CACHE& cache = GetCache();
+		vector<BYTE*>& buffers = cache.m_Free[ nClass ];
+		if ( !buffers.empty() )
+		{
+			BYTE* value = buffers.back();
+			buffers.pop_back();
+			return value;
+		}
+
+		return cache.Allocate( (size_t)1 << ( MIN_SHIFT + nClass ) );
+	}
+
+	// return a buffer to the free list of the calling thread
+	static void Release( BYTE* pBuffer, int nClass )
+	{
+		if ( pBuffer == nullptr )
+		{
+			return;
+		}
+
+		if ( nClass < 0 )
+		{
+			::VirtualFree( pBuffer, 0, MEM_RELEASE );
+			return;
+		}
+
+		GetCache().m_Free[ nClass ].push_back( pBuffer );
+	}
+};
+
+/////////////////////////////////////////////////////////////////////////////
+// this class holds a buffer of the calling thread's pool for as long as it
+// is in scope and returns it to the pool on every way out
+class CPooledBuffer
+{
+	// protected data
+protected:
+	// the buffer
+	BYTE* m_pData;
+
+	// the size asked for
+	size_t m_nSize;
+
+	// the size class of the buffer
+	int m_nClass;
+
+	// public properties
+public:
+	// the buffer
+	inline BYTE* GetData()
+	{
+		return m_pData;
+	}
+	// the buffer
+	__declspec( property( get = GetData ) )
+		BYTE* Data;
+
+	// the size asked for
+	inline size_t GetSize()
+	{
+		return m_nSize;
+	}
+	// the size asked for
+	__declspec( property( get = GetSize ) )
+		size_t Size;
+
+	// public construction / destruction
+public:
+	CPooledBuffer( size_t nSize )
+	{
+		m_pData = CBufferPool::Acquire( nSize, m_nClass );
+		m_nSize = m_pData == nullptr ? 0 : nSize;
+	}
+	~CPooledBuffer()
+	{
+		CBufferPool::Release( m_pData, m_nClass );
+	}
+	CPooledBuffer( const CPooledBuffer& ) = delete;
+	CPooledBuffer& operator=( const CPooledBuffer& ) = delete;
+};
+
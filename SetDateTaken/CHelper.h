@@ -3,6 +3,7 @@
 /////////////////////////////////////////////////////////////////////////////
 #pragma once
 #include "stdafx.h"
+#include "PathParts.h"
 #include <vector>
 
 using namespace std;
@@ -102,82 +103,42 @@ public:
 	// parse the filename from a pathname
 	static inline CString GetFileName( LPCTSTR pcszPath )
 	{
-		CString csPath( pcszPath );
-		TCHAR* pBuf = csPath.GetBuffer( csPath.GetLength() + 1 );
-		TCHAR szDrive[ _MAX_DRIVE ];
-		TCHAR szDir[ _MAX_DIR ];
-		TCHAR szFile[ _MAX_FNAME ];
-		TCHAR szExt[ _MAX_EXT ];
-
-		_tsplitpath( pBuf, szDrive, szDir, szFile, szExt );
-		csPath.ReleaseBuffer();
-		return szFile;
+		return CPathParts( pcszPath ).FileName;
 	}
 
 	/////////////////////////////////////////////////////////////////////////////
 	// parse the extension from a pathname
 	static inline CString GetExtension( LPCTSTR pcszPath )
 	{
-		CString csPath( pcszPath );
-		TCHAR* pBuf = csPath.GetBuffer( csPath.GetLength() + 1 );
-		TCHAR szDrive[ _MAX_DRIVE ];
-		TCHAR szDir[ _MAX_DIR ];
-		TCHAR szFile[ _MAX_FNAME ];
-		TCHAR szExt[ _MAX_EXT ];
-
-		_tsplitpath( pBuf, szDrive, szDir, szFile, szExt );
-		csPath.ReleaseBuffer();
-		return szExt;
+		return CPathParts( pcszPath ).Extension;
 	}
 
 	/////////////////////////////////////////////////////////////////////////////
 	// parse the directory from a pathname
 	static inline CString GetDirectory( LPCTSTR pcszPath )
 	{
-		CString csPath( pcszPath );
-		TCHAR* pBuf = csPath.GetBuffer( csPath.GetLength() + 1 );
-		TCHAR szDrive[ _MAX_DRIVE ];
-		TCHAR szDir[ _MAX_DIR ];
-		TCHAR szFile[ _MAX_FNAME ];
-		TCHAR szExt[ _MAX_EXT ];
-
-		_tsplitpath( pBuf, szDrive, szDir, szFile, szExt );
-		csPath.ReleaseBuffer();
-		return szDir;
+		return CPathParts( pcszPath ).Directory;
 	}
 
 	/////////////////////////////////////////////////////////////////////////////
 	// parse the drive from a pathname
 	static inline CString GetDrive( LPCTSTR pcszPath )
 	{
-		CString csPath( pcszPath );
-		TCHAR* pBuf = csPath.GetBuffer( csPath.GetLength() + 1 );
-		TCHAR szDrive[ _MAX_DRIVE ];
-		TCHAR szDir[ _MAX_DIR ];
-		TCHAR szFile[ _MAX_FNAME ];
-		TCHAR szExt[ _MAX_EXT ];
-
-		_tsplitpath( pBuf, szDrive, szDir, szFile, szExt );
-		csPath.ReleaseBuffer();
-		return szDrive;
+		return CPathParts( pcszPath ).Drive;
 	}
 
 	/////////////////////////////////////////////////////////////////////////////
 	// parse folder from a pathname (drive and directory)
 	static inline CString GetFolder( LPCTSTR pcszPath )
 	{
-		CString csDrive = GetDrive( pcszPath );
-		CString csDir = GetDirectory( pcszPath );
-		return csDrive + csDir;
+		return CPathParts( pcszPath ).Folder;
 	}
 
 	/////////////////////////////////////////////////////////////////////////////
 	// parse data name from a pathname (filename and extension)
 	static inline CString GetDataName( LPCTSTR pcszPath )
 	{
-		CString csFile = GetFileName( pcszPath );
-		CString csExt = GetExtension( pcszPath );
-		return csFile + csExt;
+		return CPathParts( pcszPath ).DataName;
 	}
 
 	CHelper()
@@ -0,0 +1,251 @@
+/////////////////////////////////////////////////////////////////////////////
+// Copyright  by W. T. Block, all rights reserved
+/////////////////////////////////////////////////////////////////////////////
+#pragma once
+#include "stdafx.h"
+#include "BufferPool.h"
+#include "IoThrottle.h"
+#include <vector>
+
+using namespace std;
+
+/////////////////////////////////////////////////////////////////////////////
+// this class computes a fast non-cryptographic 64 bit hash of a stream of
+// bytes using the XXH64 algorithm, which is only used to find identical
+// files and is not meant to resist a deliberate collision
+class CContentHash
+{
+	// protected definitions
+protected:
+	// the primes of the algorithm
+	static const ULONGLONG PRIME1 = 0x9E3779B185EBCA87ULL;
+	static const ULONGLONG PRIME2 = 0xC2B2AE3D27D4EB4FULL;
+	static const ULONGLONG PRIME3 = 0x165667B19E3779F9ULL;
+	static const ULONGLONG PRIME4 = 0x85EBCA77C2B2AE63ULL;
+	static const ULONGLONG PRIME5 = 0x27D4EB2F165667C5ULL;
+
+	// the bytes are consumed in stripes of this size
+	enum { STRIPE = 32 };
+
+	// protected data
+protected:
+	// the four accumulators
+	ULONGLONG m_ullAccumulator[ 4 ];
+
+	// bytes waiting for a full stripe
+	BYTE m_Stripe[ STRIPE ];
+
+	// number of bytes waiting
+	int m_nStripe;
+
+	// total number of bytes hashed
+	ULONGLONG m_ullLength;
+
+	// protected methods
+protected:
+	static inline ULONGLONG Rotate( ULONGLONG ullValue, int nBits )
+	{
+		return ( ullValue << nBits ) | ( ullValue >> ( 64 - nBits ) );
+	}
+
+	static inline ULONGLONG Read64( const BYTE* pData )
+	{
+		ULONGLONG value;
+		memcpy( &value, pData, sizeof( value ) );
+		return value;
+	}
+
+	static inline ULONGLONG Read32( const BYTE* pData )
+	{
+		DWORD value;
+		memcpy( &value, pData, sizeof( value ) );
+		return value;
+	}
+
+	static inline ULONGLONG Round( ULONGLONG ullAccumulator, ULONGLONG ullInput )
+	{
+		ullAccumulator += ullInput * PRIME2;
+		ullAccumulator = Rotate( ullAccumulator, 31 );
+		return ullAccumulator * PRIME1;
+	}
+
+	static inline ULONGLONG Merge( ULONGLONG ullHash, ULONGLONG ullAccumulator )
+	{
+		ullHash ^= Round( 0, ullAccumulator );
+		return ullHash * PRIME1 + PRIME4;
+	}
+
+	// consume one full stripe
+	inline void Consume( const BYTE* pData )
+	{
+		for ( int nLane = 0; nLane < 4; nLane++ )
+		{
+			m_ullAccumulator[ nLane ] =
+				Round( m_ullAccumulator[ nLane ], Read64( pData + nLane * 8 ) );
+		}
+	}
+
+	// public methods
+public:
+	// start a new hash
+	void Reset()
+	{
+		m_ullAccumulator[ 0 ] = PRIME1 + PRIME2;
+		m_ullAccumulator[ 1 ] = PRIME2;
+		m_ullAccumulator[ 2 ] = 0;
+		m_ullAccumulator[ 3 ] = 0 - PRIME1;
+		m_nStripe = 0;
+		m_ullLength = 0;
+	}
+
+	// add the given bytes to the hash
+	void Update( const BYTE* pData, size_t nLength )
+	{
+		m_ullLength += nLength;
+
+		// complete a partial stripe first
+		if ( m_nStripe != 0 )
+		{
+			const size_t nCopy = min( nLength, (size_t)( STRIPE - m_nStripe ) );
+			memcpy( m_Stripe + m_nStripe, pData, nCopy );
+			m_nStripe += (int)nCopy;
+			pData += nCopy;
+			nLength -= nCopy;
+			if ( m_nStripe < STRIPE )
+			{
+				return;
+			}
+			Consume( m_Stripe );
+			m_nStripe = 0;
+		}
+
+		while ( nLength >= STRIPE )
+		{
+			Consume( pData );
+			pData += STRIPE;
+			nLength -= STRIPE;
+		}
+
+		memcpy( m_Stripe, pData, nLength );
+		m_nStripe = (int)nLength;
+	}
+
+	// return the hash of the bytes added so far
+	ULONGLONG Final()
+	{
+		ULONGLONG value;
+		if ( m_ullLength >= STRIPE )
+		{
+			value =
+				Rotate( m_ullAccumulator[ 0 ], 1 ) +
+				Rotate( m_ullAccumulator[ 1 ], 7 ) +
+				Rotate( m_ullAccumulator[ 2 ], 12 ) +
+				Rotate( m_ullAccumulator[ 3 ], 18 );
+			for ( int nLane = 0; nLane < 4; nLane++ )
+			{
+				value = Merge( value, m_ullAccumulator[ nLane ] );
+			}
+
+		} else
+		{
+			value = PRIME5;
+		}
+
+		value += m_ullLength;
+
+		const BYTE* pData = m_Stripe;
+		int nLength = m_nStripe;
+		while ( nLength >= 8 )
+		{
+			value ^= Round( 0, Read64( pData ) );
+			value = Rotate( value, 27 ) * PRIME1 + PRIME4;
+			pData += 8;
+			nLength -= 8;
+		}
+
+		if ( nLength >= 4 )
+		{
+			value ^= Read32( pData ) * PRIME1;
+			value = Rotate( value, 23 ) * PRIME2 + PRIME3;
+			pData += 4;
+			nLength -= 4;
+		}
+
+		while ( nLength > 0 )
+		{
+			value ^= *pData * PRIME5;
+			value = Rotate( value, 11 ) * PRIME1;
+			pData++;
+			nLength--;
+		}
+
+		// avalanche
+		value ^= value >> 33;
+		value *= PRIME2;
+		value ^= value >> 29;
+		value *= PRIME3;
+		value ^= value >> 32;
+		return value;
+	}
+
+	/////////////////////////////////////////////////////////////////////////
+	// stream the given file, or up to the given number of bytes at its
+	// start, through the hash and return its hash and the bytes hashed.
+	// Returns false if the file cannot be read.
+	static bool HashFile
+	(
+		LPCTSTR pcszPath, ULONGLONG& ullHash, ULONGLONG& ullSize,
+		ULONGLONG ullLimit = ULLONG_MAX
+	)
+	{
+		HANDLE hFile = ::CreateFile
+		(
+			pcszPath, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+			FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL
+		);
+		if ( hFile == INVALID_HANDLE_VALUE )
+		{
+			return false;
+		}
+
+		CContentHash hash;
+		CPooledBuffer buffer( 256 * 1024 );
+		DWORD dwRead = 0;
+		bool value = buffer.Data != nullptr;
+		while ( value && hash.m_ullLength < ullLimit )
+		{
+			const DWORD dwWanted = (DWORD)min
+			(
+				(ULONGLONG)buffer.Size, ullLimit - hash.m_ullLength
+			);
+			if ( !::ReadFile( hFile, buffer.Data, dwWanted, &dwRead, NULL ) )
+			{
+				value = false;
+				break;
+			}
+			if ( dwRead == 0 )
+			{
+				break;
+			}
+			CIoThrottle::Read( dwRead );
+			hash.Update( buffer.Data, dwRead );
+		}
+
+		::CloseHandle( hFile );
+
+		ullHash = hash.Final();
+		ullSize = hash.m_ullLength;
+		return value;
+	}
+
+	// public construction
+public:
+	CContentHash()
+	{
+		Reset();
+	}
+	~CContentHash()
+	{
+	}
+};
+
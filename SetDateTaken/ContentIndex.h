@@ -0,0 +1,291 @@
+/////////////////////////////////////////////////////////////////////////////
+// Copyright  by W. T. Block, all rights reserved
+/////////////////////////////////////////////////////////////////////////////
+#pragma once
+#include "stdafx.h"
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <vector>
+
+using namespace std;
+
+/////////////////////////////////////////////////////////////////////////////
+// this class remembers the output written for each content key (the hash
+// of the start of an input, its size and its new date) so identical inputs
+// are written once and the others reuse the first output. A worker that
+// finds its key in progress leaves a function that queues its task again
+// when the first worker finishes, so no worker waits. The memory used by
+// the keys is bounded by forgetting the oldest finished keys.
+class CContentIndex
+{
+	// public definitions
+public:
+	// queues the task of a worker that found its key in progress
+	typedef function<void()> REQUEUE;
+
+	// the outcome of claiming a key
+	typedef enum
+	{
+		// the caller is the first and must complete the key
+		crFirst = 0,
+
+		// the key was written before and the output is returned
+		crDuplicate = crFirst + 1,
+
+		// the first writer failed, so the caller writes its own output
+		crFailed = crDuplicate + 1,
+
+		// the first writer is busy and the caller's task is queued again
+		// when it finishes
+		crQueued = crFailed + 1,
+
+	} CLAIM_RESULT;
+
+	// protected definitions
+protected:
+	// what is known about a key
+	typedef struct tagContentEntry
+	{
+		// pathname of the first input
+		CString m_csInput;
+
+		// pathname of the first output which is empty if it failed
+		CString m_csOutput;
+
+		// the first writer has finished
+		bool m_bDone;
+
+		// the tasks to queue again when the first writer finishes
+		vector<REQUEUE> m_arrWaiting;
+
+	} CONTENT_ENTRY;
+
+	// estimated bytes of a key beyond its text
+	enum { ENTRY_OVERHEAD = 128 };
+
+	// protected data
+protected:
+	// the keys and what is known about them
+	map<CString, CONTENT_ENTRY> m_mapEntries;
+
+	// the keys in the order they were added
+	deque<CString> m_Order;
+
+	// estimated bytes used by the keys
+	size_t m_nBytes;
+
+	// the most bytes the keys may use
+	size_t m_nMaxBytes;
+
+	// guards the keys
+	mutex m_Mutex;
+
+	// number of inputs that reused an output
+	volatile LONG m_lDuplicates;
+
+	// number of input bytes that were not processed again
+	volatile LONGLONG m_llSaved;
+
+	// protected methods
+protected:
+	// estimated bytes of a key and its output
+	static inline size_t GetSize( const CString& csKey, const CONTENT_ENTRY& entry )
+	{
+		return
+			ENTRY_OVERHEAD +
+			(
+				csKey.GetLength() + entry.m_csInput.GetLength() +
+				entry.m_csOutput.GetLength()
+			) * sizeof( TCHAR );
+	}
+
+	// forget the oldest finished keys until the memory is within bounds,
+	// stopping at a key still being written (the caller holds the lock)
+	void Evict()
+	{
+		while ( m_nBytes > m_nMaxBytes && !m_Order.empty() )
+		{
+			const auto found = m_mapEntries.find( m_Order.front() );
+			if ( found != m_mapEntries.end() )
+			{
+				if ( !found->second.m_bDone )
+				{
+					break;
+				}
+
+				m_nBytes -= GetSize( found->first, found->second );
+				m_mapEntries.erase( found );
+			}
+			m_Order.pop_front();
+		}
+	}
+
+	// public properties
+public:
+	// the most bytes the keys may use
+	inline size_t GetMaxBytes()
+	{
+		return m_nMaxBytes;
+	}
+	// the most bytes the keys may use
+	inline void SetMaxBytes( size_t value )
+	{
+		m_nMaxBytes = value;
+	}
+	// the most bytes the keys may use
+	__declspec( property( get = GetMaxBytes, put = SetMaxBytes ) )
+		size_t MaxBytes;
+
+	// number of inputs that reused an output
+	inline LONG GetDuplicates()
+	{
+		return m_lDuplicates;
+	}
+	// number of inputs that reused an output
+	__declspec( property( get = GetDuplicates ) )
+		LONG Duplicates;
+
+	// number of input bytes that were not processed again
+	inline LONGLONG GetSaved()
+	{
+		return m_llSaved;
+	}
+	// number of input bytes that were not processed again
+	__declspec( property( get = GetSaved ) )
+		LONGLONG Saved;
+
+	// public methods
+public:
+	// claim the given key for the given input. A duplicate gets the
+	// input and output of the first writer, which it compares with its
+	// own input before reusing the output. While another worker is
+	// writing the key, the given function is kept to queue the caller's
+	// task again once the writer finishes.
+	CLAIM_RESULT Claim
+	(
+		const CString& csKey, LPCTSTR pcszInput, CString& csInput,
+		CString& csOutput, REQUEUE fnRequeue
+	)
+	{
+		lock_guard<mutex> lock( m_Mutex );
+
+		const auto found = m_mapEntries.find( csKey );
+		if ( found == m_mapEntries.end() )
+		{
+			CONTENT_ENTRY& entry = m_mapEntries[ csKey ];
+			entry.m_csInput = pcszInput;
+			entry.m_bDone = false;
+			m_Order.push_back( csKey );
+			m_nBytes += GetSize( csKey, entry );
+			Evict();
+			return crFirst;
+		}
+
+		if ( !found->second.m_bDone )
+		{
+			found->second.m_arrWaiting.push_back( fnRequeue );
+			return crQueued;
+		}
+
+		if ( found->second.m_csOutput.IsEmpty() )
+		{
+			return crFailed;
+		}
+
+		csInput = found->second.m_csInput;
+		csOutput = found->second.m_csOutput;
+		return crDuplicate;
+	}
+
+	// record the output of a key claimed first, which is empty if the
+	// output was not written, and queue the tasks that found it busy
+	void Complete( const CString& csKey, LPCTSTR pcszOutput )
+	{
+		vector<REQUEUE> arrWaiting;
+		{
+			lock_guard<mutex> lock( m_Mutex );
+			const auto found = m_mapEntries.find( csKey );
+			if ( found != m_mapEntries.end() )
+			{
+				found->second.m_csOutput = pcszOutput;
+				found->second.m_bDone = true;
+				arrWaiting.swap( found->second.m_arrWaiting );
+				m_nBytes += found->second.m_csOutput.GetLength() * sizeof( TCHAR );
+				Evict();
+			}
+		}
+
+		for ( const REQUEUE& fnRequeue : arrWaiting )
+		{
+			fnRequeue();
+		}
+	}
+
+	// count an input that reused an output
+	void AddSaved( ULONGLONG ullBytes )
+	{
+		InterlockedIncrement( &m_lDuplicates );
+		InterlockedAdd64( &m_llSaved, (LONGLONG)ullBytes );
+	}
+
+	// public construction
+public:
+	CContentIndex()
+	{
+		m_nBytes = 0;
+		m_nMaxBytes = 64 * 1024 * 1024;
+		m_lDuplicates = 0;
+		m_llSaved = 0;
+	}
+	~CContentIndex()
+	{
+	}
+};
+
+/////////////////////////////////////////////////////////////////////////////
+// this class completes a key claimed first when it goes out of scope, so
+// the tasks waiting for the key are queued again on every way out of the
+// worker even if the output was not written
+class CContentClaim
+{
+	// protected data
+protected:
+	// the index holding the key, if a key was claimed
+	CContentIndex* m_pIndex;
+
+	// the claimed key
+	CString m_csKey;
+
+	// public methods
+public:
+	// remember the key claimed first
+	void Begin( CContentIndex* pIndex, const CString& csKey )
+	{
+		m_pIndex = pIndex;
+		m_csKey = csKey;
+	}
+
+	// record the output of the key
+	void Complete( LPCTSTR pcszOutput )
+	{
+		if ( m_pIndex != nullptr )
+		{
+			m_pIndex->Complete( m_csKey, pcszOutput );
+			m_pIndex = nullptr;
+		}
+	}
+
+	// public construction / destruction
+public:
+	CContentClaim()
+	{
+		m_pIndex = nullptr;
+	}
+	~CContentClaim()
+	{
+		Complete( _T( "" ) );
+	}
+};
+
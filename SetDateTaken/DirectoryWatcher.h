@@ -0,0 +1,378 @@
+/////////////////////////////////////////////////////////////////////////////
+// Copyright  by W. T. Block, all rights reserved
+/////////////////////////////////////////////////////////////////////////////
+#pragma once
+#include "stdafx.h"
+#include <functional>
+#include <map>
+#include <vector>
+
+using namespace std;
+
+/////////////////////////////////////////////////////////////////////////////
+// this class watches a folder tree for files that are created or changed
+// and reports each file once it has been quiet for the debounce time and
+// no longer has a writer. Windows has no close-write event, so the file
+// is considered written when it can be opened without sharing write
+// access. A folder is only reported when it arrives in the tree, and the
+// files of a folder that arrived are added to the pending files so they
+// wait for their writers like any other file. The thread sleeps in the
+// wait when nothing is pending.
+class CDirectoryWatcher
+{
+	// public definitions
+public:
+	// called with the pathname of a file or folder that is ready
+	typedef function<void( LPCTSTR )> READY;
+
+	// called when changes were lost and the tree should be rescanned
+	typedef function<void()> OVERFLOWED;
+
+	// protected definitions
+protected:
+	// a pathname waiting to be quiet
+	typedef struct tagPending
+	{
+		// the time of its last event
+		ULONGLONG m_ullTime;
+
+		// it was created or moved into the tree rather than changed
+		bool m_bArrived;
+
+	} PENDING;
+
+	// protected data
+protected:
+	// the folder being watched without a trailing backslash
+	CString m_csFolder;
+
+	// handle of the folder opened for overlapped reads
+	HANDLE m_hFolder;
+
+	// signaled when a read of the changes completes
+	HANDLE m_hChanged;
+
+	// signaled to end the watch
+	HANDLE m_hStop;
+
+	// the read of the changes in progress
+	OVERLAPPED m_Overlapped;
+
+	// the changes are written here by the file system and DWORD
+	// aligned as required by ReadDirectoryChangesW
+	vector<DWORD> m_Buffer;
+
+	// the entries of the folders that arrived, which join the pending
+	// pathnames once the ready pathnames have been reported
+	vector<CString> m_arrArrived;
+
+	// protected methods
+protected:
+	// start reading the next batch of changes
+	bool Read()
+	{
+		memset( &m_Overlapped, 0, sizeof( m_Overlapped ) );
+		m_Overlapped.hEvent = m_hChanged;
+
+		const DWORD dwFilter =
+			FILE_NOTIFY_CHANGE_FILE_NAME |
+			FILE_NOTIFY_CHANGE_DIR_NAME |
+			FILE_NOTIFY_CHANGE_SIZE |
+			FILE_NOTIFY_CHANGE_LAST_WRITE;
+
+		return FALSE != ::ReadDirectoryChangesW
+		(
+			m_hFolder, m_Buffer.data(),
+			(DWORD)( m_Buffer.size() * sizeof( DWORD ) ),
+			TRUE, dwFilter, NULL, &m_Overlapped, NULL
+		);
+	}
+
+	// a file is ready when no one has it open for writing
+	static bool IsReady( LPCTSTR pcszPath )
+	{
+		const DWORD dwAttributes = ::GetFileAttributes( pcszPath );
+		if ( dwAttributes == INVALID_FILE_ATTRIBUTES )
+		{
+			return false;
+		}
+
+		if ( ( dwAttributes & FILE_ATTRIBUTE_DIRECTORY ) != 0 )
+		{
+			return true;
+		}
+
+		HANDLE hFile = ::CreateFile
+		(
+			pcszPath, GENERIC_READ, FILE_SHARE_READ, NULL,
+			OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL
+		);
+		if ( hFile == INVALID_HANDLE_VALUE )
+		{
+			return false;
+		}
+
+		::CloseHandle( hFile );
+		return true;
+	}
+
+	// record the changes in the buffer where only the latest event of
+	// each pathname is kept, which coalesces a burst of writes into one
+	void Collect
+	(
+		DWORD dwBytes, map<CString, PENDING>& pending, ULONGLONG ullNow
+	)
+	{
+		const BYTE* pData = (const BYTE*)m_Buffer.data();
+		const BYTE* pEnd = pData + dwBytes;
+		while ( pData < pEnd )
+		{
+			const FILE_NOTIFY_INFORMATION* pInfo =
+				(const FILE_NOTIFY_INFORMATION*)pData;
+
+			const CStringW csName
+			(
+				pInfo->FileName,
+				(int)( pInfo->FileNameLength / sizeof( WCHAR ) )
+			);
+			const CString csPath = m_csFolder + _T( "\\" ) + CString( csName );
+
+			switch ( pInfo->Action )
+			{
+				case FILE_ACTION_ADDED:
+				case FILE_ACTION_RENAMED_NEW_NAME:
+				{
+					PENDING& item = pending[ csPath ];
+					item.m_ullTime = ullNow;
+					item.m_bArrived = true;
+					break;
+				}
+				case FILE_ACTION_MODIFIED:
+				{
+					// a new entry starts out as changed rather than
+					// arrived, which is how a folder whose contents
+					// changed is told from a folder that arrived
+					const bool bNew = pending.find( csPath ) == pending.end();
+					PENDING& item = pending[ csPath ];
+					item.m_ullTime = ullNow;
+					if ( bNew )
+					{
+						item.m_bArrived = false;
+					}
+					break;
+				}
+				case FILE_ACTION_REMOVED:
+				case FILE_ACTION_RENAMED_OLD_NAME:
+				{
+					pending.erase( csPath );
+					break;
+				}
+			}
+
+			if ( pInfo->NextEntryOffset == 0 )
+			{
+				break;
+			}
+			pData += pInfo->NextEntryOffset;
+		}
+	}
+
+	// public methods
+public:
+	// open the given folder (without a trailing backslash) and start
+	// collecting its changes, which can be done before an initial scan
+	// so no file that lands during the scan is missed
+	bool Open( LPCTSTR pcszFolder )
+	{
+		Close();
+
+		m_csFolder = pcszFolder;
+		m_hFolder = ::CreateFile
+		(
+			m_csFolder, FILE_LIST_DIRECTORY,
+			FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL,
+			OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED,
+			NULL
+		);
+		if ( m_hFolder == INVALID_HANDLE_VALUE )
+		{
+			return false;
+		}
+
+		m_hChanged = ::CreateEvent( NULL, TRUE, FALSE, NULL );
+		return Read();
+	}
+
+	// add the files and folders of a folder that arrived to the pending
+	// pathnames, which is called by the ready function for the folder
+	void AddFolder( LPCTSTR pcszFolder )
+	{
+		const CString csFolder( pcszFolder );
+		WIN32_FIND_DATA data;
+		HANDLE hFind = ::FindFirstFileEx
+		(
+			csFolder + _T( "\\*" ), FindExInfoBasic, &data,
+			FindExSearchNameMatch, NULL, FIND_FIRST_EX_LARGE_FETCH
+		);
+		if ( hFind == INVALID_HANDLE_VALUE )
+		{
+			return;
+		}
+
+		do
+		{
+			if ( 0 != _tcscmp( data.cFileName, _T( "." ) ) &&
+				0 != _tcscmp( data.cFileName, _T( ".." ) ) )
+			{
+				m_arrArrived.push_back( csFolder + _T( "\\" ) + data.cFileName );
+			}
+
+		} while ( ::FindNextFile( hFind, &data ) );
+
+		::FindClose( hFind );
+	}
+
+	// report the ready files until Stop is called
+	void Run( DWORD dwDebounce, READY fnReady, OVERFLOWED fnOverflowed )
+	{
+		// pathnames waiting to be quiet and their last event
+		map<CString, PENDING> pending;
+
+		do
+		{
+			// sleep until a change arrives, the watch is stopped or the
+			// oldest pending file has been quiet for the debounce time
+			DWORD dwTimeout = INFINITE;
+			const ULONGLONG ullNow = ::GetTickCount64();
+			for ( auto& item : pending )
+			{
+				const ULONGLONG ullElapsed = ullNow - item.second.m_ullTime;
+				const DWORD dwWait = ullElapsed >= dwDebounce ?
+					0 : (DWORD)( dwDebounce - ullElapsed );
+				dwTimeout = min( dwTimeout, dwWait );
+			}
+
+			const HANDLE handles[ 2 ] = { m_hChanged, m_hStop };
+			const DWORD dwWait =
+				::WaitForMultipleObjects( 2, handles, FALSE, dwTimeout );
+			if ( dwWait == WAIT_OBJECT_0 + 1 || dwWait == WAIT_FAILED )
+			{
+				break;
+			}
+
+			if ( dwWait == WAIT_OBJECT_0 )
+			{
+				DWORD dwBytes = 0;
+				const BOOL bResult = ::GetOverlappedResult
+				(
+					m_hFolder, &m_Overlapped, &dwBytes, FALSE
+				);
+				::ResetEvent( m_hChanged );
+
+				// zero bytes means the buffer overflowed and the
+				// changes were lost
+				if ( bResult && dwBytes != 0 )
+				{
+					Collect( dwBytes, pending, ::GetTickCount64() );
+
+				} else
+				{
+					pending.clear();
+					m_arrArrived.clear();
+					fnOverflowed();
+				}
+
+				if ( !Read() )
+				{
+					break;
+				}
+			}
+
+			// report the files that are quiet and have no writer, and
+			// give a file that is still open another debounce period
+			const ULONGLONG ullReady = ::GetTickCount64();
+			for ( auto item = pending.begin(); item != pending.end(); )
+			{
+				if ( ullReady - item->second.m_ullTime < dwDebounce )
+				{
+					++item;
+					continue;
+				}
+
+				// a folder that only changed reports its files itself
+				const DWORD dwAttributes = ::GetFileAttributes( item->first );
+				if ( dwAttributes == INVALID_FILE_ATTRIBUTES ||
+					( ( dwAttributes & FILE_ATTRIBUTE_DIRECTORY ) != 0 &&
+						!item->second.m_bArrived ) )
+				{
+					item = pending.erase( item );
+
+				} else if ( IsReady( item->first ) )
+				{
+					fnReady( item->first );
+					item = pending.erase( item );
+
+				} else
+				{
+					item->second.m_ullTime = ullReady;
+					++item;
+				}
+			}
+
+			// the entries of the folders that arrived wait like the
+			// files that reported themselves, and an entry that already
+			// has an event keeps it
+			for ( const CString& csArrived : m_arrArrived )
+			{
+				if ( pending.find( csArrived ) == pending.end() )
+				{
+					PENDING& item = pending[ csArrived ];
+					item.m_ullTime = ullReady;
+					item.m_bArrived = true;
+				}
+			}
+			m_arrArrived.clear();
+
+		} while ( true );
+	}
+
+	// end the watch which may be called from another thread
+	void Stop()
+	{
+		::SetEvent( m_hStop );
+	}
+
+	// stop reading changes and close the folder
+	void Close()
+	{
+		if ( m_hFolder != INVALID_HANDLE_VALUE )
+		{
+			::CancelIo( m_hFolder );
+			::CloseHandle( m_hFolder );
+			m_hFolder = INVALID_HANDLE_VALUE;
+		}
+
+		if ( m_hChanged != NULL )
+		{
+			::CloseHandle( m_hChanged );
+			m_hChanged = NULL;
+		}
+	}
+
+	// public construction / destruction
+public:
+	CDirectoryWatcher()
+	{
+		m_hFolder = INVALID_HANDLE_VALUE;
+		m_hChanged = NULL;
+		m_hStop = ::CreateEvent( NULL, TRUE, FALSE, NULL );
+		m_Buffer.resize( 16 * 1024 );
+		memset( &m_Overlapped, 0, sizeof( m_Overlapped ) );
+	}
+	~CDirectoryWatcher()
+	{
+		Close();
+		::CloseHandle( m_hStop );
+	}
+};
+
@@ -0,0 +1,652 @@
+/////////////////////////////////////////////////////////////////////////////
+// Copyright  by W. T. Block, all rights reserved
+/////////////////////////////////////////////////////////////////////////////
+#pragma once
+#include "stdafx.h"
+#include "BufferPool.h"
+#include "IoThrottle.h"
+#include "PayloadCheck.h"
+#include <vector>
+
+using namespace std;
+
+/////////////////////////////////////////////////////////////////////////////
+// this class reads the date properties of a JPEG or TIFF file straight
+// from the TIFF structure of its EXIF data, so only the first block of the
+// file and the few entries holding the dates are read and the image is
+// never decoded
+class CExifReader
+{
+	// protected definitions
+protected:
+	// TIFF tags of interest
+	typedef enum
+	{
+		etStripOffsets = 0x0111,
+		etStripByteCounts = 0x0117,
+		etDateTime = 0x0132,
+		etTileOffsets = 0x0144,
+		etTileByteCounts = 0x0145,
+		etExifIfd = 0x8769,
+		etOriginal = 0x9003,
+		etDigitized = 0x9004,
+	} EXIF_TAG;
+
+	// the first block read from the file which holds the date entries
+	// of almost every JPEG file, while the rest of a large EXIF segment
+	// (usually a thumbnail) is never read
+	enum { BLOCK = 16 * 1024 };
+
+	// the most entries an IFD may have before it is treated as corrupt
+	enum { MAX_ENTRIES = 1024 };
+
+	// the longest date value that is read
+	enum { MAX_DATE = 64 };
+
+	// the length of a date "YYYY:MM:DD HH:MM:SS"
+	enum { DATE_LENGTH = 19 };
+
+	// the most strips or tiles of an image that are compared
+	enum { MAX_REGIONS = 256 * 1024 };
+
+	// protected data
+protected:
+	// the open file
+	CFile m_File;
+
+	// the length of the file
+	ULONGLONG m_ullLength;
+
+	// the first block of the file in a buffer of the thread's pool
+	CPooledBuffer m_Block;
+
+	// bytes of the first block that were read
+	size_t m_nBlock;
+
+	// file offset of the TIFF header
+	ULONGLONG m_ullBase;
+
+	// the TIFF structure is little endian
+	bool m_bIntel;
+
+	// file offset of the DateTimeOriginal value, or zero when it cannot
+	// be overwritten in place
+	ULONGLONG m_ullOriginal;
+
+	// file offset of the DateTimeDigitized value, or zero when it cannot
+	// be overwritten in place
+	ULONGLONG m_ullDigitized;
+
+	// protected methods
+protected:
+	// read bytes at the given file offset, from the first block when it
+	// holds them
+	bool Read( ULONGLONG ullOffset, BYTE* pData, UINT uiLength )
+	{
+		if ( ullOffset + uiLength <= m_nBlock )
+		{
+			memcpy( pData, m_Block.Data + ullOffset, uiLength );
+			return true;
+		}
+
+		if ( ullOffset + uiLength > m_ullLength )
+		{
+			return false;
+		}
+
+		CIoThrottle::Read( uiLength );
+		m_File.Seek( ullOffset, CFile::begin );
+		return m_File.Read( pData, uiLength ) == uiLength;
+	}
+
+	// a 16 bit value in the byte order of the TIFF structure
+	inline WORD GetShort( const BYTE* pData )
+	{
+		return m_bIntel ?
+			(WORD)( pData[ 0 ] | ( pData[ 1 ] << 8 ) ) :
+			(WORD)( ( pData[ 0 ] << 8 ) | pData[ 1 ] );
+	}
+
+	// a 32 bit value in the byte order of the TIFF structure
+	inline DWORD GetLong( const BYTE* pData )
+	{
+		return m_bIntel ?
+			pData[ 0 ] | ( pData[ 1 ] << 8 ) | ( pData[ 2 ] << 16 ) |
+			( (DWORD)pData[ 3 ] << 24 ) :
+			( (DWORD)pData[ 0 ] << 24 ) | ( pData[ 1 ] << 16 ) |
+			( pData[ 2 ] << 8 ) | pData[ 3 ];
+	}
+
+	// find the TIFF header of a TIFF file or of the EXIF segment of a
+	// JPEG file. Returns false if there is none.
+	bool FindTiff()
+	{
+		const size_t nBlock = m_nBlock;
+		const BYTE* pBlock = m_Block.Data;
+		if ( nBlock >= 4 &&
+			( 0 == memcmp( pBlock, "II*\0", 4 ) || 0 == memcmp( pBlock, "MM\0*", 4 ) ) )
+		{
+			m_ullBase = 0;
+			return true;
+		}
+
+		// walk the JPEG segments up to the start of the image data
+		ULONGLONG ullOffset = 2;
+		BYTE marker[ 10 ] = { 0 };
+		while ( Read( ullOffset, marker, 4 ) && marker[ 0 ] == 0xFF )
+		{
+			const BYTE cMarker = marker[ 1 ];
+			if ( cMarker == 0xFF )
+			{
+				ullOffset++;
+				continue;
+			}
+
+			// start of scan or end of image
+			if ( cMarker == 0xDA || cMarker == 0xD9 )
+			{
+				break;
+			}
+
+			// stand alone markers have no length
+			if ( cMarker == 0x01 || ( cMarker >= 0xD0 && cMarker <= 0xD7 ) )
+			{
+				ullOffset += 2;
+				continue;
+			}
+
+			const int nLength = ( marker[ 2 ] << 8 ) | marker[ 3 ];
+			if ( nLength < 2 )
+			{
+				break;
+			}
+
+			// an APP1 segment starting with the EXIF signature
+			if ( cMarker == 0xE1 && nLength >= 2 + 6 + 8 &&
+				Read( ullOffset + 4, marker, 6 ) &&
+				0 == memcmp( marker, "Exif\0\0", 6 ) )
+			{
+				m_ullBase = ullOffset + 4 + 6;
+				return true;
+			}
+
+			ullOffset += 2 + nLength;
+		}
+
+		return false;
+	}
+
+	// read an ASCII entry of an IFD
+	bool ReadAscii( const BYTE* pEntry, CString& value )
+	{
+		const WORD wType = GetShort( pEntry + 2 );
+		const DWORD dwCount = GetLong( pEntry + 4 );
+		if ( wType != 2 || dwCount == 0 || dwCount > MAX_DATE )
+		{
+			return false;
+		}
+
+		char szValue[ MAX_DATE + 1 ] = { 0 };
+		if ( dwCount <= 4 )
+		{
+			memcpy( szValue, pEntry + 8, dwCount );
+
+		} else if ( !Read( m_ullBase + GetLong( pEntry + 8 ), (BYTE*)szValue, dwCount ) )
+		{
+			return false;
+		}
+
+		value = CStringA( szValue, (int)strnlen( szValue, dwCount ) );
+		return true;
+	}
+
+	// the file offset of the value of an ASCII entry that holds exactly a
+	// date and its terminator, or zero if it holds anything else
+	ULONGLONG GetDateOffset( const BYTE* pEntry )
+	{
+		const WORD wType = GetShort( pEntry + 2 );
+		const DWORD dwCount = GetLong( pEntry + 4 );
+		if ( wType != 2 || dwCount != DATE_LENGTH + 1 )
+		{
+			return 0;
+		}
+
+		const ULONGLONG value = m_ullBase + GetLong( pEntry + 8 );
+		return value + dwCount <= m_ullLength ? value : 0;
+	}
+
+	// read the entries of the IFD at the given offset from the TIFF header
+	bool ReadIfd( DWORD dwOffset, vector<BYTE>& entries, WORD& wEntries )
+	{
+		BYTE count[ 2 ] = { 0 };
+		if ( dwOffset == 0 || !Read( m_ullBase + dwOffset, count, 2 ) )
+		{
+			return false;
+		}
+
+		wEntries = GetShort( count );
+		if ( wEntries > MAX_ENTRIES )
+		{
+			return false;
+		}
+
+		entries.resize( wEntries * 12 );
+		return Read( m_ullBase + dwOffset + 2, entries.data(), wEntries * 12 );
+	}
+
+	// read the SHORT or LONG values of an entry of an IFD
+	bool ReadValues( const BYTE* pEntry, vector<ULONGLONG>& values )
+	{
+		const WORD wType = GetShort( pEntry + 2 );
+		const DWORD dwCount = GetLong( pEntry + 4 );
+		const UINT uiSize = wType == 3 ? 2 : wType == 4 ? 4 : 0;
+		if ( uiSize == 0 || dwCount == 0 || dwCount > MAX_REGIONS )
+		{
+			return false;
+		}
+
+		vector<BYTE> data( dwCount * uiSize );
+		if ( data.size() <= 4 )
+		{
+			memcpy( data.data(), pEntry + 8, data.size() );
+
+		} else if ( !Read( m_ullBase + GetLong( pEntry + 8 ), data.data(), (UINT)data.size() ) )
+		{
+			return false;
+		}
+
+		values.resize( dwCount );
+		for ( DWORD dwValue = 0; dwValue < dwCount; dwValue++ )
+		{
+			const BYTE* pValue = data.data() + dwValue * uiSize;
+			values[ dwValue ] = uiSize == 2 ? GetShort( pValue ) : GetLong( pValue );
+		}
+		return true;
+	}
+
+	// find the image data of the open file after its dates were read,
+	// which is the scan data of a JPEG file up to the end of the file or
+	// the strips or tiles of the first image of a TIFF file. Returns false
+	// if the image data cannot be found.
+	bool ReadPayload( vector<PAYLOAD_RANGE>& ranges )
+	{
+		ranges.clear();
+
+		// walk the JPEG segments up to the start of the scan
+		if ( m_nBlock >= 2 && m_Block.Data[ 0 ] == 0xFF && m_Block.Data[ 1 ] == 0xD8 )
+		{
+			ULONGLONG ullOffset = 2;
+			BYTE marker[ 4 ] = { 0 };
+			while ( Read( ullOffset, marker, 4 ) && marker[ 0 ] == 0xFF )
+			{
+				const BYTE cMarker = marker[ 1 ];
+				if ( cMarker == 0xFF )
+				{
+					ullOffset++;
+					continue;
+				}
+
+				if ( cMarker == 0xDA )
+				{
+					PAYLOAD_RANGE range;
+					range.m_ullOffset = ullOffset;
+					range.m_ullLength = m_ullLength - ullOffset;
+					ranges.push_back( range );
+					return true;
+				}
+
+				if ( cMarker == 0xD9 )
+				{
+					break;
+				}
+
+				if ( cMarker == 0x01 || ( cMarker >= 0xD0 && cMarker <= 0xD7 ) )
+				{
+					ullOffset += 2;
+					continue;
+				}
+
+				const int nLength = ( marker[ 2 ] << 8 ) | marker[ 3 ];
+				if ( nLength < 2 )
+				{
+					break;
+				}
+				ullOffset += 2 + nLength;
+			}
+
+			return false;
+		}
+
+		// the strips or tiles of IFD0 and their lengths
+		BYTE header[ 8 ] = { 0 };
+		vector<BYTE> entries;
+		WORD wEntries = 0;
+		if ( !Read( m_ullBase, header, 8 ) ||
+			!ReadIfd( GetLong( header + 4 ), entries, wEntries ) )
+		{
+			return false;
+		}
+
+		vector<ULONGLONG> offsets;
+		vector<ULONGLONG> lengths;
+		for ( WORD wEntry = 0; wEntry < wEntries; wEntry++ )
+		{
+			const BYTE* pEntry = entries.data() + wEntry * 12;
+			const WORD wTag = GetShort( pEntry );
+			if ( wTag == etStripOffsets || wTag == etTileOffsets )
+			{
+				ReadValues( pEntry, offsets );
+
+			} else if ( wTag == etStripByteCounts || wTag == etTileByteCounts )
+			{
+				ReadValues( pEntry, lengths );
+			}
+		}
+
+		if ( offsets.empty() || offsets.size() != lengths.size() )
+		{
+			return false;
+		}
+
+		// a region that runs past the end of the file is cut short
+		for ( size_t nRegion = 0; nRegion < offsets.size(); nRegion++ )
+		{
+			const ULONGLONG ullOffset = m_ullBase + offsets[ nRegion ];
+			if ( ullOffset >= m_ullLength )
+			{
+				continue;
+			}
+
+			PAYLOAD_RANGE range;
+			range.m_ullOffset = ullOffset;
+			range.m_ullLength = min( lengths[ nRegion ], m_ullLength - ullOffset );
+			ranges.push_back( range );
+		}
+
+		return !ranges.empty();
+	}
+
+	// overwrite the part of the date value at the given file offset that
+	// falls in a block read from the given file offset
+	static void StampDate
+	(
+		BYTE* pData, ULONGLONG ullOffset, UINT uiLength, ULONGLONG ullDate,
+		LPCSTR pcszDate
+	)
+	{
+		const ULONGLONG ullFrom = max( ullOffset, ullDate );
+		const ULONGLONG ullTo = min( ullOffset + uiLength, ullDate + DATE_LENGTH );
+		if ( ullFrom < ullTo )
+		{
+			memcpy
+			(
+				pData + ( ullFrom - ullOffset ), pcszDate + ( ullFrom - ullDate ),
+				(size_t)( ullTo - ullFrom )
+			);
+		}
+	}
+
+	// read the dates of the open file. Returns false if it is not a JPEG
+	// or TIFF file.
+	bool ReadDates( CString& csOriginal, CString& csDigitized, CString& csDateTime )
+	{
+		m_ullLength = m_File.GetLength();
+		if ( m_Block.Data == nullptr )
+		{
+			return false;
+		}
+
+		const UINT uiBlock = (UINT)min( m_ullLength, (ULONGLONG)BLOCK );
+		CIoThrottle::Read( uiBlock );
+		if ( m_File.Read( m_Block.Data, uiBlock ) != uiBlock || uiBlock < 4 )
+		{
+			return false;
+		}
+		m_nBlock = uiBlock;
+
+		const bool bJpeg = m_Block.Data[ 0 ] == 0xFF && m_Block.Data[ 1 ] == 0xD8;
+		if ( !FindTiff() )
+		{
+			// a JPEG file without EXIF data has no dates
+			return bJpeg;
+		}
+
+		BYTE header[ 8 ] = { 0 };
+		if ( !Read( m_ullBase, header, 8 ) )
+		{
+			return bJpeg;
+		}
+		m_bIntel = header[ 0 ] == 'I';
+
+		// IFD0 holds the date and time the file was changed and the
+		// offset of the EXIF IFD which holds the other dates
+		vector<BYTE> entries;
+		WORD wEntries = 0;
+		DWORD dwExif = 0;
+		if ( ReadIfd( GetLong( header + 4 ), entries, wEntries ) )
+		{
+			for ( WORD wEntry = 0; wEntry < wEntries; wEntry++ )
+			{
+				const BYTE* pEntry = entries.data() + wEntry * 12;
+				const WORD wTag = GetShort( pEntry );
+				if ( wTag == etDateTime )
+				{
+					ReadAscii( pEntry, csDateTime );
+
+				} else if ( wTag == etExifIfd )
+				{
+					dwExif = GetLong( pEntry + 8 );
+				}
+			}
+		}
+
+		if ( ReadIfd( dwExif, entries, wEntries ) )
+		{
+			for ( WORD wEntry = 0; wEntry < wEntries; wEntry++ )
+			{
+				const BYTE* pEntry = entries.data() + wEntry * 12;
+				const WORD wTag = GetShort( pEntry );
+				if ( wTag == etOriginal )
+				{
+					ReadAscii( pEntry, csOriginal );
+					m_ullOriginal = GetDateOffset( pEntry );
+
+				} else if ( wTag == etDigitized )
+				{
+					ReadAscii( pEntry, csDigitized );
+					m_ullDigitized = GetDateOffset( pEntry );
+				}
+			}
+		}
+
+		return true;
+	}
+
+	// public methods
+public:
+	/////////////////////////////////////////////////////////////////////////
+	// read the DateTimeOriginal, DateTimeDigitized and DateTime of the
+	// given JPEG or TIFF file, which are empty when the file does not have
+	// them. The hash of the first block, which is already in memory, is
+	// returned if asked for. Returns false if the file cannot be read or
+	// is another kind of image, which is left for GDI+ to read.
+	static bool GetDates
+	(
+		LPCTSTR pcszPath, CString& csOriginal, CString& csDigitized,
+		CString& csDateTime, ULONGLONG* pullHead = nullptr
+	)
+	{
+		csOriginal.Empty();
+		csDigitized.Empty();
+		csDateTime.Empty();
+
+		CExifReader reader;
+		if ( !reader.m_File.Open
+		(
+			pcszPath,
+			CFile::modeRead | CFile::shareDenyWrite | CFile::typeBinary
+		) )
+		{
+			return false;
+		}
+
+		bool value = false;
+
+		try
+		{
+			value = reader.ReadDates( csOriginal, csDigitized, csDateTime );
+			if ( value && pullHead != nullptr )
+			{
+				CContentHash hash;
+				hash.Update( reader.m_Block.Data, reader.m_nBlock );
+				*pullHead = hash.Final();
+			}
+
+		} catch ( CFileException* pException )
+		{
+			pException->Delete();
+			value = false;
+		}
+
+		reader.m_File.Close();
+		return value;
+	}
+
+	/////////////////////////////////////////////////////////////////////////
+	// copy the given JPEG or TIFF file to the target and overwrite its
+	// DateTimeOriginal and DateTimeDigitized values in place with the given
+	// Date Taken formatted date, so the image is streamed through a block
+	// at a time and never decoded. The dates are stamped into the blocks as
+	// they pass, and the given payload check, if any, hashes the image data
+	// of each block as it is read, before any date is stamped. Returns
+	// false if the file does not have both dates as values the width of a
+	// date or cannot be copied.
+	static bool WriteWithDates
+	(
+		LPCTSTR pcszSource, LPCTSTR pcszTarget, LPCSTR pcszDate,
+		CPayloadCheck* pCheck = nullptr
+	)
+	{
+		if ( strlen( pcszDate ) != DATE_LENGTH )
+		{
+			return false;
+		}
+
+		CExifReader reader;
+		if ( !reader.m_File.Open
+		(
+			pcszSource,
+			CFile::modeRead | CFile::shareDenyWrite | CFile::typeBinary
+		) )
+		{
+			return false;
+		}
+
+		bool value = false;
+
+		// set once the target is created so a failure removes it
+		bool bCreated = false;
+
+		try
+		{
+			CString csOriginal;
+			CString csDigitized;
+			CString csDateTime;
+			if ( !reader.ReadDates( csOriginal, csDigitized, csDateTime ) ||
+				reader.m_ullOriginal == 0 || reader.m_ullDigitized == 0 )
+			{
+				reader.m_File.Close();
+				return false;
+			}
+
+			CFile target;
+			if ( !target.Open
+			(
+				pcszTarget,
+				CFile::modeCreate | CFile::modeWrite | CFile::typeBinary
+			) )
+			{
+				reader.m_File.Close();
+				return false;
+			}
+			bCreated = true;
+
+			// the image data is found while the first block is still
+			// intact, and nothing is compared if it cannot be found
+			if ( pCheck != nullptr )
+			{
+				vector<PAYLOAD_RANGE> ranges;
+				if ( reader.ReadPayload( ranges ) )
+				{
+					pCheck->Start( ranges, 0 );
+
+				} else
+				{
+					pCheck->Reset();
+				}
+			}
+
+			// the first block is already read, so the copy goes on
+			// from there
+			BYTE* pData = reader.m_Block.Data;
+			ULONGLONG ullOffset = 0;
+			UINT uiRead = (UINT)reader.m_nBlock;
+			reader.m_File.Seek( reader.m_nBlock, CFile::begin );
+			do
+			{
+				if ( pCheck != nullptr )
+				{
+					pCheck->Read( ullOffset, pData, uiRead );
+				}
+
+				StampDate( pData, ullOffset, uiRead, reader.m_ullOriginal, pcszDate );
+				StampDate( pData, ullOffset, uiRead, reader.m_ullDigitized, pcszDate );
+
+				CIoThrottle::Write( uiRead );
+				target.Write( pData, uiRead );
+				ullOffset += uiRead;
+
+				uiRead = reader.m_File.Read( pData, (UINT)reader.m_Block.Size );
+				if ( uiRead != 0 )
+				{
+					CIoThrottle::Read( uiRead );
+				}
+
+			} while ( uiRead != 0 );
+
+			target.Close();
+			value = true;
+
+		} catch ( CFileException* pException )
+		{
+			pException->Delete();
+			value = false;
+
+			// the target was closed as it went out of scope, and a part
+			// of a copy must not pass for a finished output
+			if ( bCreated )
+			{
+				::DeleteFile( pcszTarget );
+			}
+		}
+
+		reader.m_File.Close();
+		return value;
+	}
+
+	// protected construction
+protected:
+	CExifReader() : m_Block( BLOCK )
+	{
+		m_nBlock = 0;
+		m_ullLength = 0;
+		m_ullBase = 0;
+		m_bIntel = false;
+		m_ullOriginal = 0;
+		m_ullDigitized = 0;
+	}
+	~CExifReader()
+	{
+	}
+};
+
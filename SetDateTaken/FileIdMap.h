@@ -0,0 +1,150 @@
+/////////////////////////////////////////////////////////////////////////////
+// Copyright  by W. T. Block, all rights reserved
+/////////////////////////////////////////////////////////////////////////////
+#pragma once
+#include "stdafx.h"
+#include <unordered_map>
+
+using namespace std;
+
+/////////////////////////////////////////////////////////////////////////////
+// the identity of a file or folder which is the same for every name that
+// leads to it, whether a hard link, a junction or a symbolic link
+typedef struct tagFileId
+{
+	// serial number of the volume holding the file
+	DWORD m_dwVolume;
+
+	// index of the file on the volume
+	ULONGLONG m_ullIndex;
+
+	bool operator==( const tagFileId& other ) const
+	{
+		return m_dwVolume == other.m_dwVolume && m_ullIndex == other.m_ullIndex;
+	}
+
+} FILE_ID;
+
+/////////////////////////////////////////////////////////////////////////////
+// template class that records the first visit of each file identity along
+// with a value describing it. The map is split into stripes with their own
+// locks so concurrent visitors seldom wait for one another.
+template<class TYPE>
+class CFileIdMap
+{
+	// protected definitions
+protected:
+	// the number of stripes which is a power of two
+	enum { STRIPES = 16 };
+
+	// hash of a file identity
+	struct FILE_ID_HASH
+	{
+		size_t operator()( const FILE_ID& id ) const
+		{
+			return hash<ULONGLONG>()( id.m_ullIndex ^ ( (ULONGLONG)id.m_dwVolume << 32 ) );
+		}
+	};
+
+	// one stripe of the map
+	typedef struct tagStripe
+	{
+		CCriticalSection m_Lock;
+		unordered_map<FILE_ID, TYPE, FILE_ID_HASH> m_mapItems;
+
+	} STRIPE;
+
+	// protected data
+protected:
+	// the stripes of the map
+	STRIPE m_Stripes[ STRIPES ];
+
+	// public methods
+public:
+	/////////////////////////////////////////////////////////////////////////
+	// get the identity of the given file or folder, following links to
+	// their target, and the number of hard links to it. Returns false if
+	// the file cannot be opened.
+	static bool GetFileId( LPCTSTR pcszPath, FILE_ID& id, DWORD& dwLinks )
+	{
+		// no access is needed to read the identity and the backup
+		// semantics allow a folder to be opened
+		HANDLE hFile = ::CreateFile
+		(
+			pcszPath, 0,
+			FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL,
+			OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS, NULL
+		);
+		if ( hFile == INVALID_HANDLE_VALUE )
+		{
+			return false;
+		}
+
+		BY_HANDLE_FILE_INFORMATION info;
+		const BOOL bInfo = ::GetFileInformationByHandle( hFile, &info );
+		::CloseHandle( hFile );
+		if ( !bInfo )
+		{
+			return false;
+		}
+
+		id.m_dwVolume = info.dwVolumeSerialNumber;
+		id.m_ullIndex =
+			( (ULONGLONG)info.nFileIndexHigh << 32 ) | info.nFileIndexLow;
+		dwLinks = info.nNumberOfLinks;
+		return true;
+	}
+
+	// record the visit of the given identity and return true if it is
+	// the first visit, otherwise return the value of the first visit
+	bool Visit( const FILE_ID& id, const TYPE& value, TYPE& first )
+	{
+		STRIPE& stripe = m_Stripes[ FILE_ID_HASH()( id ) & ( STRIPES - 1 ) ];
+		CSingleLock lock( &stripe.m_Lock, TRUE );
+
+		const auto result = stripe.m_mapItems.insert( make_pair( id, value ) );
+		if ( !result.second )
+		{
+			first = result.first->second;
+		}
+
+		return result.second;
+	}
+
+	// return true with the value of the first visit if the given
+	// identity has been visited without recording a visit
+	bool Find( const FILE_ID& id, TYPE& first )
+	{
+		STRIPE& stripe = m_Stripes[ FILE_ID_HASH()( id ) & ( STRIPES - 1 ) ];
+		CSingleLock lock( &stripe.m_Lock, TRUE );
+
+		const auto found = stripe.m_mapItems.find( id );
+		if ( found == stripe.m_mapItems.end() )
+		{
+			return false;
+		}
+
+		first = found->second;
+		return true;
+	}
+
+	// forget every visit
+	void Clear()
+	{
+		for ( STRIPE& stripe : m_Stripes )
+		{
+			CSingleLock lock( &stripe.m_Lock, TRUE );
+			stripe.m_mapItems.clear();
+		}
+	}
+
+	// public construction
+public:
+	CFileIdMap()
+	{
+	}
+	~CFileIdMap()
+	{
+	}
+};
+
@@ -0,0 +1,384 @@
+/////////////////////////////////////////////////////////////////////////////
+// Copyright  by W. T. Block, all rights reserved
+/////////////////////////////////////////////////////////////////////////////
+#pragma once
+#include "stdafx.h"
+#include <vector>
+
+using namespace std;
+
+/////////////////////////////////////////////////////////////////////////////
+// this class holds the include and exclude patterns that select the files
+// of a tree by their path relative to the root of the tree. Each pattern is
+// compiled once into the steps of a small automaton which is run against a
+// path in a single pass without backtracking. The patterns follow the
+// usual rules:
+//		*	matches any characters within one folder or file name
+//		?	matches one character within one folder or file name
+//		**	matches any number of folders
+// and a pattern without a path separator matches a name at any depth, so
+// "@eaDir" excludes every folder of that name. Matches ignore case and
+// either slash may separate the names.
+class CGlobFilter
+{
+	// protected definitions
+protected:
+	// the kind of a step of a compiled pattern
+	typedef enum
+	{
+		// one given character
+		gtLiteral = 0,
+
+		// one character other than a separator (?)
+		gtAnyChar = gtLiteral + 1,
+
+		// any characters other than a separator (*)
+		gtStar = gtAnyChar + 1,
+
+		// nothing, or any characters ending in a separator (**/)
+		gtGlobFolders = gtStar + 1,
+
+		// any characters including separators (** at the end)
+		gtGlobStar = gtGlobFolders + 1,
+
+	} GLOB_TOKEN;
+
+	// one step of a compiled pattern
+	typedef struct tagGlobStep
+	{
+		GLOB_TOKEN m_eToken;
+		TCHAR m_cChar;
+
+	} GLOB_STEP;
+
+	// a compiled pattern which is accepted when the last step is passed
+	typedef vector<GLOB_STEP> GLOB_PROGRAM;
+
+	// protected data
+protected:
+	// a file must match one of these if there are any
+	vector<GLOB_PROGRAM> m_Include;
+
+	// a file or folder matching one of these is skipped
+	vector<GLOB_PROGRAM> m_Exclude;
+
+	// protected methods
+protected:
+	// both slashes separate the names
+	static inline bool IsSeparator( TCHAR cChar )
+	{
+		return cChar == _T( '/' ) || cChar == _T( '\\' );
+	}
+
+	// compile a pattern into the steps of the automaton
+	static GLOB_PROGRAM Compile( CString csPattern )
+	{
+		csPattern.Trim();
+		csPattern.Replace( _T( '\\' ), _T( '/' ) );
+		if ( csPattern.Left( 2 ) == _T( "./" ) )
+		{
+			csPattern = csPattern.Mid( 2 );
+		}
+		csPattern.TrimLeft( _T( '/' ) );
+		csPattern.MakeLower();
+
+		// a name without a folder matches at any depth
+		if ( csPattern.Find( _T( '/' ) ) == -1 )
+		{
+			csPattern = _T( "**/" ) + csPattern;
+		}
+
+		GLOB_PROGRAM value;
+		const int nLength = csPattern.GetLength();
+		for ( int nChar = 0; nChar < nLength; nChar++ )
+		{
+			GLOB_STEP step = { gtLiteral, csPattern[ nChar ] };
+			if ( step.m_cChar == _T( '?' ) )
+			{
+				step.m_eToken = gtAnyChar;
+
+			} else if ( step.m_cChar == _T( '*' ) )
+			{
+				step.m_eToken = gtStar;
+				if ( nChar + 1 < nLength && csPattern[ nChar + 1 ] == _T( '*' ) )
+				{
+					nChar++;
+					if ( nChar + 1 < nLength && csPattern[ nChar + 1 ] == _T( '/' ) )
+					{
+						nChar++;
+						step.m_eToken = gtGlobFolders;
+
+					} else
+					{
+						step.m_eToken = gtGlobStar;
+					}
+				}
+			}
+
+			value.push_back( step );
+		}
+
+		return value;
+	}
+
+	// follow the steps that may match nothing, which are all of the
+	// wild card steps except the single character. The folders (**/) only
+	// match nothing at the start of the path or after a separator, so a
+	// name is never matched by its tail.
+	static void Close
+	(
+		const GLOB_PROGRAM& program, vector<char>& states, bool bBoundary
+	)
+	{
+		const size_t nSteps = program.size();
+		for ( size_t nStep = 0; nStep < nSteps; nStep++ )
+		{
+			const GLOB_TOKEN eToken = program[ nStep ].m_eToken;
+			if ( !states[ nStep ] || eToken < gtStar )
+			{
+				continue;
+			}
+
+			if ( eToken != gtGlobFolders || bBoundary )
+			{
+				states[ nStep + 1 ] = 1;
+			}
+		}
+	}
+
+	// advance the states by one character and return false if no state
+	// is left
+	static bool Step
+	(
+		const GLOB_PROGRAM& program, vector<char>& states,
+		vector<char>& next, TCHAR cChar
+	)
+	{
+		const bool bSeparator = IsSeparator( cChar );
+		const size_t nSteps = program.size();
+		bool bAlive = false;
+		fill( next.begin(), next.end(), 0 );
+		for ( size_t nStep = 0; nStep < nSteps; nStep++ )
+		{
+			if ( !states[ nStep ] )
+			{
+				continue;
+			}
+
+			const GLOB_STEP& step = program[ nStep ];
+			switch ( step.m_eToken )
+			{
+				case gtLiteral:
+				{
+					const bool bMatch = bSeparator ?
+						IsSeparator( step.m_cChar ) : step.m_cChar == cChar;
+					if ( bMatch )
+					{
+						next[ nStep + 1 ] = bAlive = true;
+					}
+					break;
+				}
+				case gtAnyChar:
+				{
+					if ( !bSeparator )
+					{
+						next[ nStep + 1 ] = bAlive = true;
+					}
+					break;
+				}
+				case gtStar:
+				{
+					if ( !bSeparator )
+					{
+						next[ nStep ] = bAlive = true;
+					}
+					break;
+				}
+				case gtGlobFolders:
+				{
+					next[ nStep ] = bAlive = true;
+					if ( bSeparator )
+					{
+						next[ nStep + 1 ] = 1;
+					}
+					break;
+				}
+				case gtGlobStar:
+				{
+					next[ nStep ] = bAlive = true;
+					break;
+				}
+			}
+		}
+
+		states.swap( next );
+		Close( program, states, bSeparator );
+		return bAlive;
+	}
+
+	// run the automaton over the given lower case path. When prefixes
+	// are allowed, a match of any folder along the path counts, so a file
+	// below an excluded folder is excluded too. When live is asked for,
+	// the result is whether anything below the path could still match.
+	static bool Run
+	(
+		const GLOB_PROGRAM& program, const CString& csPath,
+		bool bPrefixes, bool bLive = false
+	)
+	{
+		const size_t nSteps = program.size();
+		vector<char> states( nSteps + 1, 0 );
+		vector<char> next( nSteps + 1, 0 );
+		states[ 0 ] = 1;
+		Close( program, states, true );
+
+		const int nLength = csPath.GetLength();
+		for ( int nChar = 0; nChar < nLength; nChar++ )
+		{
+			const TCHAR cChar = csPath[ nChar ];
+			if ( bPrefixes && IsSeparator( cChar ) && states[ nSteps ] )
+			{
+				return true;
+			}
+
+			if ( !Step( program, states, next, cChar ) )
+			{
+				return false;
+			}
+		}
+
+		if ( bLive )
+		{
+			return true;
+		}
+
+		return states[ nSteps ] != 0;
+	}
+
+	// return true if one of the given programs matches the path
+	static bool Any
+	(
+		const vector<GLOB_PROGRAM>& programs, const CString& csPath,
+		bool bPrefixes, bool bLive = false
+	)
+	{
+		for ( const GLOB_PROGRAM& program : programs )
+		{
+			if ( Run( program, csPath, bPrefixes, bLive ) )
+			{
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+	// public properties
+public:
+	// true if there are no patterns
+	inline bool GetEmpty()
+	{
+		return m_Include.empty() && m_Exclude.empty();
+	}
+	// true if there are no patterns
+	__declspec( property( get = GetEmpty ) )
+		bool Empty;
+
+	// public methods
+public:
+	// add a pattern a file must match (one of) to be processed
+	void AddInclude( LPCTSTR pcszPattern )
+	{
+		m_Include.push_back( Compile( pcszPattern ) );
+	}
+
+	// add a pattern of files or folders to be skipped
+	void AddExclude( LPCTSTR pcszPattern )
+	{
+		m_Exclude.push_back( Compile( pcszPattern ) );
+	}
+
+	// return true if the folder with the given relative path should not
+	// be opened, either because it is excluded or because no include
+	// pattern can match anything below it
+	bool IsPrunedFolder( LPCTSTR pcszRelative )
+	{
+		if ( Empty )
+		{
+			return false;
+		}
+
+		const CString csPath = CString( pcszRelative ).MakeLower();
+		if ( Any( m_Exclude, csPath, true ) || Any( m_Exclude, csPath + _T( "/" ), true ) )
+		{
+			return true;
+		}
+
+		return !m_Include.empty() && !Any( m_Include, csPath + _T( "/" ), false, true );
+	}
+
+	// return true if the file with the given relative path is selected
+	bool IsSelectedFile( LPCTSTR pcszRelative )
+	{
+		if ( Empty )
+		{
+			return true;
+		}
+
+		const CString csPath = CString( pcszRelative ).MakeLower();
+		if ( Any( m_Exclude, csPath, true ) )
+		{
+			return false;
+		}
+
+		return m_Include.empty() || Any( m_Include, csPath, false );
+	}
+
+#ifdef _DEBUG
+	// check the matches that are easy to get wrong and return the number
+	// of checks that failed. Only run when asked for with --self-test.
+	static int SelfTest()
+	{
+		int value = 0;
+		const auto check = [ &value ]( bool bPassed )
+		{
+			if ( !bPassed )
+			{
+				value++;
+			}
+		};
+
+		CGlobFilter corrected;
+		corrected.AddExclude( _T( "corrected" ) );
+		check( corrected.IsPrunedFolder( _T( "Corrected" ) ) );
+		check( corrected.IsPrunedFolder( _T( "2019\\Corrected" ) ) );
+		check( !corrected.IsPrunedFolder( _T( "Uncorrected" ) ) );
+		check( corrected.IsSelectedFile( _T( "Uncorrected\\a.jpg" ) ) );
+
+		CGlobFilter synology;
+		synology.AddExclude( _T( "@eaDir" ) );
+		check( synology.IsPrunedFolder( _T( "2019\\@eaDir" ) ) );
+		check( !synology.IsPrunedFolder( _T( "x@eadir" ) ) );
+		check( !synology.IsSelectedFile( _T( "@eaDir\\a.jpg" ) ) );
+
+		CGlobFilter folders;
+		folders.AddInclude( _T( "a/**/b" ) );
+		check( folders.IsSelectedFile( _T( "a/b" ) ) );
+		check( folders.IsSelectedFile( _T( "a/x/y/b" ) ) );
+		check( !folders.IsSelectedFile( _T( "a/xb" ) ) );
+		check( !folders.IsSelectedFile( _T( "a/x/yb" ) ) );
+
+		return value;
+	}
+#endif
+
+	// public construction
+public:
+	CGlobFilter()
+	{
+	}
+	~CGlobFilter()
+	{
+	}
+};
+
@@ -0,0 +1,316 @@
+/////////////////////////////////////////////////////////////////////////////
+// Copyright  by W. T. Block, all rights reserved
+/////////////////////////////////////////////////////////////////////////////
+#pragma once
+#include "stdafx.h"
+
+/////////////////////////////////////////////////////////////////////////////
+// this class bounds the bytes read, the bytes written and the number of
+// read and write operations per second of all of the workers together, so
+// a run on shared storage has a known impact on its other users. Each
+// limit is a token bucket that refills at the limit per second and holds
+// at most one second of tokens. A worker takes the tokens of each read or
+// write and sleeps off any shortfall outside the lock, so the workers are
+// served in the order they asked. The limits may be changed while running
+// through a control file which is checked at most once per second. Every
+// read and write passes through here, so the totals of the bytes read and
+// written are kept here as well, along with a tally of the bytes each
+// thread moved since the tally was reset.
+class CIoThrottle
+{
+	// protected definitions
+protected:
+	// the buckets
+	enum { tbRead = 0, tbWrite = tbRead + 1, tbOps = tbWrite + 1, BUCKETS };
+
+	// the bytes of a megabyte
+	enum { MEGABYTE = 1024 * 1024 };
+
+	// milliseconds between checks of the control file
+	enum { CONTROL_PERIOD = 1000 };
+
+	// one token bucket
+	typedef struct tagBucket
+	{
+		// tokens added per second where zero is no limit
+		double m_dRate;
+
+		// tokens available which is negative while workers wait
+		double m_dTokens;
+
+		// tick count of the last refill
+		ULONGLONG m_ullTime;
+
+		// change the rate and start with a full bucket
+		void SetRate( double dRate, ULONGLONG ullNow )
+		{
+			m_dRate = dRate > 0 ? dRate : 0;
+			m_dTokens = m_dRate;
+			m_ullTime = ullNow;
+		}
+
+		// take the given number of tokens and return the milliseconds the
+		// caller has to wait for them
+		double Take( double dTokens, ULONGLONG ullNow )
+		{
+			if ( m_dRate <= 0 )
+			{
+				return 0;
+			}
+
+			const double dElapsed = (double)( ullNow - m_ullTime ) / 1000;
+			m_dTokens = min( m_dRate, m_dTokens + m_dRate * dElapsed );
+			m_ullTime = ullNow;
+
+			m_dTokens -= dTokens;
+			return m_dTokens < 0 ? -m_dTokens * 1000 / m_dRate : 0;
+		}
+
+		tagBucket()
+		{
+			m_dRate = 0;
+			m_dTokens = 0;
+			m_ullTime = 0;
+		}
+
+	} BUCKET;
+
+	// the state shared by all of the workers
+	typedef struct tagThrottleState
+	{
+		// the buckets
+		BUCKET m_Buckets[ BUCKETS ];
+
+		// the control file, if any
+		CString m_csControlFile;
+
+		// last write time of the control file when it was read
+		FILETIME m_ftControl;
+
+		// tick count of the last check of the control file
+		ULONGLONG m_ullChecked;
+
+		// any limit or a control file is given
+		volatile bool m_bEnabled;
+
+		// the bytes read and written by all of the workers
+		volatile LONGLONG m_llRead;
+		volatile LONGLONG m_llWritten;
+
+		// guards the buckets
+		CCriticalSection m_Lock;
+
+		tagThrottleState()
+		{
+			m_ftControl.dwLowDateTime = 0;
+			m_ftControl.dwHighDateTime = 0;
+			m_ullChecked = 0;
+			m_bEnabled = false;
+			m_llRead = 0;
+			m_llWritten = 0;
+		}
+
+	} THROTTLE_STATE;
+
+	// protected methods
+protected:
+	// the bytes the calling thread read and wrote since its tally was
+	// reset
+	static ULONGLONG& GetTally()
+	{
+		static thread_local ULONGLONG value = 0;
+		return value;
+	}
+
+	// the state shared by all of the workers
+	static THROTTLE_STATE& GetState()
+	{
+		static THROTTLE_STATE value;
+		return value;
+	}
+
+	// set the limits where a negative value leaves a limit as it is
+	// (the caller holds the lock)
+	static void ApplyLimits
+	(
+		THROTTLE_STATE& state, double dReadMbps, double dWriteMbps,
+		double dIops
+	)
+	{
+		const ULONGLONG ullNow = ::GetTickCount64();
+		if ( dReadMbps >= 0 )
+		{
+			state.m_Buckets[ tbRead ].SetRate( dReadMbps * MEGABYTE, ullNow );
+		}
+		if ( dWriteMbps >= 0 )
+		{
+			state.m_Buckets[ tbWrite ].SetRate( dWriteMbps * MEGABYTE, ullNow );
+		}
+		if ( dIops >= 0 )
+		{
+			state.m_Buckets[ tbOps ].SetRate( dIops, ullNow );
+		}
+
+		state.m_bEnabled =
+			!state.m_csControlFile.IsEmpty() ||
+			state.m_Buckets[ tbRead ].m_dRate > 0 ||
+			state.m_Buckets[ tbWrite ].m_dRate > 0 ||
+			state.m_Buckets[ tbOps ].m_dRate > 0;
+	}
+
+	// read the limits from the control file if it changed since it was
+	// last read. Each line of the file is one of
+	//   max-read-mbps=value
+	//   max-write-mbps=value
+	//   max-iops=value
+	// where zero removes the limit and a limit that is not in the file
+	// keeps its value (the caller holds the lock).
+	static void CheckControlFile( THROTTLE_STATE& state, ULONGLONG ullNow )
+	{
+		if ( state.m_csControlFile.IsEmpty() )
+		{
+			return;
+		}
+		if ( ullNow - state.m_ullChecked < CONTROL_PERIOD && state.m_ullChecked != 0 )
+		{
+			return;
+		}
+		state.m_ullChecked = ullNow;
+
+		WIN32_FILE_ATTRIBUTE_DATA data;
+		if ( !::GetFileAttributesEx( state.m_csControlFile, GetFileExInfoStandard, &data ) ||
+			::CompareFileTime( &data.ftLastWriteTime, &state.m_ftControl ) == 0 )
+		{
+			return;
+		}
+
+		CStdioFile file;
+		if ( !file.Open( state.m_csControlFile, CFile::modeRead | CFile::shareDenyNone ) )
+		{
+			return;
+		}
+		state.m_ftControl = data.ftLastWriteTime;
+
+		double dReadMbps = -1;
+		double dWriteMbps = -1;
+		double dIops = -1;
+		CString csLine;
+		while ( file.ReadString( csLine ) )
+		{
+			const int nEqual = csLine.Find( _T( '=' ) );
+			if ( nEqual == -1 )
+			{
+				continue;
+			}
+
+			const CString csKey = csLine.Left( nEqual ).Trim().MakeLower();
+			const double dValue = _tstof( csLine.Mid( nEqual + 1 ).Trim() );
+			if ( csKey == _T( "max-read-mbps" ) )
+			{
+				dReadMbps = dValue;
+
+			} else if ( csKey == _T( "max-write-mbps" ) )
+			{
+				dWriteMbps = dValue;
+
+			} else if ( csKey == _T( "max-iops" ) )
+			{
+				dIops = dValue;
+			}
+		}
+		file.Close();
+
+		ApplyLimits( state, dReadMbps, dWriteMbps, dIops );
+	}
+
+	// take the tokens of one operation of the given bytes and wait for
+	// them outside of the lock
+	static void Charge( int nBucket, ULONGLONG ullBytes )
+	{
+		THROTTLE_STATE& state = GetState();
+		InterlockedExchangeAdd64
+		(
+			nBucket == tbRead ? &state.m_llRead : &state.m_llWritten,
+			(LONGLONG)ullBytes
+		);
+		GetTally() += ullBytes;
+		if ( !state.m_bEnabled )
+		{
+			return;
+		}
+
+		double dWait = 0;
+		{
+			CSingleLock lock( &state.m_Lock, TRUE );
+			const ULONGLONG ullNow = ::GetTickCount64();
+			CheckControlFile( state, ullNow );
+
+			const double dBytes = state.m_Buckets[ nBucket ].Take( (double)ullBytes, ullNow );
+			const double dOps = state.m_Buckets[ tbOps ].Take( 1, ullNow );
+			dWait = max( dBytes, dOps );
+		}
+
+		if ( dWait >= 1 )
+		{
+			::Sleep( (DWORD)dWait );
+		}
+	}
+
+	// public methods
+public:
+	// set the limits in megabytes per second and operations per second,
+	// where zero is no limit
+	static void SetLimits( double dReadMbps, double dWriteMbps, double dIops )
+	{
+		THROTTLE_STATE& state = GetState();
+		CSingleLock lock( &state.m_Lock, TRUE );
+		ApplyLimits( state, dReadMbps, dWriteMbps, dIops );
+	}
+
+	// change the limits while running from the given control file
+	static void SetControlFile( LPCTSTR pcszPath )
+	{
+		THROTTLE_STATE& state = GetState();
+		CSingleLock lock( &state.m_Lock, TRUE );
+		state.m_csControlFile = pcszPath;
+		state.m_ullChecked = 0;
+		ApplyLimits( state, -1, -1, -1 );
+	}
+
+	// the bytes read by all of the workers
+	static ULONGLONG GetBytesRead()
+	{
+		return (ULONGLONG)GetState().m_llRead;
+	}
+
+	// the bytes written by all of the workers
+	static ULONGLONG GetBytesWritten()
+	{
+		return (ULONGLONG)GetState().m_llWritten;
+	}
+
+	// start a new tally for the calling thread
+	static void ResetTally()
+	{
+		GetTally() = 0;
+	}
+
+	// bytes the calling thread read and wrote since its tally was reset
+	static ULONGLONG GetTallyBytes()
+	{
+		return GetTally();
+	}
+
+	// account for a read of the given bytes
+	static inline void Read( ULONGLONG ullBytes )
+	{
+		Charge( tbRead, ullBytes );
+	}
+
+	// account for a write of the given bytes
+	static inline void Write( ULONGLONG ullBytes )
+	{
+		Charge( tbWrite, ullBytes );
+	}
+};
+
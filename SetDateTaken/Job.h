@@ -0,0 +1,733 @@
+/////////////////////////////////////////////////////////////////////////////
+// Copyright  by W. T. Block, all rights reserved
+/////////////////////////////////////////////////////////////////////////////
+#pragma once
+#include "stdafx.h"
+#include "FileIdMap.h"
+#include <map>
+#include <vector>
+
+using namespace std;
+
+/////////////////////////////////////////////////////////////////////////////
+// this class describes one assignment of a date to the images found by a
+// pathname (which may contain wild cards) and collects the results of
+// processing those images. The results are updated by concurrent
+// workers.
+class CJob
+{
+	// public definitions
+public:
+	// where the time portion of the new date comes from
+	typedef enum
+	{
+		// the time of the Date Taken if available, otherwise the
+		// modification time of the file
+		tpTaken = 0,
+
+		// always the modification time of the file
+		tpModified = tpTaken + 1,
+
+		// always midnight
+		tpMidnight = tpModified + 1,
+
+	} TIME_POLICY;
+
+	// protected data
+protected:
+	// pathname which may contain wild cards
+	CString m_csPath;
+
+	// 4 digit year
+	int m_nYear;
+
+	// month of the year (1..12)
+	int m_nMonth;
+
+	// day of the month (1..31)
+	int m_nDay;
+
+	// where the time portion of the new date comes from
+	TIME_POLICY m_eTimePolicy;
+
+	// folder at the root of the tree without a trailing backslash
+	CString m_csRoot;
+
+	// the job passed validation and will be run
+	bool m_bValid;
+
+	// number of images found for this job
+	volatile LONG m_lFiles;
+
+	// number of images written
+	volatile LONG m_lWritten;
+
+	// number of images that failed
+	volatile LONG m_lFailed;
+
+	// number of images skipped because an earlier job claimed them or
+	// they are another name of an image already found
+	volatile LONG m_lDuplicates;
+
+	// the folders visited by this job which stops the crawl from
+	// entering a folder twice through a junction or symbolic link
+	CFileIdMap<bool> m_mapFolders;
+
+	// protected methods
+protected:
+	// parse a date of the form YYYY-MM-DD (dashes, slashes, colons or
+	// spaces may separate the values)
+	bool ParseDate( CString csDate )
+	{
+		int nStart = 0;
+		vector<int> values;
+		do
+		{
+			const CString csToken = csDate.Tokenize( _T( "-/: " ), nStart );
+			if ( csToken.IsEmpty() )
+			{
+				break;
+			}
+			values.push_back( _tstol( csToken ) );
+
+		} while ( true );
+
+		if ( values.size() != 3 )
+		{
+			return false;
+		}
+
+		m_nYear = values[ 0 ];
+		m_nMonth = values[ 1 ];
+		m_nDay = values[ 2 ];
+		return true;
+	}
+
+	// parse the time policy name and return false if it is unknown
+	bool ParseTimePolicy( CString csPolicy )
+	{
+		csPolicy.Trim();
+		csPolicy.MakeLower();
+		if ( csPolicy.IsEmpty() || csPolicy == _T( "taken" ) )
+		{
+			m_eTimePolicy = tpTaken;
+
+		} else if ( csPolicy == _T( "modified" ) || csPolicy == _T( "mtime" ) )
+		{
+			m_eTimePolicy = tpModified;
+
+		} else if ( csPolicy == _T( "midnight" ) )
+		{
+			m_eTimePolicy = tpMidnight;
+
+		} else
+		{
+			return false;
+		}
+
+		return true;
+	}
+
+	// is the character JSON white space
+	static inline bool IsJsonSpace( TCHAR cChar )
+	{
+		return
+			cChar == _T( ' ' ) || cChar == _T( '\t' ) ||
+			cChar == _T( '\r' ) || cChar == _T( '\n' );
+	}
+
+	// skip the white space of a JSON text
+	static void SkipJsonSpace( const CString& csLine, int& nPos )
+	{
+		const int nLength = csLine.GetLength();
+		while ( nPos < nLength && IsJsonSpace( csLine[ nPos ] ) )
+		{
+			nPos++;
+		}
+	}
+
+	// convert UTF-16 text to the ANSI code page. Returns false if the text
+	// holds a surrogate without its partner or a character the code page
+	// cannot represent, which would otherwise become a question mark or
+	// a look-alike character and name a different file.
+	static bool ConvertToAnsi( const CStringW& csUnicode, CString& csValue )
+	{
+		const int nLength = csUnicode.GetLength();
+		for ( int nChar = 0; nChar < nLength; nChar++ )
+		{
+			const wchar_t cChar = csUnicode[ nChar ];
+			if ( cChar >= 0xD800 && cChar <= 0xDBFF )
+			{
+				if ( nChar + 1 >= nLength ||
+					csUnicode[ nChar + 1 ] < 0xDC00 || csUnicode[ nChar + 1 ] > 0xDFFF )
+				{
+					return false;
+				}
+				nChar++;
+
+			} else if ( cChar >= 0xDC00 && cChar <= 0xDFFF )
+			{
+				return false;
+			}
+		}
+
+		BOOL bDefault = FALSE;
+		const int nBytes = ::WideCharToMultiByte
+		(
+			CP_ACP, WC_NO_BEST_FIT_CHARS, csUnicode, nLength,
+			nullptr, 0, nullptr, &bDefault
+		);
+		if ( nBytes <= 0 || bDefault )
+		{
+			return false;
+		}
+
+		CStringA csText;
+		::WideCharToMultiByte
+		(
+			CP_ACP, WC_NO_BEST_FIT_CHARS, csUnicode, nLength,
+			csText.GetBuffer( nBytes ), nBytes, nullptr, nullptr
+		);
+		csText.ReleaseBuffer( nBytes );
+		csValue = csText;
+		return true;
+	}
+
+	// read the JSON string that starts with the double quote at the given
+	// position and decode all of its escape sequences. A run of \uXXXX
+	// escapes is converted as a whole so surrogate pairs stay together.
+	// Returns false if the string is not terminated or an escape is
+	// invalid, and with a message if the string names characters the
+	// ANSI code page cannot represent.
+	static bool ReadJsonString
+	(
+		const CString& csLine, int& nPos, CString& csValue, CString& csError
+	)
+	{
+		const int nLength = csLine.GetLength();
+		if ( nPos >= nLength || csLine[ nPos ] != _T( '"' ) )
+		{
+			return false;
+		}
+
+		const int nStart = nPos;
+		csValue.Empty();
+		CStringW csUnicode;
+		for ( nPos++; nPos < nLength; nPos++ )
+		{
+			TCHAR cChar = csLine[ nPos ];
+			if ( cChar == _T( '\\' ) && nPos + 5 < nLength && csLine[ nPos + 1 ] == _T( 'u' ) )
+			{
+				const CString csHex = csLine.Mid( nPos + 2, 4 );
+				if ( csHex.SpanIncluding( _T( "0123456789abcdefABCDEF" ) ).GetLength() != 4 )
+				{
+					return false;
+				}
+				csUnicode += (wchar_t)_tcstoul( csHex, nullptr, 16 );
+				nPos += 5;
+				continue;
+			}
+
+			if ( !csUnicode.IsEmpty() )
+			{
+				CString csText;
+				if ( !ConvertToAnsi( csUnicode, csText ) )
+				{
+					const int nEnd = csLine.Find( _T( '"' ), nPos );
+					csError.Format
+					(
+						_T( "%s holds characters the ANSI code page cannot represent" ),
+						nEnd < 0 ? csLine.Mid( nStart ) : csLine.Mid( nStart, nEnd - nStart + 1 )
+					);
+					return false;
+				}
+				csValue += csText;
+				csUnicode.Empty();
+			}
+
+			if ( cChar == _T( '"' ) )
+			{
+				nPos++;
+				return true;
+			}
+
+			if ( cChar == _T( '\\' ) )
+			{
+				if ( ++nPos >= nLength )
+				{
+					return false;
+				}
+
+				switch ( csLine[ nPos ] )
+				{
+					case _T( '"' ): cChar = _T( '"' ); break;
+					case _T( '\\' ): cChar = _T( '\\' ); break;
+					case _T( '/' ): cChar = _T( '/' ); break;
+					case _T( 'b' ): cChar = _T( '\b' ); break;
+					case _T( 'f' ): cChar = _T( '\f' ); break;
+					case _T( 'n' ): cChar = _T( '\n' ); break;
+					case _T( 'r' ): cChar = _T( '\r' ); break;
+					case _T( 't' ): cChar = _T( '\t' ); break;
+					default:
+					{
+						return false;
+					}
+				}
+			}
+
+			csValue += cChar;
+		}
+
+		return false;
+	}
+
+	// parse a single line JSON object whose values are strings, numbers,
+	// true, false or null into its keys and values. Keys are only found
+	// where the object has a key, so a key named inside a value is never
+	// mistaken for one. Returns false if the line is not such an object,
+	// with a message when a string cannot be represented.
+	static bool ParseJsonObject
+	(
+		const CString& csLine, map<CString, CString>& fields, CString& csError
+	)
+	{
+		fields.clear();
+		const int nLength = csLine.GetLength();
+		int nPos = 0;
+		SkipJsonSpace( csLine, nPos );
+		if ( nPos >= nLength || csLine[ nPos++ ] != _T( '{' ) )
+		{
+			return false;
+		}
+
+		SkipJsonSpace( csLine, nPos );
+		if ( nPos < nLength && csLine[ nPos ] == _T( '}' ) )
+		{
+			return true;
+		}
+
+		do
+		{
+			CString csKey;
+			CString csValue;
+			SkipJsonSpace( csLine, nPos );
+			if ( !ReadJsonString( csLine, nPos, csKey, csError ) )
+			{
+				return false;
+			}
+
+			SkipJsonSpace( csLine, nPos );
+			if ( nPos >= nLength || csLine[ nPos++ ] != _T( ':' ) )
+			{
+				return false;
+			}
+
+			SkipJsonSpace( csLine, nPos );
+			if ( nPos < nLength && csLine[ nPos ] == _T( '"' ) )
+			{
+				if ( !ReadJsonString( csLine, nPos, csValue, csError ) )
+				{
+					return false;
+				}
+
+			} else
+			{
+				// a number or literal runs up to the next separator, and
+				// nested objects and arrays are not used by a job
+				const int nStart = nPos;
+				while
+				(
+					nPos < nLength && csLine[ nPos ] != _T( ',' ) &&
+					csLine[ nPos ] != _T( '}' ) && !IsJsonSpace( csLine[ nPos ] )
+				)
+				{
+					if ( csLine[ nPos ] == _T( '{' ) || csLine[ nPos ] == _T( '[' ) )
+					{
+						return false;
+					}
+					nPos++;
+				}
+				csValue = csLine.Mid( nStart, nPos - nStart );
+				if ( csValue.IsEmpty() )
+				{
+					return false;
+				}
+			}
+
+			fields[ csKey ] = csValue;
+
+			SkipJsonSpace( csLine, nPos );
+			if ( nPos >= nLength )
+			{
+				return false;
+			}
+
+			const TCHAR cChar = csLine[ nPos++ ];
+			if ( cChar == _T( '}' ) )
+			{
+				return true;
+			}
+			if ( cChar != _T( ',' ) )
+			{
+				return false;
+			}
+
+		} while ( true );
+	}
+
+	// split a comma separated line where fields may be enclosed in
+	// double quotes with embedded quotes doubled
+	static vector<CString> SplitCsv( const CString& csLine )
+	{
+		vector<CString> value;
+		CString csField;
+		bool bQuoted = false;
+		const int nLength = csLine.GetLength();
+		for ( int nPos = 0; nPos < nLength; nPos++ )
+		{
+			const TCHAR cChar = csLine[ nPos ];
+			if ( bQuoted )
+			{
+				if ( cChar == _T( '"' ) )
+				{
+					if ( nPos + 1 < nLength && csLine[ nPos + 1 ] == _T( '"' ) )
+					{
+						csField += cChar;
+						nPos++;
+
+					} else
+					{
+						bQuoted = false;
+					}
+
+				} else
+				{
+					csField += cChar;
+				}
+
+			} else if ( cChar == _T( '"' ) )
+			{
+				bQuoted = true;
+
+			} else if ( cChar == _T( ',' ) )
+			{
+				value.push_back( csField.Trim() );
+				csField.Empty();
+
+			} else
+			{
+				csField += cChar;
+			}
+		}
+
+		value.push_back( csField.Trim() );
+		return value;
+	}
+
+	// public properties
+public:
+	// pathname which may contain wild cards
+	inline CString GetPath()
+	{
+		return m_csPath;
+	}
+	// pathname which may contain wild cards
+	inline void SetPath( CString value )
+	{
+		m_csPath = value;
+	}
+	// pathname which may contain wild cards
+	__declspec( property( get = GetPath, put = SetPath ) )
+		CString Path;
+
+	// 4 digit year
+	inline int GetYear()
+	{
+		return m_nYear;
+	}
+	// 4 digit year
+	inline void SetYear( int value )
+	{
+		m_nYear = value;
+	}
+	// 4 digit year
+	__declspec( property( get = GetYear, put = SetYear ) )
+		int Year;
+
+	// month of the year (1..12)
+	inline int GetMonth()
+	{
+		return m_nMonth;
+	}
+	// month of the year (1..12)
+	inline void SetMonth( int value )
+	{
+		m_nMonth = value;
+	}
+	// month of the year (1..12)
+	__declspec( property( get = GetMonth, put = SetMonth ) )
+		int Month;
+
+	// day of the month (1..31)
+	inline int GetDay()
+	{
+		return m_nDay;
+	}
+	// day of the month (1..31)
+	inline void SetDay( int value )
+	{
+		m_nDay = value;
+	}
+	// day of the month (1..31)
+	__declspec( property( get = GetDay, put = SetDay ) )
+		int Day;
+
+	// where the time portion of the new date comes from
+	inline TIME_POLICY GetTimePolicy()
+	{
+		return m_eTimePolicy;
+	}
+	// where the time portion of the new date comes from
+	inline void SetTimePolicy( TIME_POLICY value )
+	{
+		m_eTimePolicy = value;
+	}
+	// where the time portion of the new date comes from
+	__declspec( property( get = GetTimePolicy, put = SetTimePolicy ) )
+		TIME_POLICY TimePolicy;
+
+	// folder at the root of the tree without a trailing backslash
+	inline CString GetRoot()
+	{
+		return m_csRoot;
+	}
+	// folder at the root of the tree without a trailing backslash
+	inline void SetRoot( CString value )
+	{
+		m_csRoot = value;
+	}
+	// folder at the root of the tree without a trailing backslash
+	__declspec( property( get = GetRoot, put = SetRoot ) )
+		CString Root;
+
+	// the job passed validation and will be run
+	inline bool GetValid()
+	{
+		return m_bValid;
+	}
+	// the job passed validation and will be run
+	inline void SetValid( bool value )
+	{
+		m_bValid = value;
+	}
+	// the job passed validation and will be run
+	__declspec( property( get = GetValid, put = SetValid ) )
+		bool Valid;
+
+	// number of images found for this job
+	inline LONG GetFiles()
+	{
+		return m_lFiles;
+	}
+	// number of images found for this job
+	__declspec( property( get = GetFiles ) )
+		LONG Files;
+
+	// number of images written
+	inline LONG GetWritten()
+	{
+		return m_lWritten;
+	}
+	// number of images written
+	__declspec( property( get = GetWritten ) )
+		LONG Written;
+
+	// number of images that failed
+	inline LONG GetFailed()
+	{
+		return m_lFailed;
+	}
+	// number of images that failed
+	__declspec( property( get = GetFailed ) )
+		LONG Failed;
+
+	// number of images skipped because an earlier job claimed them or
+	// they are another name of an image already found
+	inline LONG GetDuplicates()
+	{
+		return m_lDuplicates;
+	}
+	// number of images skipped because an earlier job claimed them or
+	// they are another name of an image already found
+	__declspec( property( get = GetDuplicates ) )
+		LONG Duplicates;
+
+	// public methods
+public:
+	// count an image found for this job
+	inline void AddFile()
+	{
+		InterlockedIncrement( &m_lFiles );
+	}
+
+	// count an image written
+	inline void AddWritten()
+	{
+		InterlockedIncrement( &m_lWritten );
+	}
+
+	// count an image that failed
+	inline void AddFailed()
+	{
+		InterlockedIncrement( &m_lFailed );
+	}
+
+	// count an image claimed by an earlier job
+	inline void AddDuplicate()
+	{
+		InterlockedIncrement( &m_lDuplicates );
+	}
+
+	// record the visit of the given folder and return false if the job
+	// has already been there through another name, which is also how a
+	// link loop shows up. A folder whose identity cannot be read is
+	// visited.
+	bool VisitFolder( LPCTSTR pcszFolder )
+	{
+		FILE_ID id;
+		DWORD dwLinks = 0;
+		if ( !CFileIdMap<bool>::GetFileId( pcszFolder, id, dwLinks ) )
+		{
+			return true;
+		}
+
+		bool bFirst = false;
+		return m_mapFolders.Visit( id, true, bFirst );
+	}
+
+	// forget the visited folders before the tree is crawled again
+	void ClearFolders()
+	{
+		m_mapFolders.Clear();
+	}
+
+	// the date formatted as YYYY-MM-DD for reporting
+	CString GetDateText()
+	{
+		CString value;
+		value.Format( _T( "%04d-%02d-%02d" ), Year, Month, Day );
+		return value;
+	}
+
+	// is the line of a job file the header of comma separated values,
+	// i.e. its first field is the word path
+	static bool IsHeader( CString csLine )
+	{
+		csLine.Trim();
+		if ( csLine.Left( 1 ) == _T( "{" ) )
+		{
+			return false;
+		}
+
+		CString csField = SplitCsv( csLine )[ 0 ];
+		return csField.MakeLower() == _T( "path" );
+	}
+
+	// parse a line of a job file which is either a JSON object such as
+	//		{ "path": "c:\\pictures\\*.jpg", "date": "1980-09-06", "time": "taken" }
+	// or comma separated values such as
+	//		"c:\pictures\*.jpg",1980-09-06,taken
+	// where the time policy is optional. Returns false with a message
+	// if the line cannot be used.
+	bool Parse( CString csLine, CString& csError )
+	{
+		csLine.Trim();
+
+		CString csPath;
+		CString csDate;
+		CString csPolicy;
+
+		if ( csLine.Left( 1 ) == _T( "{" ) )
+		{
+			map<CString, CString> fields;
+			csError.Empty();
+			if ( !ParseJsonObject( csLine, fields, csError ) )
+			{
+				if ( csError.IsEmpty() )
+				{
+					csError = _T( "invalid JSON object" );
+				}
+				return false;
+			}
+
+			const auto path = fields.find( _T( "path" ) );
+			const auto date = fields.find( _T( "date" ) );
+			if ( path == fields.end() || date == fields.end() )
+			{
+				csError = _T( "a path and a date are required" );
+				return false;
+			}
+			csPath = path->second;
+			csDate = date->second;
+
+			const auto time = fields.find( _T( "time" ) );
+			if ( time != fields.end() )
+			{
+				csPolicy = time->second;
+			}
+
+		} else
+		{
+			const vector<CString> fields = SplitCsv( csLine );
+			if ( fields.size() < 2 || fields.size() > 3 )
+			{
+				csError = _T( "expected path,date[,time]" );
+				return false;
+			}
+
+			csPath = fields[ 0 ];
+			csDate = fields[ 1 ];
+			if ( fields.size() == 3 )
+			{
+				csPolicy = fields[ 2 ];
+			}
+		}
+
+		if ( csPath.IsEmpty() )
+		{
+			csError = _T( "the path is empty" );
+			return false;
+		}
+
+		if ( !ParseDate( csDate ) )
+		{
+			csError.Format( _T( "invalid date \"%s\"" ), csDate );
+			return false;
+		}
+
+		if ( !ParseTimePolicy( csPolicy ) )
+		{
+			csError.Format( _T( "unknown time policy \"%s\"" ), csPolicy );
+			return false;
+		}
+
+		Path = csPath;
+		return true;
+	}
+
+	// public construction
+public:
+	CJob()
+	{
+		m_nYear = -1;
+		m_nMonth = -1;
+		m_nDay = -1;
+		m_eTimePolicy = tpTaken;
+		m_bValid = false;
+		m_lFiles = 0;
+		m_lWritten = 0;
+		m_lFailed = 0;
+		m_lDuplicates = 0;
+	}
+};
+
@@ -0,0 +1,857 @@
+/////////////////////////////////////////////////////////////////////////////
+// Copyright  by W. T. Block, all rights reserved
+/////////////////////////////////////////////////////////////////////////////
+#pragma once
+#include "stdafx.h"
+#include "BufferPool.h"
+#include "IoThrottle.h"
+#include "PayloadCheck.h"
+#include <vector>
+#include <string.h>
+
+using namespace std;
+
+/////////////////////////////////////////////////////////////////////////////
+// this class patches the metadata of a JPEG file at the byte level so the
+// compressed image data never has to be decoded. Segments are patched in
+// place and are never resized which allows the remainder of the file to
+// be left alone.
+class CJpegPatcher
+{
+	// public definitions
+public:
+	// the outcome of patching the dates of an XMP packet
+	typedef enum
+	{
+		// there is no XMP packet or it holds no date property
+		xrNone = 0,
+
+		// the date properties were patched
+		xrPatched = xrNone + 1,
+
+		// the packet holds dates that could not be patched, so the file
+		// still has its old XMP dates
+		xrFailed = xrPatched + 1,
+
+	} XMP_RESULT;
+
+	// protected definitions
+protected:
+	// JPEG markers of interest (the second byte following 0xFF)
+	typedef enum
+	{
+		jmTEM = 0x01,
+		jmRST0 = 0xD0,
+		jmRST7 = 0xD7,
+		jmSOI = 0xD8,
+		jmEOI = 0xD9,
+		jmSOS = 0xDA,
+		jmAPP0 = 0xE0,
+		jmAPP1 = 0xE1,
+	} JPEG_MARKER;
+
+	// location and identity of a segment in front of the image data
+	typedef struct tagSegment
+	{
+		// the marker following 0xFF
+		BYTE m_cMarker;
+
+		// file offset of the 0xFF that starts the segment
+		ULONGLONG m_ullOffset;
+
+		// size of the data following the length field
+		int m_nPayload;
+
+		// APP1 segment holding EXIF data
+		bool m_bExif;
+
+		// APP1 segment holding an XMP packet
+		bool m_bXmp;
+
+	} SEGMENT;
+
+	// a minimal APP1 segment holding a big endian TIFF structure with
+	// IFD0 pointing to an EXIF IFD that contains the ExifVersion,
+	// DateTimeOriginal (0x9003) and DateTimeDigitized (0x9004) tags
+	typedef struct tagExifTemplate
+	{
+		BYTE m_Data[ 118 ];
+
+	} EXIF_TEMPLATE;
+
+	// offsets in the EXIF template
+	typedef enum
+	{
+		// start of the TIFF header (after "Exif\0\0")
+		etTiff = 10,
+
+		// IFD0 relative to the TIFF header
+		etIfd0 = 8,
+
+		// EXIF IFD relative to the TIFF header
+		etExifIfd = etIfd0 + 2 + 12 + 4,
+
+		// date values relative to the TIFF header
+		etOriginalValue = etExifIfd + 2 + 3 * 12 + 4,
+		etDigitizedValue = etOriginalValue + 20,
+
+		// date values relative to the start of the segment
+		etOriginal = etTiff + etOriginalValue,
+		etDigitized = etTiff + etDigitizedValue,
+
+		// size of the whole segment
+		etSize = etTiff + etDigitizedValue + 20,
+
+	} EXIF_TEMPLATE_OFFSET;
+
+	// write a big endian 16 bit value
+	static constexpr void PutShort( BYTE* pData, int nPos, int nValue )
+	{
+		pData[ nPos ] = (BYTE)( nValue >> 8 );
+		pData[ nPos + 1 ] = (BYTE)nValue;
+	}
+
+	// write a big endian 32 bit value
+	static constexpr void PutLong( BYTE* pData, int nPos, int nValue )
+	{
+		PutShort( pData, nPos, nValue >> 16 );
+		PutShort( pData, nPos + 2, nValue );
+	}
+
+	// write a 12 byte IFD entry
+	static constexpr void PutEntry
+	(
+		BYTE* pData, int nPos, int nTag, int nType, int nCount, int nValue
+	)
+	{
+		PutShort( pData, nPos, nTag );
+		PutShort( pData, nPos + 2, nType );
+		PutLong( pData, nPos + 4, nCount );
+		PutLong( pData, nPos + 8, nValue );
+	}
+
+	// build the EXIF template at compile time with empty date values
+	static constexpr EXIF_TEMPLATE BuildExifTemplate()
+	{
+		EXIF_TEMPLATE value = { { 0 } };
+		BYTE* pData = value.m_Data;
+
+		// APP1 marker and length (which excludes the marker)
+		PutShort( pData, 0, 0xFFE1 );
+		PutShort( pData, 2, etSize - 2 );
+
+		// EXIF signature
+		pData[ 4 ] = 'E';
+		pData[ 5 ] = 'x';
+		pData[ 6 ] = 'i';
+		pData[ 7 ] = 'f';
+
+		// big endian TIFF header pointing to IFD0
+		BYTE* pTiff = pData + etTiff;
+		pTiff[ 0 ] = 'M';
+		pTiff[ 1 ] = 'M';
+		PutShort( pTiff, 2, 42 );
+		PutLong( pTiff, 4, etIfd0 );
+
+		// IFD0 holds only the pointer to the EXIF IFD
+		PutShort( pTiff, etIfd0, 1 );
+		PutEntry( pTiff, etIfd0 + 2, 0x8769, 4, 1, etExifIfd );
+
+		// the EXIF IFD with tags in ascending order
+		PutShort( pTiff, etExifIfd, 3 );
+		PutEntry( pTiff, etExifIfd + 2, 0x9000, 7, 4, 0x30323330 );
+		PutEntry( pTiff, etExifIfd + 14, 0x9003, 2, 20, etOriginalValue );
+		PutEntry( pTiff, etExifIfd + 26, 0x9004, 2, 20, etDigitizedValue );
+
+		return value;
+	}
+
+	// the EXIF template which is built once by the compiler
+	static const EXIF_TEMPLATE& GetExifTemplate()
+	{
+		static constexpr EXIF_TEMPLATE value = BuildExifTemplate();
+		return value;
+	}
+
+	// the width of an EXIF date "YYYY:MM:DD HH:MM:SS"
+	static inline int GetExifDateLength()
+	{
+		return 19;
+	}
+
+	// the XMP APP1 segment starts with this null terminated namespace
+	static inline LPCSTR GetXmpNamespace()
+	{
+		return "http://ns.adobe.com/xap/1.0/";
+	}
+
+	// length of the XMP namespace including the null terminator
+	static inline int GetXmpNamespaceLength()
+	{
+		return 29;
+	}
+
+	// the width of an XMP date "YYYY-MM-DDTHH:MM:SS"
+	static inline int GetXmpDateLength()
+	{
+		return 19;
+	}
+
+	// is the character XML white space
+	static inline bool IsWhiteSpace( BYTE value )
+	{
+		return value == ' ' || value == '\t' || value == '\r' || value == '\n';
+	}
+
+	// is the character part of the date and time of an XMP date
+	static inline bool IsDateChar( BYTE value )
+	{
+		return ( value >= '0' && value <= '9' ) || value == '-' || value == ':' || value == 'T';
+	}
+
+	// find a string within a byte range and return -1 if not found
+	static int Find
+	(
+		const BYTE* pData, int nStart, int nEnd, LPCSTR pcszFind
+	)
+	{
+		const int nFind = (int)strlen( pcszFind );
+		const int nLast = nEnd - nFind;
+		for ( int nPos = nStart; nPos <= nLast; nPos++ )
+		{
+			if ( pData[ nPos ] == (BYTE)pcszFind[ 0 ] &&
+				0 == memcmp( pData + nPos, pcszFind, nFind ) )
+			{
+				return nPos;
+			}
+		}
+
+		return -1;
+	}
+
+	/////////////////////////////////////////////////////////////////////////
+	// given the position just past a property name, locate the value of
+	// the property whether written as an attribute (name="value") or as
+	// an element (<name>value</name>) and return false if neither
+	static bool FindValue
+	(
+		const BYTE* pData, int nSize, int nPos, int& nStart, int& nEnd
+	)
+	{
+		while ( nPos < nSize && IsWhiteSpace( pData[ nPos ] ) )
+		{
+			nPos++;
+		}
+		if ( nPos >= nSize )
+		{
+			return false;
+		}
+
+		BYTE cEnd = 0;
+		if ( pData[ nPos ] == '>' )
+		{
+			cEnd = '<';
+			nPos++;
+
+		} else if ( pData[ nPos ] == '=' )
+		{
+			nPos++;
+			while ( nPos < nSize && IsWhiteSpace( pData[ nPos ] ) )
+			{
+				nPos++;
+			}
+			if ( nPos >= nSize ||
+				( pData[ nPos ] != '"' && pData[ nPos ] != '\'' ) )
+			{
+				return false;
+			}
+			cEnd = pData[ nPos++ ];
+
+		} else
+		{
+			return false;
+		}
+
+		nStart = nPos;
+		while ( nPos < nSize && pData[ nPos ] != cEnd )
+		{
+			nPos++;
+		}
+		if ( nPos >= nSize )
+		{
+			return false;
+		}
+
+		nEnd = nPos;
+		return true;
+	}
+
+	// public methods
+public:
+	/////////////////////////////////////////////////////////////////////////
+	// replace the date and time of the date properties in an XMP packet
+	// with the given XMP date. A time zone that follows the old time is
+	// kept, while its fractional seconds belong to the old time and are
+	// dropped. The change in length is absorbed by the white space padding
+	// in front of the packet trailer so the packet keeps its size. The
+	// packet is not modified unless the result is patched.
+	static XMP_RESULT PatchXmpPacket( BYTE* pPacket, int nSize, LPCSTR pcszDate )
+	{
+		// the date properties that are kept in step with the EXIF dates
+		static LPCSTR Properties[] =
+		{
+			"xmp:CreateDate",
+			"photoshop:DateCreated",
+			"exif:DateTimeOriginal",
+			"exif:DateTimeDigitized",
+		};
+		const int nProperties = _countof( Properties );
+		const int nDate = GetXmpDateLength();
+
+		vector<BYTE> packet;
+		packet.reserve( nSize + nProperties * nDate );
+		int nPatched = 0;
+		int nCopied = 0;
+
+		// a single pass over the packet looking for the property names
+		for ( int nPos = 0; nPos < nSize; nPos++ )
+		{
+			// a property name follows the start of an element or white
+			// space, which excludes closing elements
+			if ( nPos == 0 ||
+				( pPacket[ nPos - 1 ] != '<' &&
+					!IsWhiteSpace( pPacket[ nPos - 1 ] ) ) )
+			{
+				continue;
+			}
+
+			for ( LPCSTR pcszName : Properties )
+			{
+				const int nName = (int)strlen( pcszName );
+				if ( nPos + nName > nSize ||
+					0 != memcmp( pPacket + nPos, pcszName, nName ) )
+				{
+					continue;
+				}
+
+				int nStart = 0;
+				int nEnd = 0;
+				if ( !FindValue( pPacket, nSize, nPos + nName, nStart, nEnd ) )
+				{
+					continue;
+				}
+
+				// the suffix after the old date and time and any
+				// fractional seconds is the time zone, if any
+				int nSuffix = nStart;
+				while ( nSuffix < nEnd && nSuffix - nStart < nDate &&
+					IsDateChar( pPacket[ nSuffix ] ) )
+				{
+					nSuffix++;
+				}
+				if ( nSuffix < nEnd && pPacket[ nSuffix ] == '.' )
+				{
+					nSuffix++;
+					while ( nSuffix < nEnd && pPacket[ nSuffix ] >= '0' && pPacket[ nSuffix ] <= '9' )
+					{
+						nSuffix++;
+					}
+				}
+
+				// copy up to the value and then the new date, which the
+				// suffix follows
+				packet.insert
+				(
+					packet.end(), pPacket + nCopied, pPacket + nStart
+				);
+				packet.insert
+				(
+					packet.end(), (const BYTE*)pcszDate,
+					(const BYTE*)pcszDate + nDate
+				);
+				nCopied = nSuffix;
+				nPos = nEnd;
+				nPatched++;
+				break;
+			}
+		}
+
+		if ( nPatched == 0 )
+		{
+			return xrNone;
+		}
+
+		packet.insert( packet.end(), pPacket + nCopied, pPacket + nSize );
+
+		// the padding is the white space in front of the trailer
+		const int nDelta = (int)packet.size() - nSize;
+		if ( nDelta != 0 )
+		{
+			int nTrailer = -1;
+			int nFound = Find
+			(
+				packet.data(), 0, (int)packet.size(), "<?xpacket end="
+			);
+			while ( nFound != -1 )
+			{
+				nTrailer = nFound;
+				nFound = Find
+				(
+					packet.data(), nFound + 1, (int)packet.size(),
+					"<?xpacket end="
+				);
+			}
+			if ( nTrailer == -1 )
+			{
+				return xrFailed;
+			}
+
+			int nPadding = nTrailer;
+			while ( nPadding > 0 && IsWhiteSpace( packet[ nPadding - 1 ] ) )
+			{
+				nPadding--;
+			}
+
+			// grow or shrink the padding to restore the original size
+			if ( nDelta > 0 )
+			{
+				if ( nTrailer - nPadding < nDelta )
+				{
+					return xrFailed;
+				}
+				packet.erase
+				(
+					packet.begin() + nTrailer - nDelta,
+					packet.begin() + nTrailer
+				);
+
+			} else
+			{
+				packet.insert( packet.begin() + nTrailer, -nDelta, ' ' );
+			}
+		}
+
+		memcpy( pPacket, packet.data(), nSize );
+		return xrPatched;
+	}
+
+	/////////////////////////////////////////////////////////////////////////
+	// list the segments of an open JPEG file from the start of the image
+	// marker up to the start of the image data, whose offset is returned
+	// through the given pointer if any (zero if the image has none). Only
+	// the marker, length and signature bytes of each segment are read.
+	static bool ReadSegments
+	(
+		CFile& file, vector<SEGMENT>& segments, ULONGLONG* pullImage = nullptr
+	)
+	{
+		BYTE marker[ 4 ] = { 0 };
+		file.Seek( 0, CFile::begin );
+		if ( file.Read( marker, 2 ) != 2 ||
+			marker[ 0 ] != 0xFF || marker[ 1 ] != jmSOI )
+		{
+			return false;
+		}
+
+		// walk the segments until the start of the image data
+		do
+		{
+			const ULONGLONG ullOffset = file.GetPosition();
+			if ( file.Read( marker, 2 ) != 2 || marker[ 0 ] != 0xFF )
+			{
+				return false;
+			}
+
+			const BYTE cMarker = marker[ 1 ];
+			if ( cMarker == jmSOS || cMarker == jmEOI )
+			{
+				if ( cMarker == jmSOS && pullImage != nullptr )
+				{
+					*pullImage = ullOffset;
+				}
+				break;
+			}
+
+			// stand alone markers have no length
+			if ( cMarker == 0xFF || cMarker == jmTEM ||
+				( cMarker >= jmRST0 && cMarker <= jmRST7 ) )
+			{
+				if ( cMarker == 0xFF )
+				{
+					file.Seek( -1, CFile::current );
+				}
+				continue;
+			}
+
+			if ( file.Read( marker + 2, 2 ) != 2 )
+			{
+				return false;
+			}
+
+			const int nLength = ( marker[ 2 ] << 8 ) | marker[ 3 ];
+			if ( nLength < 2 )
+			{
+				return false;
+			}
+
+			SEGMENT segment;
+			segment.m_cMarker = cMarker;
+			segment.m_ullOffset = ullOffset;
+			segment.m_nPayload = nLength - 2;
+			segment.m_bExif = false;
+			segment.m_bXmp = false;
+
+			// the APP1 signature tells EXIF and XMP apart
+			if ( cMarker == jmAPP1 )
+			{
+				BYTE signature[ 29 ] = { 0 };
+				const UINT uiSignature =
+					min( (UINT)segment.m_nPayload, (UINT)sizeof( signature ) );
+				const UINT uiRead = file.Read( signature, uiSignature );
+				segment.m_bExif =
+					uiRead >= 6 && 0 == memcmp( signature, "Exif\0\0", 6 );
+				segment.m_bXmp =
+					uiRead == (UINT)GetXmpNamespaceLength() &&
+					0 == memcmp( signature, GetXmpNamespace(), uiRead );
+			}
+
+			segments.push_back( segment );
+			file.Seek
+			(
+				ullOffset + 4 + segment.m_nPayload, CFile::begin
+			);
+
+		} while ( true );
+
+		return true;
+	}
+
+	/////////////////////////////////////////////////////////////////////////
+	// read the standard XMP packet of an open JPEG file and its offset.
+	// Returns false with an empty packet if the file has none, and with
+	// the packet sized if it cannot be read whole.
+	static bool ReadXmpPacket
+	(
+		CFile& file, vector<BYTE>& packet, ULONGLONG& ullPacket
+	)
+	{
+		packet.clear();
+		vector<SEGMENT> segments;
+		if ( !ReadSegments( file, segments ) )
+		{
+			return false;
+		}
+
+		for ( const SEGMENT& segment : segments )
+		{
+			if ( !segment.m_bXmp )
+			{
+				continue;
+			}
+
+			const int nNamespace = GetXmpNamespaceLength();
+			const int nPacket = segment.m_nPayload - nNamespace;
+			ullPacket = segment.m_ullOffset + 4 + nNamespace;
+
+			packet.resize( nPacket );
+			CIoThrottle::Read( nPacket );
+			file.Seek( ullPacket, CFile::begin );
+			return file.Read( packet.data(), nPacket ) == (UINT)nPacket;
+		}
+
+		return false;
+	}
+
+	/////////////////////////////////////////////////////////////////////////
+	// patch the dates of the XMP packet embedded in an open JPEG file.
+	// Only the markers in front of the image data are read, and only the
+	// XMP segment is written back at its original position and size. A
+	// JPEG file has one standard XMP packet, which is the first XMP
+	// segment; the extended XMP segments have another namespace and are
+	// not dates of the image.
+	static XMP_RESULT PatchXmp( CFile& file, LPCSTR pcszDate )
+	{
+		vector<BYTE> packet;
+		ULONGLONG ullPacket = 0;
+		if ( !ReadXmpPacket( file, packet, ullPacket ) )
+		{
+			return packet.empty() ? xrNone : xrFailed;
+		}
+
+		const int nPacket = (int)packet.size();
+		const XMP_RESULT value = PatchXmpPacket( packet.data(), nPacket, pcszDate );
+		if ( value != xrPatched )
+		{
+			return value;
+		}
+
+		CIoThrottle::Write( nPacket );
+		file.Seek( ullPacket, CFile::begin );
+		file.Write( packet.data(), nPacket );
+		return xrPatched;
+	}
+
+	/////////////////////////////////////////////////////////////////////////
+	// read the standard XMP packet of the given JPEG file and confirm its
+	// date properties already hold the given XMP date, which is the case
+	// when patching them again changes nothing. Returns xrPatched if they
+	// do, xrNone if the file has no packet or no date properties and
+	// xrFailed if a date differs or the packet cannot be read.
+	static XMP_RESULT CheckXmpFile( LPCTSTR pcszPath, LPCSTR pcszDate )
+	{
+		CFile file;
+		if ( !file.Open
+		(
+			pcszPath,
+			CFile::modeRead | CFile::shareDenyWrite | CFile::typeBinary
+		) )
+		{
+			return xrFailed;
+		}
+
+		XMP_RESULT value = xrNone;
+
+		try
+		{
+			vector<BYTE> packet;
+			ULONGLONG ullPacket = 0;
+			if ( ReadXmpPacket( file, packet, ullPacket ) )
+			{
+				const vector<BYTE> written( packet );
+				value = PatchXmpPacket( packet.data(), (int)packet.size(), pcszDate );
+				if ( value == xrPatched && packet != written )
+				{
+					value = xrFailed;
+				}
+
+			} else if ( !packet.empty() )
+			{
+				value = xrFailed;
+			}
+
+		} catch ( CFileException* pException )
+		{
+			pException->Delete();
+			value = xrFailed;
+		}
+
+		file.Close();
+		return value;
+	}
+
+	/////////////////////////////////////////////////////////////////////////
+	// patch the dates of the XMP packet embedded in the given JPEG file,
+	// where a file that cannot be opened or written has failed
+	static XMP_RESULT PatchXmpFile( LPCTSTR pcszPath, LPCSTR pcszDate )
+	{
+		CFile file;
+		if ( !file.Open
+		(
+			pcszPath,
+			CFile::modeReadWrite | CFile::shareDenyWrite | CFile::typeBinary
+		) )
+		{
+			return xrFailed;
+		}
+
+		XMP_RESULT value = xrNone;
+
+		try
+		{
+			value = PatchXmp( file, pcszDate );
+
+		} catch ( CFileException* pException )
+		{
+			pException->Delete();
+			value = xrFailed;
+		}
+
+		file.Close();
+		return value;
+	}
+
+	/////////////////////////////////////////////////////////////////////////
+	// copy a JPEG file that has no EXIF segment and splice the prebuilt
+	// EXIF template, stamped with the given Date Taken formatted date,
+	// after the start of image marker and any JFIF APP0 segment. The rest
+	// of the source is copied verbatim, so the image is never decoded. The
+	// outcome of patching an XMP packet that came along is returned
+	// through the given pointer, if any.
+	// The given payload check, if any, hashes the scan data as it is read
+	// from the source and learns where it lands after the template, so
+	// the scan data of the output can be read back and compared. Returns
+	// false without creating the target if the source already has EXIF
+	// data, which is left for GDI+ to update.
+	static bool WriteWithExifTemplate
+	(
+		LPCTSTR pcszSource, LPCTSTR pcszTarget, LPCSTR pcszDate,
+		LPCSTR pcszXmpDate, CPayloadCheck* pCheck = nullptr,
+		XMP_RESULT* peXmp = nullptr
+	)
+	{
+		if ( peXmp != nullptr )
+		{
+			*peXmp = xrNone;
+		}
+
+		const int nDate = GetExifDateLength();
+		if ( (int)strlen( pcszDate ) != nDate )
+		{
+			return false;
+		}
+
+		CFile source;
+		if ( !source.Open
+		(
+			pcszSource,
+			CFile::modeRead | CFile::shareDenyWrite | CFile::typeBinary
+		) )
+		{
+			return false;
+		}
+
+		bool value = false;
+
+		// set once the target is created so a failure removes it
+		bool bCreated = false;
+
+		try
+		{
+			vector<SEGMENT> segments;
+			ULONGLONG ullImage = 0;
+			if ( !ReadSegments( source, segments, &ullImage ) )
+			{
+				return false;
+			}
+
+			// the template is spliced after the start of image marker or
+			// after the APP0 segment that is required to follow it
+			ULONGLONG ullSplice = 2;
+			for ( const SEGMENT& segment : segments )
+			{
+				if ( segment.m_bExif )
+				{
+					return false;
+				}
+			}
+			if ( !segments.empty() && segments[ 0 ].m_cMarker == jmAPP0 &&
+				segments[ 0 ].m_ullOffset == 2 )
+			{
+				ullSplice = 2 + 4 + segments[ 0 ].m_nPayload;
+			}
+
+			// copy the template and stamp the two dates into it
+			const EXIF_TEMPLATE& Template = GetExifTemplate();
+			EXIF_TEMPLATE exif;
+			memcpy( &exif, &Template, sizeof( exif ) );
+			memcpy( exif.m_Data + etOriginal, pcszDate, nDate );
+			memcpy( exif.m_Data + etDigitized, pcszDate, nDate );
+
+			// the buffer of the thread's pool also holds the leading
+			// markers which may be a little larger than a block
+			CPooledBuffer buffer( max( (size_t)ullSplice, (size_t)64 * 1024 ) );
+			if ( buffer.Data == nullptr )
+			{
+				return false;
+			}
+
+			CFile target;
+			if ( !target.Open
+			(
+				pcszTarget,
+				CFile::modeCreate | CFile::modeReadWrite | CFile::typeBinary
+			) )
+			{
+				return false;
+			}
+			bCreated = true;
+
+			// the scan data follows the template in the output
+			if ( pCheck != nullptr )
+			{
+				if ( ullImage != 0 )
+				{
+					PAYLOAD_RANGE range;
+					range.m_ullOffset = ullImage;
+					range.m_ullLength = source.GetLength() - ullImage;
+					pCheck->Start
+					(
+						vector<PAYLOAD_RANGE>( 1, range ), sizeof( exif.m_Data )
+					);
+
+				} else
+				{
+					pCheck->Reset();
+				}
+			}
+
+			// copy the leading markers, the template and then the rest
+			// of the file in large blocks
+			source.Seek( 0, CFile::begin );
+			UINT uiRead = source.Read( buffer.Data, (UINT)ullSplice );
+			CIoThrottle::Read( uiRead );
+			CIoThrottle::Write( uiRead + sizeof( exif.m_Data ) );
+			target.Write( buffer.Data, uiRead );
+			target.Write( exif.m_Data, sizeof( exif.m_Data ) );
+
+			ULONGLONG ullSource = uiRead;
+			do
+			{
+				uiRead = source.Read( buffer.Data, (UINT)buffer.Size );
+				if ( uiRead == 0 )
+				{
+					break;
+				}
+				CIoThrottle::Read( uiRead );
+				CIoThrottle::Write( uiRead );
+				if ( pCheck != nullptr )
+				{
+					pCheck->Read( ullSource, buffer.Data, uiRead );
+				}
+				target.Write( buffer.Data, uiRead );
+				ullSource += uiRead;
+
+			} while ( true );
+
+			// an XMP packet that came along must agree with the new dates
+			if ( pcszXmpDate != nullptr )
+			{
+				const XMP_RESULT eXmp = PatchXmp( target, pcszXmpDate );
+				if ( peXmp != nullptr )
+				{
+					*peXmp = eXmp;
+				}
+			}
+
+			target.Close();
+			value = true;
+
+		} catch ( CFileException* pException )
+		{
+			pException->Delete();
+			value = false;
+			if ( peXmp != nullptr )
+			{
+				*peXmp = xrNone;
+			}
+
+			// the target was closed as it went out of scope, and a part
+			// of a copy must not pass for a finished output
+			if ( bCreated )
+			{
+				::DeleteFile( pcszTarget );
+			}
+		}
+
+		source.Close();
+		return value;
+	}
+
+	CJpegPatcher()
+	{
+	}
+	~CJpegPatcher()
+	{
+	}
+};
+
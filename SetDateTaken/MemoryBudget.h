@@ -0,0 +1,137 @@
+/////////////////////////////////////////////////////////////////////////////
+// Copyright  by W. T. Block, all rights reserved
+/////////////////////////////////////////////////////////////////////////////
+#pragma once
+#include "stdafx.h"
+#include <mutex>
+#include <condition_variable>
+
+using namespace std;
+
+/////////////////////////////////////////////////////////////////////////////
+// this class bounds the memory of the images decoded at the same time. A
+// worker reserves the estimated memory of an image before decoding it and
+// waits while the reservations of the other workers leave too little of
+// the budget. The caller fails an image larger than the whole budget
+// rather than reserve it; should one be reserved anyway, it is admitted
+// once no other image holds a reservation so it is never starved. A budget
+// of zero admits every image at once.
+class CMemoryBudget
+{
+	// protected data
+protected:
+	// the bytes that may be reserved at a time
+	ULONGLONG m_ullBudget;
+
+	// the bytes reserved
+	ULONGLONG m_ullReserved;
+
+	// the most bytes reserved at a time
+	ULONGLONG m_ullPeak;
+
+	// guards the reservations
+	mutex m_Mutex;
+
+	// signaled when a reservation is released
+	condition_variable m_cvReleased;
+
+	// public properties
+public:
+	// the bytes that may be reserved at a time
+	inline ULONGLONG GetBudget()
+	{
+		lock_guard<mutex> lock( m_Mutex );
+		return m_ullBudget;
+	}
+	// the bytes that may be reserved at a time
+	inline void SetBudget( ULONGLONG value )
+	{
+		{
+			lock_guard<mutex> lock( m_Mutex );
+			m_ullBudget = value;
+		}
+		m_cvReleased.notify_all();
+	}
+	// the bytes that may be reserved at a time
+	__declspec( property( get = GetBudget, put = SetBudget ) )
+		ULONGLONG Budget;
+
+	// the most bytes reserved at a time
+	inline ULONGLONG GetPeak()
+	{
+		lock_guard<mutex> lock( m_Mutex );
+		return m_ullPeak;
+	}
+	// the most bytes reserved at a time
+	__declspec( property( get = GetPeak ) )
+		ULONGLONG Peak;
+
+	// public methods
+public:
+	// wait until the given bytes fit the budget and reserve them
+	void Reserve( ULONGLONG ullBytes )
+	{
+		unique_lock<mutex> lock( m_Mutex );
+		m_cvReleased.wait
+		(
+			lock, [ this, ullBytes ]
+			{
+				return
+					m_ullBudget == 0 || m_ullReserved == 0 ||
+					m_ullReserved + ullBytes <= m_ullBudget;
+			}
+		);
+
+		m_ullReserved += ullBytes;
+		m_ullPeak = max( m_ullPeak, m_ullReserved );
+	}
+
+	// release bytes that were reserved
+	void Release( ULONGLONG ullBytes )
+	{
+		{
+			lock_guard<mutex> lock( m_Mutex );
+			m_ullReserved -= min( ullBytes, m_ullReserved );
+		}
+		m_cvReleased.notify_all();
+	}
+
+	// public construction
+public:
+	CMemoryBudget()
+	{
+		m_ullBudget = 0;
+		m_ullReserved = 0;
+		m_ullPeak = 0;
+	}
+};
+
+/////////////////////////////////////////////////////////////////////////////
+// this class holds a reservation of a memory budget for as long as it is
+// in scope and releases it on every way out
+class CMemoryReservation
+{
+	// protected data
+protected:
+	// the budget reserved from
+	CMemoryBudget* m_pBudget;
+
+	// the bytes reserved
+	ULONGLONG m_ullBytes;
+
+	// public construction / destruction
+public:
+	CMemoryReservation( CMemoryBudget& budget, ULONGLONG ullBytes )
+	{
+		m_pBudget = &budget;
+		m_ullBytes = ullBytes;
+		m_pBudget->Reserve( m_ullBytes );
+	}
+	~CMemoryReservation()
+	{
+		m_pBudget->Release( m_ullBytes );
+	}
+	CMemoryReservation( const CMemoryReservation& ) = delete;
+	CMemoryReservation& operator=( const CMemoryReservation& ) = delete;
+};
+
@@ -0,0 +1,267 @@
+/////////////////////////////////////////////////////////////////////////////
+// Copyright  by W. T. Block, all rights reserved
+/////////////////////////////////////////////////////////////////////////////
+#pragma once
+#include "stdafx.h"
+#include <algorithm>
+#include <map>
+#include <vector>
+
+using namespace std;
+
+/////////////////////////////////////////////////////////////////////////////
+// this class collects the date properties of the images of a tree from
+// concurrent workers and saves them sorted by pathname as a CSV file or as
+// a columnar file. The columnar file is made of these sections, where the
+// numbers are 32 bit little endian values:
+//   header:    "SDTCOLS" and a version byte of 1, the number of rows and
+//              the number of folders
+//   folders:   the folder dictionary, each a length and its bytes
+//   folder:    the index of the folder of each row in the dictionary
+//   name:      the end offset of the name of each row in the name bytes,
+//              followed by the name bytes
+//   original, digitized, datetime:
+//              19 bytes per row ("YYYY:MM:DD HH:MM:SS"), all zero when
+//              the image does not have the date
+class CMetadataExport
+{
+	// public definitions
+public:
+	// the kinds of file that can be saved
+	typedef enum
+	{
+		efColumnar = 0,
+		efCsv = efColumnar + 1,
+
+	} EXPORT_FORMAT;
+
+	// protected definitions
+protected:
+	// the number of dates of an image
+	enum { DATES = 3 };
+
+	// the dates of one image
+	typedef struct tagExportRow
+	{
+		// folder of the image without a trailing backslash
+		CString m_csFolder;
+
+		// filename and extension of the image
+		CString m_csName;
+
+		// DateTimeOriginal, DateTimeDigitized and DateTime
+		CString m_csDates[ DATES ];
+
+	} EXPORT_ROW;
+
+	// the width of a date column
+	enum { DATE_WIDTH = 19 };
+
+	// protected data
+protected:
+	// the rows in the order they were added
+	vector<EXPORT_ROW> m_Rows;
+
+	// guards the rows against concurrent workers
+	CCriticalSection m_Lock;
+
+	// protected methods
+protected:
+	// quote a CSV field if it holds a comma, a quote or a line break
+	static CString Quote( const CString& csField )
+	{
+		if ( csField.FindOneOf( _T( ",\"\r\n" ) ) == -1 )
+		{
+			return csField;
+		}
+
+		CString value( csField );
+		value.Replace( _T( "\"" ), _T( "\"\"" ) );
+		return _T( "\"" ) + value + _T( "\"" );
+	}
+
+	// add a 32 bit little endian value to the given bytes
+	static void PutLong( vector<BYTE>& bytes, DWORD dwValue )
+	{
+		for ( int nByte = 0; nByte < 4; nByte++ )
+		{
+			bytes.push_back( (BYTE)( dwValue >> ( nByte * 8 ) ) );
+		}
+	}
+
+	// add the bytes of the given text to the given bytes
+	static void PutText( vector<BYTE>& bytes, const CString& csText )
+	{
+		const CStringA csBytes( csText );
+		const BYTE* pBytes = (const BYTE*)(LPCSTR)csBytes;
+		bytes.insert( bytes.end(), pBytes, pBytes + csBytes.GetLength() );
+	}
+
+	// save the rows as a CSV file
+	bool SaveCsv( LPCTSTR pcszPath )
+	{
+		CStdioFile file;
+		const UINT uFlags =
+			CFile::modeCreate | CFile::modeWrite | CFile::shareDenyWrite;
+		if ( !file.Open( pcszPath, uFlags ) )
+		{
+			return false;
+		}
+
+		file.WriteString( _T( "path,original,digitized,datetime\n" ) );
+		for ( const EXPORT_ROW& row : m_Rows )
+		{
+			CString csLine = Quote( row.m_csFolder + _T( "\\" ) + row.m_csName );
+			for ( const CString& csDate : row.m_csDates )
+			{
+				csLine += _T( "," ) + Quote( csDate );
+			}
+			file.WriteString( csLine + _T( "\n" ) );
+		}
+
+		file.Close();
+		return true;
+	}
+
+	// save the rows as a columnar file
+	bool SaveColumnar( LPCTSTR pcszPath )
+	{
+		CFile file;
+		const UINT uFlags =
+			CFile::modeCreate | CFile::modeWrite | CFile::shareDenyWrite |
+			CFile::typeBinary;
+		if ( !file.Open( pcszPath, uFlags ) )
+		{
+			return false;
+		}
+
+		// the folder dictionary in the order of the sorted rows
+		map<CString, DWORD> mapFolders;
+		vector<BYTE> folders;
+		vector<BYTE> folder;
+		folder.reserve( m_Rows.size() * 4 );
+		for ( const EXPORT_ROW& row : m_Rows )
+		{
+			const auto result = mapFolders.insert
+			(
+				make_pair( row.m_csFolder, (DWORD)mapFolders.size() )
+			);
+			if ( result.second )
+			{
+				PutLong( folders, (DWORD)CStringA( row.m_csFolder ).GetLength() );
+				PutText( folders, row.m_csFolder );
+			}
+			PutLong( folder, result.first->second );
+		}
+
+		const char szSignature[] = "SDTCOLS\1";
+		vector<BYTE> header( szSignature, szSignature + 8 );
+		PutLong( header, (DWORD)m_Rows.size() );
+		PutLong( header, (DWORD)mapFolders.size() );
+
+		try
+		{
+			file.Write( header.data(), (UINT)header.size() );
+			file.Write( folders.data(), (UINT)folders.size() );
+			file.Write( folder.data(), (UINT)folder.size() );
+
+			// the name offsets and then the name bytes
+			vector<BYTE> names;
+			vector<BYTE> offsets;
+			offsets.reserve( m_Rows.size() * 4 );
+			for ( const EXPORT_ROW& row : m_Rows )
+			{
+				PutText( names, row.m_csName );
+				PutLong( offsets, (DWORD)names.size() );
+			}
+			file.Write( offsets.data(), (UINT)offsets.size() );
+			file.Write( names.data(), (UINT)names.size() );
+
+			// one fixed width column per date
+			vector<BYTE> column( m_Rows.size() * DATE_WIDTH );
+			for ( int nDate = 0; nDate < DATES; nDate++ )
+			{
+				fill( column.begin(), column.end(), (BYTE)0 );
+				BYTE* pCell = column.data();
+				for ( const EXPORT_ROW& row : m_Rows )
+				{
+					const CStringA csDate( row.m_csDates[ nDate ] );
+					memcpy( pCell, (LPCSTR)csDate, min( csDate.GetLength(), (int)DATE_WIDTH ) );
+					pCell += DATE_WIDTH;
+				}
+				file.Write( column.data(), (UINT)column.size() );
+			}
+
+		} catch ( CFileException* pException )
+		{
+			pException->Delete();
+			file.Abort();
+			return false;
+		}
+
+		file.Close();
+		return true;
+	}
+
+	// public properties
+public:
+	// number of images collected
+	inline int GetCount()
+	{
+		CSingleLock lock( &m_Lock, TRUE );
+		return (int)m_Rows.size();
+	}
+	// number of images collected
+	__declspec( property( get = GetCount ) )
+		int Count;
+
+	// public methods
+public:
+	// add the dates of one image
+	void Add
+	(
+		LPCTSTR pcszFolder, LPCTSTR pcszName, LPCTSTR pcszOriginal,
+		LPCTSTR pcszDigitized, LPCTSTR pcszDateTime
+	)
+	{
+		EXPORT_ROW row;
+		row.m_csFolder = pcszFolder;
+		row.m_csName = pcszName;
+		row.m_csDates[ 0 ] = pcszOriginal;
+		row.m_csDates[ 1 ] = pcszDigitized;
+		row.m_csDates[ 2 ] = pcszDateTime;
+
+		CSingleLock lock( &m_Lock, TRUE );
+		m_Rows.push_back( row );
+	}
+
+	// save the images sorted by pathname in the given format
+	bool Save( LPCTSTR pcszPath, EXPORT_FORMAT eFormat )
+	{
+		CSingleLock lock( &m_Lock, TRUE );
+
+		// the workers finish in any order
+		sort
+		(
+			m_Rows.begin(), m_Rows.end(),
+			[]( const EXPORT_ROW& left, const EXPORT_ROW& right )
+			{
+				const int nFolder = left.m_csFolder.CompareNoCase( right.m_csFolder );
+				return nFolder != 0 ?
+					nFolder < 0 : left.m_csName.CompareNoCase( right.m_csName ) < 0;
+			}
+		);
+
+		return eFormat == efCsv ? SaveCsv( pcszPath ) : SaveColumnar( pcszPath );
+	}
+
+	// public construction
+public:
+	CMetadataExport()
+	{
+	}
+	~CMetadataExport()
+	{
+	}
+};
+
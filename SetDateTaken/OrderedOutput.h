@@ -0,0 +1,130 @@
+/////////////////////////////////////////////////////////////////////////////
+// Copyright  by W. T. Block, all rights reserved
+/////////////////////////////////////////////////////////////////////////////
+#pragma once
+#include "stdafx.h"
+#include <functional>
+#include <map>
+
+using namespace std;
+
+/////////////////////////////////////////////////////////////////////////////
+// this class writes the output of the images in the order they were found
+// although the workers finish them in any order. Each output carries the
+// sequence number the image was given when it was found, and waits in a
+// reorder buffer until the output of every image found before it has been
+// written. The buffer holds at most a window of outputs, so when a slow
+// image holds up more than the window the outputs after it are written
+// and its own output is written whenever it arrives.
+class COrderedOutput
+{
+	// public definitions
+public:
+	// writes one output
+	typedef function<void( LPCTSTR )> SINK;
+
+	// protected data
+protected:
+	// the outputs waiting for an earlier output by sequence number
+	map<LONGLONG, CString> m_mapWaiting;
+
+	// the sequence number of the next output to write
+	LONGLONG m_llNext;
+
+	// the most outputs that wait at a time
+	size_t m_nWindow;
+
+	// writes one output
+	SINK m_Sink;
+
+	// guards the buffer and keeps the outputs from interleaving
+	CCriticalSection m_Lock;
+
+	// protected methods
+protected:
+	// write the waiting outputs that are next in order (the caller holds
+	// the lock)
+	void Drain()
+	{
+		auto waiting = m_mapWaiting.begin();
+		while ( waiting != m_mapWaiting.end() && waiting->first == m_llNext )
+		{
+			m_Sink( waiting->second );
+			waiting = m_mapWaiting.erase( waiting );
+			m_llNext++;
+		}
+	}
+
+	// public properties
+public:
+	// the most outputs that wait at a time
+	inline size_t GetWindow()
+	{
+		return m_nWindow;
+	}
+	// the most outputs that wait at a time
+	inline void SetWindow( size_t value )
+	{
+		m_nWindow = max( value, (size_t)1 );
+	}
+	// the most outputs that wait at a time
+	__declspec( property( get = GetWindow, put = SetWindow ) )
+		size_t Window;
+
+	// public methods
+public:
+	// start over from the first sequence number writing the outputs to
+	// the given sink
+	void Start( SINK sink )
+	{
+		CSingleLock lock( &m_Lock, TRUE );
+		m_Sink = sink;
+		m_mapWaiting.clear();
+		m_llNext = 0;
+	}
+
+	// write the output of the given sequence number once the outputs
+	// before it have been written
+	void Write( LONGLONG llSequence, LPCTSTR pcszOutput )
+	{
+		CSingleLock lock( &m_Lock, TRUE );
+
+		// an output that was given up on is written as soon as it comes
+		if ( llSequence < m_llNext )
+		{
+			m_Sink( pcszOutput );
+			return;
+		}
+
+		m_mapWaiting[ llSequence ] = pcszOutput;
+		Drain();
+
+		// stop waiting for the earliest missing output once the window
+		// is full
+		while ( m_mapWaiting.size() > m_nWindow )
+		{
+			m_llNext = m_mapWaiting.begin()->first;
+			Drain();
+		}
+	}
+
+	// write every waiting output in order
+	void Flush()
+	{
+		CSingleLock lock( &m_Lock, TRUE );
+		while ( !m_mapWaiting.empty() )
+		{
+			m_llNext = m_mapWaiting.begin()->first;
+			Drain();
+		}
+	}
+
+	// public construction
+public:
+	COrderedOutput()
+	{
+		m_llNext = 0;
+		m_nWindow = 1024;
+	}
+};
+
@@ -0,0 +1,257 @@
+/////////////////////////////////////////////////////////////////////////////
+// Copyright  by W. T. Block, all rights reserved
+/////////////////////////////////////////////////////////////////////////////
+#pragma once
+#include "stdafx.h"
+#include "BufferPool.h"
+
+/////////////////////////////////////////////////////////////////////////////
+// this class is a view of part of a string which neither owns nor copies
+// the characters, so the string must outlive the view
+class CPathView
+{
+	// protected data
+protected:
+	// the first character of the view
+	LPCTSTR m_pData;
+
+	// the number of characters in the view
+	int m_nLength;
+
+	// public properties
+public:
+	// the first character of the view which is not terminated
+	inline LPCTSTR GetData() const
+	{
+		return m_pData;
+	}
+	// the first character of the view which is not terminated
+	__declspec( property( get = GetData ) )
+		LPCTSTR Data;
+
+	// the number of characters in the view
+	inline int GetLength() const
+	{
+		return m_nLength;
+	}
+	// the number of characters in the view
+	__declspec( property( get = GetLength ) )
+		int Length;
+
+	// the view has no characters
+	inline bool GetEmpty() const
+	{
+		return m_nLength == 0;
+	}
+	// the view has no characters
+	__declspec( property( get = GetEmpty ) )
+		bool Empty;
+
+	// public methods
+public:
+	// the characters of the view as a new string
+	inline CString ToString() const
+	{
+		return CString( m_pData, m_nLength );
+	}
+
+	// the characters of the view as a new string
+	inline operator CString() const
+	{
+		return ToString();
+	}
+
+	// compare the view to the given string ignoring case
+	inline bool EqualsNoCase( LPCTSTR pcszOther ) const
+	{
+		return
+			_tcsnicmp( m_pData, pcszOther, m_nLength ) == 0 &&
+			pcszOther[ m_nLength ] == 0;
+	}
+
+	// public construction
+public:
+	CPathView( LPCTSTR pcszData = _T( "" ), int nLength = 0 )
+	{
+		m_pData = pcszData;
+		m_nLength = nLength;
+	}
+};
+
+/////////////////////////////////////////////////////////////////////////////
+// this class splits a pathname once into the same parts as _tsplitpath and
+// hands them out as views of the pathname, so no part is copied unless the
+// caller asks for a string. The pathname must outlive the parts. The data
+// name and the extension end the pathname, so their data is terminated.
+class CPathParts
+{
+	// protected data
+protected:
+	// the pathname
+	LPCTSTR m_pPath;
+
+	// length of the pathname
+	int m_nLength;
+
+	// length of the drive ("c:")
+	int m_nDrive;
+
+	// length of the drive and directory including the trailing backslash
+	int m_nFolder;
+
+	// offset of the extension including its period
+	int m_nExtension;
+
+	// public properties
+public:
+	// the drive of the pathname ("c:")
+	inline CPathView GetDrive() const
+	{
+		return CPathView( m_pPath, m_nDrive );
+	}
+	// the drive of the pathname ("c:")
+	__declspec( property( get = GetDrive ) )
+		CPathView Drive;
+
+	// the directory of the pathname with its trailing backslash
+	inline CPathView GetDirectory() const
+	{
+		return CPathView( m_pPath + m_nDrive, m_nFolder - m_nDrive );
+	}
+	// the directory of the pathname with its trailing backslash
+	__declspec( property( get = GetDirectory ) )
+		CPathView Directory;
+
+	// the drive and directory with the trailing backslash
+	inline CPathView GetFolder() const
+	{
+		return CPathView( m_pPath, m_nFolder );
+	}
+	// the drive and directory with the trailing backslash
+	__declspec( property( get = GetFolder ) )
+		CPathView Folder;
+
+	// the drive and directory without the trailing backslashes
+	inline CPathView GetParent() const
+	{
+		int nLength = m_nFolder;
+		while
+		(
+			nLength > 0 &&
+			( m_pPath[ nLength - 1 ] == _T( '\\' ) || m_pPath[ nLength - 1 ] == _T( '/' ) )
+		)
+		{
+			nLength--;
+		}
+		return CPathView( m_pPath, nLength );
+	}
+	// the drive and directory without the trailing backslashes
+	__declspec( property( get = GetParent ) )
+		CPathView Parent;
+
+	// the filename without the extension
+	inline CPathView GetFileName() const
+	{
+		return CPathView( m_pPath + m_nFolder, m_nExtension - m_nFolder );
+	}
+	// the filename without the extension
+	__declspec( property( get = GetFileName ) )
+		CPathView FileName;
+
+	// the extension including its period
+	inline CPathView GetExtension() const
+	{
+		return CPathView( m_pPath + m_nExtension, m_nLength - m_nExtension );
+	}
+	// the extension including its period
+	__declspec( property( get = GetExtension ) )
+		CPathView Extension;
+
+	// the filename and extension
+	inline CPathView GetDataName() const
+	{
+		return CPathView( m_pPath + m_nFolder, m_nLength - m_nFolder );
+	}
+	// the filename and extension
+	__declspec( property( get = GetDataName ) )
+		CPathView DataName;
+
+	// public construction
+public:
+	CPathParts( LPCTSTR pcszPath )
+	{
+		m_pPath = pcszPath;
+		m_nLength = (int)_tcslen( pcszPath );
+
+		// a drive letter and colon
+		m_nDrive = m_nLength >= 2 && pcszPath[ 1 ] == _T( ':' ) ? 2 : 0;
+
+		// the folder ends after the last separator, where the multibyte
+		// search never mistakes a trail byte for a backslash
+		LPCTSTR pBackslash = _tcsrchr( pcszPath + m_nDrive, _T( '\\' ) );
+		LPCTSTR pSlash = _tcsrchr( pcszPath + m_nDrive, _T( '/' ) );
+		LPCTSTR pSeparator =
+			pSlash != nullptr && ( pBackslash == nullptr || pSlash > pBackslash ) ?
+			pSlash : pBackslash;
+		m_nFolder =
+			pSeparator == nullptr ? m_nDrive : (int)( pSeparator - pcszPath ) + 1;
+
+		// the extension starts at the last period of the data name
+		LPCTSTR pPeriod = _tcsrchr( pcszPath + m_nFolder, _T( '.' ) );
+		m_nExtension =
+			pPeriod == nullptr ? m_nLength : (int)( pPeriod - pcszPath );
+	}
+};
+
+/////////////////////////////////////////////////////////////////////////////
+// this class holds the wide form of a pathname for GDI+, which is the one
+// place a pathname leaves the encoding used by the rest of the program. The
+// characters live in a buffer of the thread's pool.
+class CWidePath
+{
+	// protected data
+protected:
+#ifdef _UNICODE
+	// the pathname is already wide
+	LPCWSTR m_pPath;
+#else
+	// the converted pathname
+	CPooledBuffer m_Buffer;
+#endif
+
+	// public methods
+public:
+	// the wide pathname
+	inline operator LPCWSTR()
+	{
+#ifdef _UNICODE
+		return m_pPath;
+#else
+		return m_Buffer.Data == nullptr ? L"" : (LPCWSTR)m_Buffer.Data;
+#endif
+	}
+
+	// public construction
+public:
+#ifdef _UNICODE
+	CWidePath( LPCWSTR pcszPath )
+	{
+		m_pPath = pcszPath;
+	}
+#else
+	// a multibyte character never becomes more than one wide character
+	CWidePath( LPCSTR pcszPath ) :
+		m_Buffer( ( strlen( pcszPath ) + 1 ) * sizeof( WCHAR ) )
+	{
+		if ( m_Buffer.Data != nullptr )
+		{
+			const int nLength = (int)( m_Buffer.Size / sizeof( WCHAR ) );
+			::MultiByteToWideChar
+			(
+				CP_ACP, 0, pcszPath, -1, (LPWSTR)m_Buffer.Data, nLength
+			);
+		}
+	}
+#endif
+};
+
@@ -0,0 +1,266 @@
+/////////////////////////////////////////////////////////////////////////////
+// Copyright  by W. T. Block, all rights reserved
+/////////////////////////////////////////////////////////////////////////////
+#pragma once
+#include "stdafx.h"
+#include "BufferPool.h"
+#include "ContentHash.h"
+#include "IoThrottle.h"
+#include <algorithm>
+#include <vector>
+
+using namespace std;
+
+/////////////////////////////////////////////////////////////////////////////
+// a region of a file that holds image data
+typedef struct tagPayloadRange
+{
+	// file offset of the region
+	ULONGLONG m_ullOffset;
+
+	// length of the region
+	ULONGLONG m_ullLength;
+
+	// the regions are hashed in file order
+	bool operator<( const tagPayloadRange& other ) const
+	{
+		return m_ullOffset < other.m_ullOffset;
+	}
+
+} PAYLOAD_RANGE;
+
+/////////////////////////////////////////////////////////////////////////////
+// this class confirms that the image data of a file is copied unchanged
+// while its metadata is patched. The regions holding the image data (the
+// scan data of a JPEG file or the strips and tiles of a TIFF file) are
+// hashed as the blocks are read from the input, before anything is stamped
+// into them. Once the output is finished, including any XMP packet patched
+// after the copy, the same regions moved by a fixed amount are read back
+// from the output and hashed again, so the check compares the bytes that
+// reached the disk with the bytes of the input. A date stamped into the
+// image data, a block written at the wrong offset or a short write makes
+// the two hashes differ.
+class CPayloadCheck
+{
+	// protected definitions
+protected:
+	// the size of the blocks the output is read back in
+	enum { BLOCK_SIZE = 64 * 1024 };
+
+	// one side of the copy
+	typedef struct tagPayloadSide
+	{
+		// the hash of the image data passed so far
+		CContentHash m_Hash;
+
+		// bytes of image data passed so far
+		ULONGLONG m_ullLength;
+
+		// the first region that may still be in a later block
+		size_t m_nRange;
+
+	} PAYLOAD_SIDE;
+
+	// protected data
+protected:
+	// the regions of image data in the input in file order
+	vector<PAYLOAD_RANGE> m_arrRanges;
+
+	// bytes of image data in the input
+	ULONGLONG m_ullLength;
+
+	// how far the regions moved from the input to the output
+	LONGLONG m_llShift;
+
+	// the input side
+	PAYLOAD_SIDE m_Input;
+
+	// the output side
+	PAYLOAD_SIDE m_Output;
+
+	// protected methods
+protected:
+	// hash the parts of a block at the given file offset of one side that
+	// fall in the regions. The blocks of a side come in file order, so
+	// regions before the block are passed once.
+	void Update
+	(
+		PAYLOAD_SIDE& side, ULONGLONG ullOffset, const BYTE* pData, size_t nLength
+	)
+	{
+		const ULONGLONG ullEnd = ullOffset + nLength;
+		for ( size_t nRange = side.m_nRange; nRange < m_arrRanges.size(); nRange++ )
+		{
+			const PAYLOAD_RANGE& range = m_arrRanges[ nRange ];
+			const ULONGLONG ullStart = range.m_ullOffset;
+			const ULONGLONG ullStop = ullStart + range.m_ullLength;
+			if ( ullStart >= ullEnd )
+			{
+				break;
+			}
+			if ( ullStop <= ullOffset )
+			{
+				side.m_nRange = nRange + 1;
+				continue;
+			}
+
+			const ULONGLONG ullFrom = max( ullStart, ullOffset );
+			const ULONGLONG ullTo = min( ullStop, ullEnd );
+			side.m_Hash.Update( pData + ( ullFrom - ullOffset ), (size_t)( ullTo - ullFrom ) );
+			side.m_ullLength += ullTo - ullFrom;
+		}
+	}
+
+	// public properties
+public:
+	// the file has image data to compare
+	inline bool GetChecked()
+	{
+		return m_ullLength != 0;
+	}
+	// the file has image data to compare
+	__declspec( property( get = GetChecked ) )
+		bool Checked;
+
+	// the image data of the output is the image data of the input
+	inline bool GetMatches()
+	{
+		return
+			m_Input.m_ullLength == m_ullLength &&
+			m_Output.m_ullLength == m_ullLength &&
+			m_Input.m_Hash.Final() == m_Output.m_Hash.Final();
+	}
+	// the image data of the output is the image data of the input
+	__declspec( property( get = GetMatches ) )
+		bool Matches;
+
+	// public methods
+public:
+	// start a new copy of the given regions of image data, which are
+	// found at the given distance from their input offsets in the output
+	void Start( const vector<PAYLOAD_RANGE>& ranges, LONGLONG llShift )
+	{
+		Reset();
+		m_arrRanges = ranges;
+		m_llShift = llShift;
+		sort( m_arrRanges.begin(), m_arrRanges.end() );
+
+		// overlapping regions are merged so no byte is hashed twice
+		size_t nMerged = 0;
+		for ( const PAYLOAD_RANGE& range : m_arrRanges )
+		{
+			if ( range.m_ullLength == 0 )
+			{
+				continue;
+			}
+
+			if ( nMerged != 0 )
+			{
+				PAYLOAD_RANGE& last = m_arrRanges[ nMerged - 1 ];
+				const ULONGLONG ullStop = last.m_ullOffset + last.m_ullLength;
+				if ( range.m_ullOffset <= ullStop )
+				{
+					last.m_ullLength = max
+					(
+						ullStop, range.m_ullOffset + range.m_ullLength
+					) - last.m_ullOffset;
+					continue;
+				}
+			}
+
+			m_arrRanges[ nMerged++ ] = range;
+		}
+		m_arrRanges.resize( nMerged );
+
+		for ( const PAYLOAD_RANGE& range : m_arrRanges )
+		{
+			m_ullLength += range.m_ullLength;
+		}
+	}
+
+	// forget the regions so nothing is compared
+	void Reset()
+	{
+		m_arrRanges.clear();
+		m_ullLength = 0;
+		m_llShift = 0;
+		m_Input.m_Hash.Reset();
+		m_Input.m_ullLength = 0;
+		m_Input.m_nRange = 0;
+		m_Output.m_Hash.Reset();
+		m_Output.m_ullLength = 0;
+		m_Output.m_nRange = 0;
+	}
+
+	// a block read from the input at the given offset
+	void Read( ULONGLONG ullOffset, const BYTE* pData, size_t nLength )
+	{
+		Update( m_Input, ullOffset, pData, nLength );
+	}
+
+	// read the regions of image data back from the finished output and
+	// hash them. Returns false if the output cannot be read, in which case
+	// it does not match.
+	bool ReadOutput( LPCTSTR pcszOutput )
+	{
+		m_Output.m_Hash.Reset();
+		m_Output.m_ullLength = 0;
+		m_Output.m_nRange = 0;
+		if ( m_arrRanges.empty() )
+		{
+			return true;
+		}
+
+		CPooledBuffer buffer( BLOCK_SIZE );
+		CFile file;
+		if ( buffer.Data == nullptr || !file.Open
+		(
+			pcszOutput,
+			CFile::modeRead | CFile::shareDenyWrite | CFile::typeBinary
+		) )
+		{
+			return false;
+		}
+
+		bool value = true;
+		try
+		{
+			for ( const PAYLOAD_RANGE& range : m_arrRanges )
+			{
+				file.Seek( (LONGLONG)range.m_ullOffset + m_llShift, CFile::begin );
+				ULONGLONG ullLeft = range.m_ullLength;
+				while ( ullLeft != 0 )
+				{
+					const UINT uiRead = file.Read
+					(
+						buffer.Data, (UINT)min( ullLeft, (ULONGLONG)buffer.Size )
+					);
+					if ( uiRead == 0 )
+					{
+						break;
+					}
+					CIoThrottle::Read( uiRead );
+					m_Output.m_Hash.Update( buffer.Data, uiRead );
+					m_Output.m_ullLength += uiRead;
+					ullLeft -= uiRead;
+				}
+			}
+
+		} catch ( CFileException* pException )
+		{
+			pException->Delete();
+			value = false;
+		}
+
+		file.Close();
+		return value;
+	}
+
+	// public construction
+public:
+	CPayloadCheck()
+	{
+		Reset();
+	}
+};
+
@@ -0,0 +1,319 @@
+/////////////////////////////////////////////////////////////////////////////
+// Copyright  by W. T. Block, all rights reserved
+/////////////////////////////////////////////////////////////////////////////
+#pragma once
+#include "stdafx.h"
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+using namespace std;
+
+/////////////////////////////////////////////////////////////////////////////
+// the counters of a run at one moment
+typedef struct tagProgressSample
+{
+	// folders found but not listed yet
+	LONGLONG m_llFoldersPending;
+
+	// images found
+	LONGLONG m_llFound;
+
+	// images done, written or failed
+	LONGLONG m_llProcessed;
+
+	// images skipped because another name or job has them
+	LONGLONG m_llSkipped;
+
+	// images that failed
+	LONGLONG m_llFailed;
+
+	// bytes read from the images
+	ULONGLONG m_ullRead;
+
+	// bytes written
+	ULONGLONG m_ullWritten;
+
+	// the tree is still being walked, so more images may be found
+	bool m_bWalking;
+
+	tagProgressSample()
+	{
+		m_llFoldersPending = 0;
+		m_llFound = 0;
+		m_llProcessed = 0;
+		m_llSkipped = 0;
+		m_llFailed = 0;
+		m_ullRead = 0;
+		m_ullWritten = 0;
+		m_bWalking = false;
+	}
+
+} PROGRESS_SAMPLE;
+
+/////////////////////////////////////////////////////////////////////////////
+// this class reports the progress of a run from a thread of its own. A
+// few times a second it takes a sample of the counters the workers keep
+// anyway, so the workers do nothing extra, and draws a status line with
+// the rate and the time remaining on standard error, and writes the same
+// numbers to a status file for monitoring. The status file is replaced as
+// a whole so a reader never sees half of it.
+class CProgressReporter
+{
+	// public definitions
+public:
+	// fills in a sample of the counters
+	typedef function<void( PROGRESS_SAMPLE& )> SAMPLER;
+
+	// protected definitions
+protected:
+	// the clock of the samples
+	typedef chrono::steady_clock CLOCK;
+
+	// milliseconds between samples
+	enum { PERIOD = 250 };
+
+	// the weight of the latest sample in the smoothed rate
+	static inline double GetSmoothing()
+	{
+		return 0.2;
+	}
+
+	// protected data
+protected:
+	// fills in a sample of the counters
+	SAMPLER m_Sampler;
+
+	// draw the status line on standard error
+	bool m_bConsole;
+
+	// the status file, if any
+	CString m_csStatusFile;
+
+	// the thread that takes the samples
+	thread m_Thread;
+
+	// the thread exits when this is set
+	bool m_bStop;
+
+	// guards the stop flag
+	mutex m_Mutex;
+
+	// signaled when the reporter is stopping
+	condition_variable m_cvStop;
+
+	// the start of the run
+	CLOCK::time_point m_Start;
+
+	// the previous sample and its time
+	PROGRESS_SAMPLE m_Last;
+	CLOCK::time_point m_LastTime;
+
+	// the smoothed images done per second
+	double m_dRate;
+
+	// the length of the last status line drawn
+	int m_nLastLine;
+
+	// protected methods
+protected:
+	// format a number of seconds as hours, minutes and seconds
+	static CString FormatTime( double dSeconds )
+	{
+		const LONGLONG llSeconds = (LONGLONG)( dSeconds + 0.5 );
+		CString value;
+		value.Format
+		(
+			_T( "%I64d:%02I64d:%02I64d" ), llSeconds / 3600,
+			llSeconds / 60 % 60, llSeconds % 60
+		);
+		return value;
+	}
+
+	// take a sample, update the rate and report it
+	void Report( bool bFinal )
+	{
+		PROGRESS_SAMPLE sample;
+		m_Sampler( sample );
+
+		const CLOCK::time_point now = CLOCK::now();
+		const double dInterval =
+			chrono::duration<double>( now - m_LastTime ).count();
+		const double dElapsed =
+			chrono::duration<double>( now - m_Start ).count();
+		if ( dInterval > 0 )
+		{
+			const double dRate =
+				( sample.m_llProcessed - m_Last.m_llProcessed ) / dInterval;
+			m_dRate = m_dRate == 0 ?
+				dRate : m_dRate + GetSmoothing() * ( dRate - m_dRate );
+		}
+		const double dReadRate = dElapsed > 0 ? sample.m_ullRead / dElapsed : 0;
+		const double dWriteRate = dElapsed > 0 ? sample.m_ullWritten / dElapsed : 0;
+
+		// the time remaining is only known for the images found so far
+		// while the walk goes on
+		const LONGLONG llRemaining =
+			max( sample.m_llFound - sample.m_llProcessed, 0LL );
+		const double dRemaining = m_dRate > 0 ? llRemaining / m_dRate : -1;
+
+		m_Last = sample;
+		m_LastTime = now;
+
+		if ( m_bConsole )
+		{
+			DrawLine( sample, dReadRate, dWriteRate, dRemaining, bFinal );
+		}
+
+		if ( !m_csStatusFile.IsEmpty() )
+		{
+			WriteStatus
+			(
+				sample, dElapsed, dReadRate, dWriteRate, dRemaining, bFinal
+			);
+		}
+	}
+
+	// draw the status line over the previous one on standard error
+	void DrawLine
+	(
+		const PROGRESS_SAMPLE& sample, double dReadRate, double dWriteRate,
+		double dRemaining, bool bFinal
+	)
+	{
+		CString csLine;
+		csLine.Format
+		(
+			_T( "%I64d/%I64d%s done, %I64d failed, %I64d skipped, " )
+			_T( "%I64d folders, %.1f/s, read %.1f MB/s, write %.1f MB/s, ETA %s" ),
+			sample.m_llProcessed, sample.m_llFound,
+			sample.m_bWalking ? _T( "+" ) : _T( "" ),
+			sample.m_llFailed, sample.m_llSkipped, sample.m_llFoldersPending,
+			m_dRate, dReadRate / ( 1024 * 1024 ), dWriteRate / ( 1024 * 1024 ),
+			dRemaining < 0 ? CString( _T( "-" ) ) : FormatTime( dRemaining )
+		);
+
+		// blank out the rest of a longer previous line
+		const int nLength = csLine.GetLength();
+		if ( nLength < m_nLastLine )
+		{
+			csLine += CString( _T( ' ' ), m_nLastLine - nLength );
+		}
+		m_nLastLine = nLength;
+
+		_ftprintf( stderr, _T( "\r%s%s" ), (LPCTSTR)csLine, bFinal ? _T( "\n" ) : _T( "" ) );
+		fflush( stderr );
+	}
+
+	// replace the status file with a JSON object of the sample
+	void WriteStatus
+	(
+		const PROGRESS_SAMPLE& sample, double dElapsed, double dReadRate,
+		double dWriteRate, double dRemaining, bool bFinal
+	)
+	{
+		CString csStatus;
+		csStatus.Format
+		(
+			_T( "{\"state\": \"%s\", \"elapsed\": %.1f, " )
+			_T( "\"folders_pending\": %I64d, \"found\": %I64d, " )
+			_T( "\"processed\": %I64d, \"skipped\": %I64d, \"failed\": %I64d, " )
+			_T( "\"bytes_read\": %I64u, \"bytes_written\": %I64u, " )
+			_T( "\"files_per_second\": %.2f, \"read_bytes_per_second\": %.0f, " )
+			_T( "\"write_bytes_per_second\": %.0f, \"eta_seconds\": %.0f}\n" ),
+			bFinal ? _T( "done" ) : sample.m_bWalking ? _T( "walking" ) : _T( "processing" ),
+			dElapsed, sample.m_llFoldersPending, sample.m_llFound,
+			sample.m_llProcessed, sample.m_llSkipped, sample.m_llFailed,
+			sample.m_ullRead, sample.m_ullWritten, m_dRate, dReadRate,
+			dWriteRate, bFinal ? 0 : dRemaining
+		);
+
+		const CString csTemporary = m_csStatusFile + _T( ".tmp" );
+		CStdioFile file;
+		const UINT uFlags =
+			CFile::modeCreate | CFile::modeWrite | CFile::shareDenyWrite;
+		if ( !file.Open( csTemporary, uFlags ) )
+		{
+			return;
+		}
+		file.WriteString( csStatus );
+		file.Close();
+
+		::MoveFileEx( csTemporary, m_csStatusFile, MOVEFILE_REPLACE_EXISTING );
+	}
+
+	// the thread loop that reports until the reporter is stopped
+	void Run()
+	{
+		unique_lock<mutex> lock( m_Mutex );
+		while ( !m_cvStop.wait_for
+		(
+			lock, chrono::milliseconds( PERIOD ), [ this ] { return m_bStop; }
+		) )
+		{
+			lock.unlock();
+			Report( false );
+			lock.lock();
+		}
+	}
+
+	// public methods
+public:
+	// start reporting the samples of the given sampler on the console
+	// and to the given status file, either of which may be left out
+	void Start( SAMPLER sampler, bool bConsole, LPCTSTR pcszStatusFile )
+	{
+		Stop();
+
+		m_Sampler = sampler;
+		m_bConsole = bConsole;
+		m_csStatusFile = pcszStatusFile == nullptr ? _T( "" ) : pcszStatusFile;
+		if ( !m_bConsole && m_csStatusFile.IsEmpty() )
+		{
+			return;
+		}
+
+		m_Start = CLOCK::now();
+		m_LastTime = m_Start;
+		m_Last = PROGRESS_SAMPLE();
+		m_dRate = 0;
+		m_nLastLine = 0;
+		m_bStop = false;
+		m_Thread = thread( &CProgressReporter::Run, this );
+	}
+
+	// stop the thread and report the final sample
+	void Stop()
+	{
+		if ( !m_Thread.joinable() )
+		{
+			return;
+		}
+
+		{
+			lock_guard<mutex> lock( m_Mutex );
+			m_bStop = true;
+		}
+		m_cvStop.notify_all();
+		m_Thread.join();
+
+		Report( true );
+	}
+
+	// public construction / destruction
+public:
+	CProgressReporter()
+	{
+		m_bConsole = false;
+		m_bStop = false;
+		m_dRate = 0;
+		m_nLastLine = 0;
+	}
+	~CProgressReporter()
+	{
+		Stop();
+	}
+};
+
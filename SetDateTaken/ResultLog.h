@@ -0,0 +1,211 @@
+/////////////////////////////////////////////////////////////////////////////
+// Copyright  by W. T. Block, all rights reserved
+/////////////////////////////////////////////////////////////////////////////
+#pragma once
+#include "stdafx.h"
+#include <algorithm>
+#include <vector>
+
+using namespace std;
+
+/////////////////////////////////////////////////////////////////////////////
+// this class writes one tab separated line per image with the result, the
+// pathname and the new date. The log of each shard of a sharded run starts
+// with a line naming the shard, and the logs of all the shards can be
+// merged into one log sorted by pathname as if the tree had been processed
+// by a single run.
+class CResultLog
+{
+	// protected data
+protected:
+	// the open log
+	CStdioFile m_File;
+
+	// the log is open
+	bool m_bOpen;
+
+	// guards the log against concurrent workers
+	CCriticalSection m_Lock;
+
+	// protected methods
+protected:
+	// the pathname is the second field of a result line
+	static CString GetPathName( const CString& csLine )
+	{
+		int nStart = csLine.Find( _T( '\t' ) );
+		if ( nStart == -1 )
+		{
+			return csLine;
+		}
+
+		nStart++;
+		const int nEnd = csLine.Find( _T( '\t' ), nStart );
+		return nEnd == -1 ? csLine.Mid( nStart ) : csLine.Mid( nStart, nEnd - nStart );
+	}
+
+	// public properties
+public:
+	// the log is open
+	inline bool GetOpened()
+	{
+		return m_bOpen;
+	}
+	// the log is open
+	__declspec( property( get = GetOpened ) )
+		bool Opened;
+
+	// public methods
+public:
+	// create the log which replaces an existing log of the same name,
+	// and write a header if one is given
+	bool Create( LPCTSTR pcszPath, LPCTSTR pcszHeader = nullptr )
+	{
+		CSingleLock lock( &m_Lock, TRUE );
+		if ( m_bOpen )
+		{
+			return false;
+		}
+
+		const UINT uFlags =
+			CFile::modeCreate | CFile::modeWrite | CFile::shareDenyWrite;
+		if ( !m_File.Open( pcszPath, uFlags ) )
+		{
+			return false;
+		}
+
+		m_bOpen = true;
+		if ( pcszHeader != nullptr )
+		{
+			m_File.WriteString( CString( _T( "# " ) ) + pcszHeader + _T( "\n" ) );
+		}
+		return true;
+	}
+
+	// record the result of one image
+	void Write( LPCTSTR pcszResult, LPCTSTR pcszPath, LPCTSTR pcszDate )
+	{
+		CSingleLock lock( &m_Lock, TRUE );
+		if ( !m_bOpen )
+		{
+			return;
+		}
+
+		CString csLine;
+		csLine.Format( _T( "%s\t%s\t%s\n" ), pcszResult, pcszPath, pcszDate );
+		m_File.WriteString( csLine );
+	}
+
+	// write the given line as it is
+	void WriteLine( LPCTSTR pcszLine )
+	{
+		CSingleLock lock( &m_Lock, TRUE );
+		if ( m_bOpen )
+		{
+			m_File.WriteString( CString( pcszLine ) + _T( "\n" ) );
+		}
+	}
+
+	// close the log
+	void Close()
+	{
+		CSingleLock lock( &m_Lock, TRUE );
+		if ( m_bOpen )
+		{
+			m_File.Close();
+			m_bOpen = false;
+		}
+	}
+
+	/////////////////////////////////////////////////////////////////////////
+	// merge the given logs into one log sorted by pathname. The header
+	// lines are collected into the given list and the number of lines of
+	// each result are returned in the given parallel lists. Returns false
+	// if a log cannot be read or the merged log cannot be written.
+	static bool Merge
+	(
+		const vector<CString>& logs, LPCTSTR pcszMerged,
+		vector<CString>& headers, vector<CString>& results,
+		vector<int>& counts, CString& csError
+	)
+	{
+		vector<CString> lines;
+		for ( const CString& csLog : logs )
+		{
+			CStdioFile file;
+			if ( !file.Open( csLog, CFile::modeRead | CFile::shareDenyWrite ) )
+			{
+				csError.Format( _T( "Unable to read log:\n\t%s\n" ), csLog );
+				return false;
+			}
+
+			CString csLine;
+			while ( file.ReadString( csLine ) )
+			{
+				if ( csLine.IsEmpty() )
+				{
+					continue;
+				}
+
+				if ( csLine.Left( 1 ) == _T( "#" ) )
+				{
+					headers.push_back( csLine.Mid( 1 ).Trim() );
+					continue;
+				}
+
+				lines.push_back( csLine );
+			}
+			file.Close();
+		}
+
+		// the order of a single run does not depend on the shards
+		stable_sort
+		(
+			lines.begin(), lines.end(),
+			[]( const CString& csLeft, const CString& csRight )
+			{
+				return GetPathName( csLeft ).CompareNoCase( GetPathName( csRight ) ) < 0;
+			}
+		);
+
+		CStdioFile merged;
+		const UINT uFlags =
+			CFile::modeCreate | CFile::modeWrite | CFile::shareDenyWrite;
+		if ( !merged.Open( pcszMerged, uFlags ) )
+		{
+			csError.Format( _T( "Unable to write log:\n\t%s\n" ), pcszMerged );
+			return false;
+		}
+
+		for ( const CString& csLine : lines )
+		{
+			merged.WriteString( csLine + _T( "\n" ) );
+
+			const CString csResult = csLine.SpanExcluding( _T( "\t" ) );
+			const auto found = find( results.begin(), results.end(), csResult );
+			if ( found == results.end() )
+			{
+				results.push_back( csResult );
+				counts.push_back( 1 );
+
+			} else
+			{
+				counts[ found - results.begin() ]++;
+			}
+		}
+		merged.Close();
+
+		return true;
+	}
+
+	// public construction / destruction
+public:
+	CResultLog()
+	{
+		m_bOpen = false;
+	}
+	~CResultLog()
+	{
+		Close();
+	}
+};
+
@@ -0,0 +1,224 @@
+/////////////////////////////////////////////////////////////////////////////
+// Copyright  by W. T. Block, all rights reserved
+/////////////////////////////////////////////////////////////////////////////
+#pragma once
+#include "stdafx.h"
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <random>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+/////////////////////////////////////////////////////////////////////////////
+// this class holds the work that failed for a reason that may pass, such
+// as a share that dropped its connection, and runs it again once its delay
+// has passed. The delay doubles with each attempt up to a limit, and half
+// of it is random so the retries of many files spread out instead of
+// hitting the storage together. A thread of its own waits for the delays,
+// started by the first retry, so the workers never sleep on a retry.
+class CRetryQueue
+{
+	// public definitions
+public:
+	// the work to run again
+	typedef function<void()> ACTION;
+
+	// protected definitions
+protected:
+	// the clock of the delays
+	typedef chrono::steady_clock CLOCK;
+
+	// work waiting for its delay to pass
+	typedef struct tagRetryEntry
+	{
+		// when the work is run again
+		CLOCK::time_point m_Due;
+
+		// the work
+		ACTION m_Action;
+
+		// the earliest entry comes first in the priority queue
+		bool operator<( const tagRetryEntry& other ) const
+		{
+			return m_Due > other.m_Due;
+		}
+
+	} RETRY_ENTRY;
+
+	// protected data
+protected:
+	// the work waiting by the time it is due
+	priority_queue<RETRY_ENTRY> m_Queue;
+
+	// number of actions being run by the thread
+	int m_nRunning;
+
+	// the thread that runs the work when it is due
+	thread m_Thread;
+
+	// the thread exits when this is set
+	bool m_bStop;
+
+	// guards the queue
+	mutex m_Mutex;
+
+	// signaled when work is added or the queue is stopping
+	condition_variable m_cvAdded;
+
+	// signaled when the queue has no more work waiting
+	condition_variable m_cvEmpty;
+
+	// the delay of the first retry in milliseconds
+	int m_nBaseDelay;
+
+	// the longest delay in milliseconds
+	int m_nMaxDelay;
+
+	// number of times a file is tried before it has failed
+	int m_nMaxAttempts;
+
+	// the random half of the delays
+	mt19937 m_Random;
+
+	// protected methods
+protected:
+	// the thread loop that runs the work as it becomes due
+	void Run()
+	{
+		unique_lock<mutex> lock( m_Mutex );
+		do
+		{
+			if ( m_Queue.empty() )
+			{
+				m_cvEmpty.notify_all();
+				if ( m_bStop )
+				{
+					break;
+				}
+				m_cvAdded.wait( lock );
+				continue;
+			}
+
+			const CLOCK::time_point due = m_Queue.top().m_Due;
+			if ( CLOCK::now() < due && !m_bStop )
+			{
+				m_cvAdded.wait_until( lock, due );
+				continue;
+			}
+
+			// the work may block while the workers are busy, so it runs
+			// outside of the lock
+			ACTION action = m_Queue.top().m_Action;
+			m_Queue.pop();
+			m_nRunning++;
+			lock.unlock();
+
+			action();
+
+			lock.lock();
+			m_nRunning--;
+
+		} while ( true );
+	}
+
+	// public properties
+public:
+	// number of times a file is tried before it has failed
+	inline int GetMaxAttempts()
+	{
+		return m_nMaxAttempts;
+	}
+	// number of times a file is tried before it has failed
+	inline void SetMaxAttempts( int value )
+	{
+		m_nMaxAttempts = max( value, 1 );
+	}
+	// number of times a file is tried before it has failed
+	__declspec( property( get = GetMaxAttempts, put = SetMaxAttempts ) )
+		int MaxAttempts;
+
+	// public methods
+public:
+	// run the given work again after the delay of the given attempt,
+	// counting from zero for the first retry
+	void Add( ACTION action, int nAttempt )
+	{
+		{
+			lock_guard<mutex> lock( m_Mutex );
+
+			const int nShift = min( nAttempt, 16 );
+			const int nDelay = (int)min
+			(
+				(LONGLONG)m_nBaseDelay << nShift, (LONGLONG)m_nMaxDelay
+			);
+			const int nJitter =
+				uniform_int_distribution<int>( 0, nDelay / 2 )( m_Random );
+
+			RETRY_ENTRY entry;
+			entry.m_Due =
+				CLOCK::now() + chrono::milliseconds( nDelay - nDelay / 2 + nJitter );
+			entry.m_Action = move( action );
+			m_Queue.push( move( entry ) );
+
+			if ( !m_Thread.joinable() )
+			{
+				m_bStop = false;
+				m_Thread = thread( &CRetryQueue::Run, this );
+			}
+		}
+		m_cvAdded.notify_one();
+	}
+
+	// wait until every waiting retry has been run. Returns false at once
+	// if no retry was waiting.
+	bool WaitForPending()
+	{
+		unique_lock<mutex> lock( m_Mutex );
+		if ( m_Queue.empty() && m_nRunning == 0 )
+		{
+			return false;
+		}
+
+		m_cvEmpty.wait
+		(
+			lock, [ this ] { return m_Queue.empty() && m_nRunning == 0; }
+		);
+		return true;
+	}
+
+	// run the waiting retries at once and end the thread
+	void Stop()
+	{
+		{
+			lock_guard<mutex> lock( m_Mutex );
+			m_bStop = true;
+		}
+		m_cvAdded.notify_all();
+
+		if ( m_Thread.joinable() )
+		{
+			m_Thread.join();
+		}
+	}
+
+	// public construction / destruction
+public:
+	CRetryQueue() : m_Random( random_device()() )
+	{
+		m_nRunning = 0;
+		m_bStop = false;
+		m_nBaseDelay = 500;
+		m_nMaxDelay = 30 * 1000;
+		m_nMaxAttempts = 4;
+	}
+	~CRetryQueue()
+	{
+		Stop();
+	}
+};
+
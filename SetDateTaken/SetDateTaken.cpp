@@ -4,6 +4,9 @@
 #include "stdafx.h"
 #include "SetDateTaken.h"
 #include "CHelper.h"
+#include "XmpSidecar.h"
+#include "JpegPatcher.h"
+#include "ExifReader.h"
 
 #ifdef _DEBUG
 #define new DEBUG_NEW
@@ -25,20 +28,20 @@ CString GetStringProperty( Gdiplus::Image* pImage, PROPID id )
 	// if the property exists, it will have a non-zero size 
 	if ( uiSize > 0 )
 	{
-		// using a smart pointer which will release itself
-		// when it goes out of context
-		unique_ptr<Gdiplus::PropertyItem> pItem =
-			unique_ptr<Gdiplus::PropertyItem>
-			(
-				(PropertyItem*)malloc( uiSize )
-			);
+		// a buffer of the thread's pool which returns to the
+		// pool when it goes out of context
+		CPooledBuffer item( uiSize );
+		Gdiplus::PropertyItem* pItem = (Gdiplus::PropertyItem*)item.Data;
 
 		// Get the property item.
-		pImage->GetPropertyItem( id, uiSize, pItem.get() );
-
-		// the property should be ASCII
-		if ( pItem->type == PropertyTagTypeASCII )
+		if
+		(
+			pItem != nullptr &&
+			pImage->GetPropertyItem( id, uiSize, pItem ) == Gdiplus::Ok &&
+			pItem->type == PropertyTagTypeASCII
+		)
 		{
+			// the property should be ASCII
 			value = (LPCSTR)pItem->value;
 		}
 	}
@@ -144,37 +147,152 @@ void CDate::SetDateTaken( CString csDate )
 } // SetDateTaken
 
 /////////////////////////////////////////////////////////////////////////////
-// get the current date taken, if any, from the given filename
-CString GetCurrentDateTaken( LPCTSTR lpszPathName )
+// the size of the given file in bytes, which is zero if it is not found
+ULONGLONG GetFileLength( LPCTSTR lpszPathName )
 {
-	USES_CONVERSION;
+	WIN32_FILE_ATTRIBUTE_DATA data;
+	if ( !::GetFileAttributesEx( lpszPathName, GetFileExInfoStandard, &data ) )
+	{
+		return 0;
+	}
 
-	CString value;
+	return ( (ULONGLONG)data.nFileSizeHigh << 32 ) | data.nFileSizeLow;
+} // GetFileLength
+
+/////////////////////////////////////////////////////////////////////////////
+// estimate the memory GDI+ needs to open and save an image of the given
+// mime type and file size, which is the file itself and the decoded
+// pixels that a compressed format expands to
+ULONGLONG EstimateMemory( LPCTSTR pcszMimeType, ULONGLONG ullLength )
+{
+	const CString csMimeType( pcszMimeType );
+	ULONGLONG ullExpansion = 4;
+	if ( csMimeType == _T( "image/jpeg" ) )
+	{
+		ullExpansion = 10;
+
+	} else if ( csMimeType == _T( "image/tiff" ) )
+	{
+		ullExpansion = 2;
+
+	} else if ( csMimeType == _T( "image/bmp" ) )
+	{
+		ullExpansion = 1;
+	}
+
+	return ullLength + ullLength * ullExpansion;
+} // EstimateMemory
+
+/////////////////////////////////////////////////////////////////////////////
+// an image whose estimated memory is more than the share of the memory
+// budget of each image in flight
+bool IsLargeImage( ULONGLONG ullMemory )
+{
+	const ULONGLONG ullBudget = m_MemoryBudget.Budget;
+	return ullBudget != 0 && ullMemory > ullBudget / max( m_Pool.Limit, 1 );
+} // IsLargeImage
+
+/////////////////////////////////////////////////////////////////////////////
+// copy a file once the read and write limits allow for its size
+BOOL CopyFileThrottled
+(
+	LPCTSTR lpszExisting, LPCTSTR lpszNew, BOOL bFailIfExists
+)
+{
+	const ULONGLONG ullLength = GetFileLength( lpszExisting );
+	CIoThrottle::Read( ullLength );
+	CIoThrottle::Write( ullLength );
+
+	return ::CopyFile( lpszExisting, lpszNew, bFailIfExists );
+} // CopyFileThrottled
+
+/////////////////////////////////////////////////////////////////////////////
+// read the DateTimeOriginal, DateTimeDigitized and DateTime properties of
+// the given image, which are empty if the image does not have them. The
+// hash of the start of a JPEG or TIFF file is returned if asked for, and
+// is left alone for the other images.
+void GetDateProperties
+(
+	LPCTSTR lpszPathName, CString& csOriginal, CString& csDigitized,
+	CString& csDateTime, ULONGLONG* pullHead = nullptr
+)
+{
+	// the dates of a JPEG or TIFF file are read straight from its
+	// EXIF data without opening the image
+	if ( CExifReader::GetDates
+	(
+		lpszPathName, csOriginal, csDigitized, csDateTime, pullHead
+	) )
+	{
+		return;
+	}
+
+	// only the other formats need GDI+, which may read the whole file
+	// and decode the whole image within the memory budget
+	if ( !InitGdiplus() )
+	{
+		return;
+	}
+	const ULONGLONG ullLength = GetFileLength( lpszPathName );
+	CIoThrottle::Read( ullLength );
+
+	CString csMimeType;
+	m_Extension.FindMimeType
+	(
+		CPathParts( lpszPathName ).Extension.ToString().MakeLower(), csMimeType
+	);
+	CMemoryReservation reservation
+	(
+		m_MemoryBudget, EstimateMemory( csMimeType, ullLength )
+	);
 
 	// smart pointer to the image representing this file
 	unique_ptr<Gdiplus::Image> pImage =
 		unique_ptr<Gdiplus::Image>
 		(
-			Gdiplus::Image::FromFile( T2CW( lpszPathName ) )
+			Gdiplus::Image::FromFile( CWidePath( lpszPathName ) )
 		);
 
 	// test the date properties stored in the given image
-	CString csOriginal =
+	csOriginal =
 		GetStringProperty( pImage.get(), PropertyTagExifDTOrig );
-	CString csDigitized =
+	csDigitized =
 		GetStringProperty( pImage.get(), PropertyTagExifDTDigitized );
+	csDateTime =
+		GetStringProperty( pImage.get(), PropertyTagDateTime );
+
+} // GetDateProperties
+
+/////////////////////////////////////////////////////////////////////////////
+// get the current date taken, if any, from the given filename and
+// populate the given date class with it, along with the hash of the start
+// of the file if asked for
+CString GetCurrentDateTaken
+(
+	LPCTSTR lpszPathName, CDate& date, ULONGLONG* pullHead = nullptr
+)
+{
+	CString value;
+
+	CString csOriginal;
+	CString csDigitized;
+	CString csDateTime;
+	GetDateProperties
+	(
+		lpszPathName, csOriginal, csDigitized, csDateTime, pullHead
+	);
 
 	// officially the original property is the date taken in this
 	// format: "YYYY:MM:DD HH:MM:SS"
-	m_Date.DateTaken = csOriginal;
-	if ( m_Date.Okay )
+	date.DateTaken = csOriginal;
+	if ( date.Okay )
 	{
 		value = csOriginal;
 
 	} else // alternately use the date digitized
 	{
-		m_Date.DateTaken = csDigitized;
-		if ( m_Date.Okay )
+		date.DateTaken = csDigitized;
+		if ( date.Okay )
 		{
 			value = csDigitized;
 		}
@@ -184,12 +302,82 @@ CString GetCurrentDateTaken( LPCTSTR lpszPathName )
 } // GetCurrentDateTaken
 
 /////////////////////////////////////////////////////////////////////////////
-// Save the data inside pImage to the given filename but relocated to the 
-// sub-folder "Corrected"
-bool Save( LPCTSTR lpszPathName, Gdiplus::Image* pImage )
+// given the root of the tree being scanned and a source folder below it
+// (neither with a trailing backslash) return the output folder for the
+// source folder, creating the output folder the first time it is
+// requested. Returns false if the folder cannot be created.
+bool CFolderCache::Prepare
+(
+	LPCTSTR pcszRoot, LPCTSTR pcszSource, CString& csFolder
+)
 {
-	USES_CONVERSION;
+	CSingleLock lock( &m_Lock, TRUE );
+
+	// the output of a mirrored folder depends on the root of its tree
+	const CString csRoot( pcszRoot );
+	const CString csSource( pcszSource );
+	const bool bMirror = !m_csOutputRoot.IsEmpty();
+	const CString csKey = bMirror ? csRoot + _T( "|" ) + csSource : csSource;
+
+	CString* pFolder = m_mapFolders.find( csKey );
+	if ( pFolder != nullptr )
+	{
+		csFolder = *pFolder;
+		return true;
+	}
+
+	// the output folder mirrors the source folder below the output root
+	// or is the "Corrected" folder below the source folder. The root
+	// must end at a backslash of the source folder, so "C:\work" does
+	// not hold "C:\workshop".
+	const int nRoot = csRoot.GetLength();
+	const bool bInside =
+		0 == csSource.Left( nRoot ).CompareNoCase( csRoot ) &&
+		( csSource.GetLength() == nRoot || csSource[ nRoot ] == _T( '\\' ) );
+	if ( bMirror && bInside )
+	{
+		csFolder = m_csOutputRoot + csSource.Mid( nRoot );
 
+	} else if ( bMirror )
+	{
+		// a folder outside the root is mirrored by its full path below
+		// the output root, without the prefix of a long or UNC path and
+		// the colon of its drive, so the output never lands in the
+		// source tree
+		CString csFull( csSource );
+		csFull.TrimLeft( _T( "\\?" ) );
+		csFull.Remove( _T( ':' ) );
+		csFolder = m_csOutputRoot + _T( "\\" ) + csFull;
+
+	} else
+	{
+		csFolder = csSource + _T( "\\" ) + GetCorrectedFolder();
+	}
+
+	// the lock is held while the folder is created so only one writer
+	// ever creates a given folder
+	if ( !::PathFileExists( csFolder ) )
+	{
+		if ( !CreatePath( csFolder ) )
+		{
+			return false;
+		}
+	}
+
+	m_mapFolders.add( csKey, new CString( csFolder ) );
+	return true;
+} // CFolderCache::Prepare
+
+/////////////////////////////////////////////////////////////////////////////
+// Save the data inside pImage to the given filename which is located in
+// an output folder that has already been prepared, using the encoder
+// with the given class ID. The status of GDI+ is returned if asked for.
+bool Save
+(
+	LPCTSTR lpszPathName, Gdiplus::Image* pImage, CLSID clsid,
+	Status* pStatus = nullptr
+)
+{
 	// save and overwrite the selected image file with current page
 	int iValue =
 		EncoderValue::EncoderValueVersionGif89 |
@@ -203,371 +391,2321 @@ bool Save( LPCTSTR lpszPathName, Gdiplus::Image* pImage )
 	param.Parameter[ 0 ].Type = EncoderParameterValueTypeLong;
 	param.Parameter[ 0 ].NumberOfValues = 1;
 
-	// writing to the same file will fail, so save to a corrected folder
-	// below the image being corrected
-	const CString csCorrected = GetCorrectedFolder();
-	const CString csFolder = CHelper::GetFolder( lpszPathName ) + csCorrected;
-	if ( !::PathFileExists( csFolder ) )
+	// save the image to the corrected folder
+	Status status = pImage->Save( CWidePath( lpszPathName ), &clsid, &param );
+	if ( pStatus != nullptr )
 	{
-		if ( !CreatePath( csFolder ) )
-		{
-			return false;
-		}
+		*pStatus = status;
 	}
 
-	// filename plus extension
-	const CString csData = CHelper::GetDataName( lpszPathName );
-
-	// create a new path from the pieces
-	const CString csPath = csFolder + _T( "\\" ) + csData;
-
-	// use the extension member class to get the class ID of the file
-	CLSID clsid = m_Extension.ClassID;
-
-	// save the image to the corrected folder
-	Status status = pImage->Save( T2CW( csPath ), &clsid, &param );
-
 	// return true if the save worked
 	return status == Ok;
 } // Save
 
 /////////////////////////////////////////////////////////////////////////////
-// crawl through the directory tree looking for supported image extensions
-void RecursePath( LPCTSTR path )
+// write a block of text to the console without interleaving it with the
+// output of the other workers
+void WriteOutput( LPCTSTR pcszOutput )
 {
-	USES_CONVERSION;
-
-	// valid file extensions
-	const CString csValidExt = _T( ".jpg;.jpeg;.png;.gif;.bmp;.tif;.tiff" );
+	CSingleLock lock( &m_ConsoleLock, TRUE );
+	CStdioFile fout( stdout );
+	fout.WriteString( pcszOutput );
+} // WriteOutput
 
-	// the new folder under the image folder to contain the corrected images
-	const CString csCorrected = GetCorrectedFolder();
-	const int nCorrected = GetCorrectedFolderLength();
+/////////////////////////////////////////////////////////////////////////////
+// write the output of one image to the plan of a dry run when there is
+// one, and otherwise to the console
+void EmitFileOutput( LPCTSTR pcszOutput )
+{
+	if ( m_Plan.Opened )
+	{
+		CString csLine( pcszOutput );
+		csLine.TrimRight( _T( "\n" ) );
+		m_Plan.WriteLine( csLine );
 
-	// get the folder which will trim any wild card data
-	CString csPathname = CHelper::GetFolder( path );
+	} else
+	{
+		WriteOutput( pcszOutput );
+	}
+} // EmitFileOutput
 
-	// wild cards are in use if the pathname does not equal the given path
-	const bool bWildCards = csPathname != path;
-	csPathname.TrimRight( _T( "\\" ) );
-	CString csData;
+/////////////////////////////////////////////////////////////////////////////
+// write the output of the given image along with the output of its
+// earlier attempts. With ordered output it waits until the output of the
+// images found before it has been written.
+void WriteFileOutput( const FILE_TASK& task, const CString& csOutput )
+{
+	const CString csText = task.m_csEarlier + csOutput;
+	if ( m_bOrderedOutput )
+	{
+		m_Ordered.Write( task.m_llSequence, csText );
 
-	// build a string with wild-cards
-	CString strWildcard;
-	if ( bWildCards )
+	} else
 	{
-		csData = CHelper::GetDataName( path );
-		strWildcard.Format( _T( "%s\\%s" ), csPathname, csData );
+		EmitFileOutput( csText );
+	}
+} // WriteFileOutput
 
-	} else // no wild cards, just a folder
+/////////////////////////////////////////////////////////////////////////////
+// the key of a claimed file, which is its full path in lower case so it
+// compares the same however the job gave it. Returns false if the path
+// cannot be made full.
+bool GetClaimKey( LPCTSTR pcszPath, CString& csKey )
+{
+	TCHAR szPath[ _MAX_PATH ] = { 0 };
+	if ( _tfullpath( szPath, pcszPath, _MAX_PATH ) == nullptr )
 	{
-		strWildcard.Format( _T( "%s\\*.*" ), csPathname );
+		return false;
 	}
 
-	// start trolling for files we are interested in
-	CFileFind finder;
-	BOOL bWorking = finder.FindFile( strWildcard );
-	while ( bWorking )
+	csKey = CString( szPath ).MakeLower();
+	return true;
+} // GetClaimKey
+
+/////////////////////////////////////////////////////////////////////////////
+// when more than one job is run, the first job to find a file claims it
+// and this returns false for the jobs that find it later
+bool ClaimFile( LPCTSTR pcszPath )
+{
+	CString csKey;
+	if ( !m_bClaimFiles || !GetClaimKey( pcszPath, csKey ) )
 	{
-		bWorking = finder.FindNextFile();
+		return true;
+	}
 
-		// skip "." and ".." folder names
-		if ( finder.IsDots() )
-		{
-			continue;
-		}
+	CSingleLock lock( &m_ClaimLock, TRUE );
+	return m_setClaimed.insert( csKey ).second;
+} // ClaimFile
 
-		// if it's a directory, recursively search it
-		if ( finder.IsDirectory() )
-		{
-			// do not recurse into the corrected folder
-			const CString str =
-				finder.GetFilePath().TrimRight( _T( "\\" ) );
-			if ( str.Right( nCorrected ) == csCorrected )
-			{
-				continue;
-			}
+/////////////////////////////////////////////////////////////////////////////
+// release the claim of a file that is done when claims only last while
+// the file is in flight
+void ReleaseFile( LPCTSTR pcszPath )
+{
+	CString csKey;
+	if ( !m_bClaimFiles || !m_bReleaseClaims || !GetClaimKey( pcszPath, csKey ) )
+	{
+		return;
+	}
 
-			// if wild cards are in use, build a path with the wild cards
-			if ( bWildCards )
-			{
-				CString csPath;
-				csPath.Format( _T( "%s\\%s" ), str, csData );
+	CSingleLock lock( &m_ClaimLock, TRUE );
+	m_setClaimed.erase( csKey );
+} // ReleaseFile
 
-				// recurse into the new directory with wild cards
-				RecursePath( csPath );
+/////////////////////////////////////////////////////////////////////////////
+// count the result of an image for its job and record it in the result
+// log, if any
+void RecordResult
+(
+	CJob* pJob, bool bWritten, LPCTSTR pcszPath, LPCTSTR pcszDate
+)
+{
+	bWritten ? pJob->AddWritten() : pJob->AddFailed();
+	ReleaseFile( pcszPath );
+	const LPCTSTR pcszResult =
+		!bWritten ? _T( "failed" ) : m_bDryRun ? _T( "planned" ) : _T( "written" );
+	m_Log.Write( pcszResult, pcszPath, pcszDate );
 
-			} else // recurse into the new directory
-			{
-				RecursePath( str + _T( "\\" ) );
-			}
+} // RecordResult
 
-		} else // write the properties if it is a valid extension
+/////////////////////////////////////////////////////////////////////////////
+// a system error that may pass when the operation is tried again later,
+// such as a share that dropped its connection or a file that another
+// program has open
+bool IsTransientError( DWORD dwError )
+{
+	switch ( dwError )
+	{
+		case ERROR_SHARING_VIOLATION:
+		case ERROR_LOCK_VIOLATION:
+		case ERROR_NETNAME_DELETED:
+		case ERROR_BAD_NETPATH:
+		case ERROR_NETWORK_BUSY:
+		case ERROR_UNEXP_NET_ERR:
+		case ERROR_BAD_NET_RESP:
+		case ERROR_REQ_NOT_ACCEP:
+		case ERROR_NETWORK_UNREACHABLE:
+		case ERROR_HOST_UNREACHABLE:
+		case ERROR_CONNECTION_ABORTED:
+		case ERROR_CONNECTION_REFUSED:
+		case ERROR_VC_DISCONNECTED:
+		case ERROR_SEM_TIMEOUT:
+		case ERROR_TIMEOUT:
+		case ERROR_OPERATION_ABORTED:
+		case ERROR_DEV_NOT_EXIST:
+		case ERROR_NOT_READY:
+		case ERROR_IO_DEVICE:
+		case ERROR_NO_SYSTEM_RESOURCES:
+		case ERROR_NONPAGED_SYSTEM_RESOURCES:
+		case ERROR_WORKING_SET_QUOTA:
 		{
-			const CString csPath = finder.GetFilePath();
-			const CString csExt = CHelper::GetExtension( csPath ).MakeLower();
-			const CString csFile = CHelper::GetFileName( csPath );
+			return true;
+		}
+	}
 
-			if ( -1 != csValidExt.Find( csExt ) )
-			{
-				m_Extension.FileExtension = csExt;
-
-				CStdioFile fout( stdout );
-				fout.WriteString( csPath + _T( "\n" ) );
-
-				// get the file's Date Taken metadata first and returns 
-				// an empty string on failure. The m_Date member is 
-				// fully populated if successful
-				const CString csDateTaken = GetCurrentDateTaken( csPath );
-
-				// modify our date/time information with the modified time
-				// of this file. This is to keep the times unique and in the
-				// original sequence, but depending on the source of the image
-				// will probably not be the same as the date taken which
-				// is unknown if csDateTaken is empty.
-				if ( csDateTaken.IsEmpty() )
-				{
-					// the file's status contains the information we are 
-					// looking for which is the modification time.
-					CFileStatus fs;
-
-					// if successful, write the modification time to the
-					// member date class
-					if ( CFile::GetStatus( csPath, fs ) )
-					{
-						m_Date.Hour = fs.m_mtime.GetHour();
-						m_Date.Minute = fs.m_mtime.GetMinute();
-						m_Date.Second = fs.m_mtime.GetSecond();
-					}
-				}
+	return false;
+} // IsTransientError
 
-				// restore the command line date information
-				m_Date.Year = m_nYear;
-				m_Date.Month = m_nMonth;
-				m_Date.Day = m_nDay;
-				
+/////////////////////////////////////////////////////////////////////////////
+// the system error of the call that just failed. GDI+ does not always
+// leave one, so the given file is opened to find out whether it can be
+// read at all, and zero means the problem is with the image itself.
+DWORD GetFailureError( LPCTSTR pcszProbe )
+{
+	DWORD value = ::GetLastError();
+	if ( value != ERROR_SUCCESS || pcszProbe == nullptr )
+	{
+		return value;
+	}
 
-				// get the date and time from the member date class which
-				// should contain the date and time
-				COleDateTime oDT = m_Date.DateAndTime;
-				COleDateTime::DateTimeStatus eStatus = oDT.GetStatus();
+	HANDLE hFile = ::CreateFile
+	(
+		pcszProbe, GENERIC_READ,
+		FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL,
+		OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL
+	);
+	if ( hFile == INVALID_HANDLE_VALUE )
+	{
+		return ::GetLastError();
+	}
 
-				// error out if the date / time data is invalid
-				if ( eStatus != COleDateTime::valid )
-				{
-					fout.WriteString
-					(
-						_T( ".\n" )
-						_T( "Invalid date and time.\n" )
-						_T( ".\n" )
-					);
-					continue;
-				}
+	::CloseHandle( hFile );
+	return ERROR_SUCCESS;
+} // GetFailureError
 
-				// this formatted date will be written into the date
-				// properties of the new file in the "Corrected" folder
-				CString csDate = m_Date.Date;
-
-				// update the user about the date being used
-				CString csOutput;
-				csOutput.Format( _T( "New Date:\n\t%s\n.\n" ), csDate );
-				fout.WriteString( csOutput );
-
-				// smart pointer to the image representing this file
-				unique_ptr<Gdiplus::Image> pImage =
-					unique_ptr<Gdiplus::Image>
-					(
-						Gdiplus::Image::FromFile( T2CW( csPath ) )
-					);
-
-				// smart pointer to the original date property item
-				unique_ptr<Gdiplus::PropertyItem> pOriginalDateItem =
-					unique_ptr<Gdiplus::PropertyItem>( new Gdiplus::PropertyItem );
-				pOriginalDateItem->id = PropertyTagExifDTOrig;
-				pOriginalDateItem->type = PropertyTagTypeASCII;
-				pOriginalDateItem->length = csDate.GetLength() + 1;
-				pOriginalDateItem->value = csDate.GetBuffer( pOriginalDateItem->length );
-
-				// smart pointer to the digitized date property item
-				unique_ptr<Gdiplus::PropertyItem> pDigitizedDateItem =
-					unique_ptr<Gdiplus::PropertyItem>( new Gdiplus::PropertyItem );
-				pDigitizedDateItem->id = PropertyTagExifDTDigitized;
-				pDigitizedDateItem->type = PropertyTagTypeASCII;
-				pDigitizedDateItem->length = csDate.GetLength() + 1;
-				pDigitizedDateItem->value = csDate.GetBuffer( pDigitizedDateItem->length );
-
-				// if these properties exist they will be replaced
-				// if these properties do not exist they will be created
-				Gdiplus::Status eOriginal =
-					pImage->SetPropertyItem( pOriginalDateItem.get() );
-				Gdiplus::Status eDigitized =
-					pImage->SetPropertyItem( pDigitizedDateItem.get() );
-
-				// save the image to the new path
-				Save( csPath, pImage.get() );
-
-				// release the date buffer
-				csDate.ReleaseBuffer();
-			}
+/////////////////////////////////////////////////////////////////////////////
+// the system error of a GDI+ call that failed with the given status. Only
+// a Win32Error status leaves a system error behind, so any other status
+// is either a system error of its own or a problem with the image, which
+// is never tried again. The given file, if any, is opened to find out
+// whether the failure was really that it could not be read.
+DWORD GetGdiplusError( Status status, LPCTSTR pcszProbe )
+{
+	switch ( status )
+	{
+		case Win32Error:
+		{
+			return GetFailureError( pcszProbe );
+		}
+		case FileNotFound:
+		{
+			return ERROR_FILE_NOT_FOUND;
+		}
+		case AccessDenied:
+		{
+			return ERROR_ACCESS_DENIED;
 		}
 	}
 
-	finder.Close();
+	::SetLastError( ERROR_SUCCESS );
+	return pcszProbe == nullptr ? ERROR_SUCCESS : GetFailureError( pcszProbe );
+} // GetGdiplusError
 
-} // RecursePath
+/////////////////////////////////////////////////////////////////////////////
+// process one image on a worker thread
+void ProcessFile( const FILE_TASK& task );
 
 /////////////////////////////////////////////////////////////////////////////
-// set the current file extension which will automatically lookup the
-// related mime type and class ID and set their respective properties
-void CExtension::SetFileExtension( CString value )
+// give up on the given image for now. A failure that may pass is tried
+// again after a delay while the image has attempts left, and any other
+// failure is recorded for the failure report. The output of the image
+// already describes the failure.
+void FailFile
+(
+	const FILE_TASK& task, CString& csOutput, LPCTSTR pcszReason,
+	DWORD dwError, LPCTSTR pcszDate
+)
 {
-	m_csFileExtension = value;
-
-	if ( m_mapExtensions.Exists[ value ] )
+	const bool bTransient = IsTransientError( dwError );
+	const int nAttempts = task.m_nAttempt + 1;
+	CString csMessage;
+	if ( bTransient && nAttempts < m_Retry.MaxAttempts )
 	{
-		MimeType = *m_mapExtensions.find( value );
-
-		// populate the mime type map the first time it is referenced
-		if ( m_mapMimeTypes.Count == 0 )
+		csMessage.Format
+		(
+			_T( "Error %u, will retry (attempt %d of %d)\n.\n" ),
+			dwError, nAttempts + 1, m_Retry.MaxAttempts
+		);
+		csOutput += csMessage;
+
+		// the retry waits on the thread of the retry queue and then
+		// joins the other images in the pool. Ordered output keeps the
+		// output of this attempt until the image is done.
+		FILE_TASK retry( task );
+		retry.m_nAttempt = nAttempts;
+		if ( m_bOrderedOutput )
 		{
-			UINT num = 0;
-			UINT size = 0;
+			retry.m_csEarlier += csOutput;
 
-			// gets the number of available image encoders and 
-			// the total size of the array
-			Gdiplus::GetImageEncodersSize( &num, &size );
-			if ( size == 0 )
+		} else
+		{
+			WriteOutput( csOutput );
+		}
+		m_Retry.Add
+		(
+			[ retry ]()
 			{
-				return;
-			}
+				m_Pool.Submit( [ retry ]() { ProcessFile( retry ); } );
+			},
+			task.m_nAttempt
+		);
+		return;
+	}
 
-			// create a smart pointer to the image codex information
-			unique_ptr<ImageCodecInfo> pImageCodecInfo =
-				unique_ptr<ImageCodecInfo>
-				(
-					(ImageCodecInfo*)malloc( size )
-				);
-			if ( pImageCodecInfo == nullptr )
-			{
-				return;
-			}
+	FILE_FAILURE failure;
+	failure.m_csPath = task.m_csPath;
+	failure.m_csReason = pcszReason;
+	failure.m_dwError = dwError;
+	failure.m_nAttempts = nAttempts;
+	failure.m_bTransient = bTransient;
+	{
+		CSingleLock lock( &m_FailureLock, TRUE );
+		m_arrFailures.push_back( failure );
+	}
 
-			// Returns an array of ImageCodecInfo objects that contain 
-			// information about the image encoders built into GDI+.
-			Gdiplus::GetImageEncoders( num, size, pImageCodecInfo.get() );
+	WriteFileOutput( task, csOutput );
+	RecordResult( task.m_pJob, false, task.m_csPath, pcszDate );
 
-			// populate the map of mime types the first time it is 
-			// needed
-			for ( UINT nIndex = 0; nIndex < num; ++nIndex )
-			{
-				CString csKey;
-				csKey = CW2A( pImageCodecInfo.get()[ nIndex ].MimeType );
-				CLSID classID = pImageCodecInfo.get()[ nIndex ].Clsid;
-				m_mapMimeTypes.add( csKey, new CLSID( classID ) );
-			}
+} // FailFile
+
+/////////////////////////////////////////////////////////////////////////////
+// with the verify option, confirm the output of the given image carries
+// the new date in both of its EXIF date properties and, given an XMP date,
+// in the date properties of its XMP packet. When the image data was copied
+// rather than encoded again, its regions are read back from the finished
+// output and compared with the hash the payload check took of the input.
+// A wrong output is removed and the image has failed.
+bool VerifyFile
+(
+	const FILE_TASK& task, CString& csOutput, LPCTSTR pcszOutput,
+	const CString& csDate, LPCSTR pcszXmpDate, CPayloadCheck& check
+)
+{
+	if ( !m_bVerify )
+	{
+		return true;
+	}
+
+	CString csOriginal;
+	CString csDigitized;
+	CString csDateTime;
+	CString csReason;
+	if ( !CExifReader::GetDates( pcszOutput, csOriginal, csDigitized, csDateTime ) )
+	{
+		// only JPEG and TIFF dates are read without decoding the image
+		if ( !check.Checked )
+		{
+			InterlockedIncrement( &m_lUnverified );
+			return true;
 		}
+		csReason = _T( "Dates not readable" );
 
-		ClassID = *m_mapMimeTypes.find( MimeType );
+	} else if ( csOriginal != csDate || csDigitized != csDate )
+	{
+		csReason = _T( "Dates not written" );
 
-	} else
+	} else if ( pcszXmpDate != nullptr &&
+		CJpegPatcher::CheckXmpFile( pcszOutput, pcszXmpDate ) == CJpegPatcher::xrFailed )
+	{
+		csReason = _T( "XMP dates not written" );
+
+	} else if ( check.Checked && !check.ReadOutput( pcszOutput ) )
 	{
-		MimeType = _T( "" );
+		csReason = _T( "Image data not readable" );
+
+	} else if ( check.Checked && !check.Matches )
+	{
+		csReason = _T( "Image data changed" );
 	}
-} // CExtension::SetFileExtension
 
-/////////////////////////////////////////////////////////////////////////////
-// a console application that can crawl through the file
-// system and troll for image metadata properties
-int _tmain( int argc, TCHAR* argv[], TCHAR* envp[] )
-{
-	HMODULE hModule = ::GetModuleHandle( NULL );
-	if ( hModule == NULL )
+	if ( csReason.IsEmpty() )
 	{
-		_tprintf( _T( "Fatal Error: GetModuleHandle failed\n" ) );
-		return 1;
+		InterlockedIncrement( &m_lVerified );
+		return true;
 	}
 
-	// initialize MFC and error on failure
-	if ( !AfxWinInit( hModule, NULL, ::GetCommandLine(), 0 ) )
+	::DeleteFile( pcszOutput );
+
+	CString csMessage;
+	csMessage.Format
+	(
+		_T( "Verification failed, %s:\n\t%s\n.\n" ),
+		csReason.MakeLower(), pcszOutput
+	);
+	csOutput += csMessage;
+	FailFile( task, csOutput, _T( "Verification failed" ), ERROR_SUCCESS, csDate );
+	return false;
+
+} // VerifyFile
+
+/////////////////////////////////////////////////////////////////////////////
+// fail the given image when the dates of its XMP packet could not be
+// patched, since the output would carry XMP dates that contradict its new
+// EXIF dates. The output is removed.
+bool CheckXmpResult
+(
+	const FILE_TASK& task, CString& csOutput, LPCTSTR pcszOutput,
+	CJpegPatcher::XMP_RESULT eXmp, const CString& csDate
+)
+{
+	if ( eXmp != CJpegPatcher::xrFailed )
 	{
-		_tprintf( _T( "Fatal Error: MFC initialization failed\n " ) );
-		return 2;
+		return true;
 	}
 
-	// do some common command line argument corrections
-	vector<CString> arrArgs = CHelper::CorrectedCommandLine( argc, argv );
-	size_t nArgs = arrArgs.size();
+	::DeleteFile( pcszOutput );
 
-	CStdioFile fOut( stdout );
 	CString csMessage;
+	csMessage.Format
+	(
+		_T( "Unable to update the XMP dates:\n\t%s\n.\n" ), pcszOutput
+	);
+	csOutput += csMessage;
+	FailFile( task, csOutput, _T( "Unable to update the XMP dates" ), ERROR_SUCCESS, csDate );
+	return false;
 
-	// display the number of arguments if not 1 to help the user 
-	// understand what went wrong if there is an error in the
-	// command line syntax
-	if ( nArgs != 1 )
+} // CheckXmpResult
+
+/////////////////////////////////////////////////////////////////////////////
+// replace the date of the given date class, which holds the current Date
+// Taken of the given image if it has one, with the date of the job and set
+// its time by the time policy of the job. Returns the source of the time
+// which is "taken", "modified", "midnight" or "unknown".
+CString GetNewDate
+(
+	LPCTSTR pcszPath, CJob* pJob, const CString& csDateTaken, CDate& date
+)
+{
+	CString value = _T( "taken" );
+
+	// modify our date/time information with the modified time
+	// of this file. This is to keep the times unique and in the
+	// original sequence, but depending on the source of the image
+	// will probably not be the same as the date taken which
+	// is unknown if csDateTaken is empty. The job may also ask for
+	// the modified time or midnight regardless of the date taken.
+	const CJob::TIME_POLICY eTimePolicy = pJob->TimePolicy;
+	if ( eTimePolicy == CJob::tpMidnight )
 	{
-		fOut.WriteString( _T( ".\n" ) );
-		csMessage.Format( _T( "The number of parameters are %d\n.\n" ), nArgs - 1 );
-		fOut.WriteString( csMessage );
+		date.Hour = 0;
+		date.Minute = 0;
+		date.Second = 0;
+		value = _T( "midnight" );
 
-		// display the arguments
-		for ( int i = 1; i < nArgs; i++ )
+	} else if ( csDateTaken.IsEmpty() || eTimePolicy == CJob::tpModified )
+	{
+		// the file's status contains the information we are
+		// looking for which is the modification time.
+		CFileStatus fs;
+
+		// if successful, write the modification time to the
+		// date class
+		if ( CFile::GetStatus( pcszPath, fs ) )
 		{
-			csMessage.Format( _T( "Parameter %d is %s\n.\n" ), i, arrArgs[ i ] );
-			fOut.WriteString( csMessage );
+			date.Hour = fs.m_mtime.GetHour();
+			date.Minute = fs.m_mtime.GetMinute();
+			date.Second = fs.m_mtime.GetSecond();
+			value = _T( "modified" );
+
+		} else if ( csDateTaken.IsEmpty() )
+		{
+			value = _T( "unknown" );
 		}
 	}
 
-	// five arguments are expected 
-	if ( nArgs != 5 )
-	{
-		fOut.WriteString( _T( ".\n" ) );
-		fOut.WriteString
-		(
-			_T( "SetDateTaken, Copyright (c) 2020, " )
-			_T( "by W. T. Block.\n" )
-		);
+	// restore the date information of the job
+	date.Year = pJob->Year;
+	date.Month = pJob->Month;
+	date.Day = pJob->Day;
 
-		fOut.WriteString
-		(
-			_T( ".\n" )
-			_T( "A Windows command line program to set the image(s)\n" )
-			_T( "  Date Taken metadata given a base folder and a date\n" )
-			_T( "  and by default will also process sub-directories.\n" )
-			_T( ".\n" )
-			_T( "The time portion of the date comes from the Date\n" )
-			_T( "  Taken if available, otherwise the modification\n" )
-			_T( "  time is used. \n" )
-			_T( "Also a \"Corrected\" folder will be created with the\n" )
-			_T( "  same filenames, but these files will have their \n" )
-			_T( "  Date Taken metadata set. The original files\n" )
-			_T( "  will remain unmodified.\n" )
-			_T( ".\n" )
-		);
+	return value;
+} // GetNewDate
 
-		fOut.WriteString
+/////////////////////////////////////////////////////////////////////////////
+// return true if the two files hold the same bytes, which stops reading at
+// the first block that differs
+bool IsSameContent( LPCTSTR pcszFirst, LPCTSTR pcszSecond )
+{
+	CFile first;
+	CFile second;
+	if
+	(
+		!first.Open
 		(
-			_T( ".\n" )
-			_T( "Usage:\n" )
-			_T( ".\n" )
-			_T( ".  SetDateTaken pathname year month day\n" )
-			_T( ".\n" )
-			_T( "Where:\n" )
-			_T( ".\n" )
-		);
-
-		fOut.WriteString
+			pcszFirst, CFile::modeRead | CFile::shareDenyWrite | CFile::typeBinary
+		) ||
+		!second.Open
 		(
-			_T( ".  pathname is the root of the tree to be scanned, but\n" )
+			pcszSecond, CFile::modeRead | CFile::shareDenyWrite | CFile::typeBinary
+		)
+	)
+	{
+		return false;
+	}
+
+	bool value = first.GetLength() == second.GetLength();
+	try
+	{
+		CPooledBuffer bufferFirst( 64 * 1024 );
+		CPooledBuffer bufferSecond( 64 * 1024 );
+		value = value && bufferFirst.Data != nullptr && bufferSecond.Data != nullptr;
+		const UINT uiBlock = (UINT)min( bufferFirst.Size, bufferSecond.Size );
+		while ( value )
+		{
+			const UINT uiFirst = first.Read( bufferFirst.Data, uiBlock );
+			const UINT uiSecond = second.Read( bufferSecond.Data, uiBlock );
+			CIoThrottle::Read( uiFirst + uiSecond );
+			if ( uiFirst != uiSecond )
+			{
+				value = false;
+
+			} else if ( uiFirst == 0 )
+			{
+				break;
+
+			} else
+			{
+				value = 0 == memcmp( bufferFirst.Data, bufferSecond.Data, uiFirst );
+			}
+		}
+
+	} catch ( CFileException* pException )
+	{
+		pException->Delete();
+		value = false;
+	}
+
+	return value;
+} // IsSameContent
+
+/////////////////////////////////////////////////////////////////////////////
+// set the Date Taken of one image file which runs on a worker thread. The
+// console output for the file is collected and written as one block.
+void ProcessFile( const FILE_TASK& task )
+{
+	USES_CONVERSION;
+
+	CJob* pJob = task.m_pJob;
+	const CString csPath = task.m_csPath;
+	CString csOutput = csPath + _T( "\n" );
+	CString csMessage;
+
+	// this file's own copy of the mime type, where the class ID of the
+	// encoder is only looked up if GDI+ has to write the file
+	CString csMimeType;
+	m_Extension.FindMimeType( task.m_csExtension, csMimeType );
+
+	// this file's own date class
+	CDate date;
+
+	// the hash of the first block read for the dates, which is only
+	// asked for when identical content is written once
+	ULONGLONG ullHead = 0;
+
+	// get the file's Date Taken metadata first and returns
+	// an empty string on failure. The date class is
+	// fully populated if successful
+	const CString csDateTaken =
+		GetCurrentDateTaken( csPath, date, m_bDedupe ? &ullHead : nullptr );
+
+	// apply the time policy of the job and its date
+	GetNewDate( csPath, pJob, csDateTaken, date );
+
+	// get the date and time from the date class which
+	// should contain the date and time
+	COleDateTime oDT = date.DateAndTime;
+	COleDateTime::DateTimeStatus eStatus = oDT.GetStatus();
+
+	// error out if the date / time data is invalid
+	if ( eStatus != COleDateTime::valid )
+	{
+		csOutput +=
+			_T( ".\n" )
+			_T( "Invalid date and time.\n" )
+			_T( ".\n" );
+		FailFile( task, csOutput, _T( "Invalid date and time" ), 0, _T( "" ) );
+		return;
+	}
+
+	// this formatted date will be written into the date
+	// properties of the new file in the "Corrected" folder
+	CString csDate = date.Date;
+
+	// update the user about the date being used
+	csMessage.Format( _T( "New Date:\n\t%s\n.\n" ), csDate );
+	csOutput += csMessage;
+
+	bool bWritten = false;
+
+	// in sidecar mode the image is left alone and the date is
+	// recorded in an XMP file next to the image
+	if ( m_bSidecar )
+	{
+		// with an output root the sidecar goes into the
+		// mirrored tree
+		CString csSidecarFolder;
+		if
+		(
+			!m_csOutputRoot.IsEmpty() &&
+			!m_FolderCache.Prepare( pJob->Root, task.m_csFolder, csSidecarFolder )
+		)
+		{
+			const DWORD dwError = GetFailureError( nullptr );
+			csMessage.Format
+			(
+				_T( "Unable to create folder:\n\t%s\n.\n" ), csSidecarFolder
+			);
+			csOutput += csMessage;
+			FailFile( task, csOutput, _T( "Unable to create folder" ), dwError, csDate );
+			return;
+		}
+
+		bWritten = CXmpSidecar::Write( csPath, csDate, csSidecarFolder );
+		if ( !bWritten )
+		{
+			const DWORD dwError = GetFailureError( nullptr );
+			csMessage.Format
+			(
+				_T( "Sidecar not written:\n\t%s\n.\n" ),
+				CXmpSidecar::GetSidecarPath( csPath, csSidecarFolder )
+			);
+			csOutput += csMessage;
+			FailFile( task, csOutput, _T( "Sidecar not written" ), dwError, csDate );
+			return;
+		}
+
+		WriteFileOutput( task, csOutput );
+		RecordResult( pJob, bWritten, csPath, csDate );
+		return;
+	}
+
+	// writing to the same file will fail, so the copy goes to
+	// a corrected folder below the folder being corrected
+	// which is checked and created once per folder
+	CString csFolder;
+	if ( !m_FolderCache.Prepare( pJob->Root, task.m_csFolder, csFolder ) )
+	{
+		const DWORD dwError = GetFailureError( nullptr );
+		csMessage.Format
+		(
+			_T( "Unable to create folder:\n\t%s\n.\n" ), csFolder
+		);
+		csOutput += csMessage;
+		FailFile( task, csOutput, _T( "Unable to create folder" ), dwError, csDate );
+		return;
+	}
+
+	// the same filename relocated to the corrected folder
+	const CString csCorrectedPath =
+		csFolder + _T( "\\" ) + task.m_csDataName;
+
+	// identical content with the same new date is written once and
+	// the other copies link to (or copy) the first output. The key is
+	// the hash of the first block of the input, which was read for its
+	// dates, with its size and new date, so an input with a new key is
+	// only read by its writer. An input whose key was written before is
+	// compared in full with the first input before the output is reused,
+	// and one whose key is being written is put aside and queued again
+	// when the first writer finishes. The claim releases the waiting
+	// copies however this worker ends.
+	CContentClaim claim;
+	if ( m_bDedupe )
+	{
+		// other images are hashed over the size of the first block
+		ULONGLONG ullHash = ullHead;
+		ULONGLONG ullHashed = 0;
+		const ULONGLONG ullSize = GetFileLength( csPath );
+		if ( ullHash != 0 || CContentHash::HashFile( csPath, ullHash, ullHashed, 16 * 1024 ) )
+		{
+			CString csKey;
+			csKey.Format( _T( "%016I64x:%I64u:%s" ), ullHash, ullSize, csDate );
+
+			CString csFirstInput;
+			CString csFirst;
+			const CContentIndex::CLAIM_RESULT eClaim = m_ContentIndex.Claim
+			(
+				csKey, csPath, csFirstInput, csFirst,
+				[ task ]()
+				{
+					m_Pool.Requeue( [ task ]() { ProcessFile( task ); } );
+				}
+			);
+			if ( eClaim == CContentIndex::crQueued )
+			{
+				return;
+			}
+
+			if ( eClaim == CContentIndex::crFirst )
+			{
+				claim.Begin( &m_ContentIndex, csKey );
+
+			} else if
+			(
+				eClaim == CContentIndex::crDuplicate &&
+				IsSameContent( csFirstInput, csPath ) &&
+				(
+					::CreateHardLink( csCorrectedPath, csFirst, NULL ) ||
+					CopyFileThrottled( csFirst, csCorrectedPath, FALSE )
+				)
+			)
+			{
+				m_ContentIndex.AddSaved( ullSize );
+				csMessage.Format( _T( "Same content as:\n\t%s\n.\n" ), csFirst );
+				csOutput += csMessage;
+				WriteFileOutput( task, csOutput );
+				RecordResult( pJob, true, csPath, csDate );
+				return;
+			}
+		}
+	}
+
+	// the XMP form of the new date for any embedded XMP packet
+	char szXmpDate[ 20 ] = { 0 };
+	const bool bXmpDate = CXmpSidecar::ToXmpDate( csDate, szXmpDate );
+	const bool bJpeg = csMimeType == _T( "image/jpeg" );
+	const LPCSTR pcszXmpDate = bJpeg && bXmpDate ? szXmpDate : nullptr;
+
+	// the image data copied by the byte level writers is hashed as it is
+	// read when the output is verified
+	CPayloadCheck check;
+	CPayloadCheck* pCheck = m_bVerify ? &check : nullptr;
+
+	// a JPEG without a Date Taken usually has no EXIF data at
+	// all, so splice in the prebuilt EXIF template instead of
+	// having GDI+ decode and encode the whole image
+	CJpegPatcher::XMP_RESULT eXmp = CJpegPatcher::xrNone;
+	if ( bJpeg && csDateTaken.IsEmpty() &&
+		CJpegPatcher::WriteWithExifTemplate
+		(
+			csPath, csCorrectedPath, T2CA( csDate ),
+			bXmpDate ? szXmpDate : nullptr, pCheck, &eXmp
+		) )
+	{
+		if ( !CheckXmpResult( task, csOutput, csCorrectedPath, eXmp, csDate ) ||
+			!VerifyFile( task, csOutput, csCorrectedPath, csDate, pcszXmpDate, check ) )
+		{
+			return;
+		}
+
+		claim.Complete( csCorrectedPath );
+		WriteFileOutput( task, csOutput );
+		RecordResult( pJob, true, csPath, csDate );
+		return;
+	}
+
+	// GDI+ decodes the whole image, so an image too large for its
+	// share of the memory budget is streamed through with its dates
+	// overwritten in place when it already has them
+	const ULONGLONG ullLength = GetFileLength( csPath );
+	const ULONGLONG ullMemory = EstimateMemory( csMimeType, ullLength );
+	if ( IsLargeImage( ullMemory ) &&
+		CExifReader::WriteWithDates
+		(
+			csPath, csCorrectedPath, T2CA( csDate ), pCheck
+		) )
+	{
+		if ( bJpeg && bXmpDate )
+		{
+			eXmp = CJpegPatcher::PatchXmpFile( csCorrectedPath, szXmpDate );
+		}
+
+		if ( !CheckXmpResult( task, csOutput, csCorrectedPath, eXmp, csDate ) ||
+			!VerifyFile( task, csOutput, csCorrectedPath, csDate, pcszXmpDate, check ) )
+		{
+			return;
+		}
+
+		claim.Complete( csCorrectedPath );
+		WriteFileOutput( task, csOutput );
+		RecordResult( pJob, true, csPath, csDate );
+		return;
+	}
+
+	// an image that could not be streamed and would not fit the whole
+	// budget is not decoded at all, which keeps the peak memory within
+	// the budget whatever the sizes of the images
+	const ULONGLONG ullBudget = m_MemoryBudget.Budget;
+	if ( ullBudget != 0 && ullMemory > ullBudget )
+	{
+		csMessage.Format
+		(
+			_T( "Image too large to decode within the memory budget " )
+			_T( "(%I64u MB estimated, %I64u MB budget):\n\t%s\n.\n" ),
+			ullMemory / ( 1024 * 1024 ), ullBudget / ( 1024 * 1024 ), csPath
+		);
+		csOutput += csMessage;
+		FailFile
+		(
+			task, csOutput, _T( "Image too large for the memory budget" ),
+			ERROR_SUCCESS, csDate
+		);
+		return;
+	}
+
+	// otherwise the image waits until its memory fits the budget
+	CMemoryReservation reservation( m_MemoryBudget, ullMemory );
+
+	// GDI+ is started by the first file that needs it, and an image
+	// that needs it cannot be written without it
+	if ( !InitGdiplus() )
+	{
+		csOutput +=
+			_T( ".\n" )
+			_T( "Unable to start GDI+ to write the image.\n" )
+			_T( ".\n" );
+		FailFile( task, csOutput, _T( "Unable to start GDI+" ), 0, csDate );
+		return;
+	}
+	CLSID clsid;
+	m_Extension.Lookup( task.m_csExtension, csMimeType, clsid );
+
+	// GDI+ reads the whole image and writes about as much again
+	CIoThrottle::Read( ullLength );
+	CIoThrottle::Write( ullLength );
+
+	// smart pointer to the image representing this file
+	::SetLastError( ERROR_SUCCESS );
+	unique_ptr<Gdiplus::Image> pImage =
+		unique_ptr<Gdiplus::Image>
+		(
+			Gdiplus::Image::FromFile( CWidePath( csPath ) )
+		);
+	const Status eRead = pImage == nullptr ? OutOfMemory : pImage->GetLastStatus();
+	if ( eRead != Ok )
+	{
+		const DWORD dwError = GetGdiplusError( eRead, csPath );
+		csMessage.Format( _T( "Unable to read image:\n\t%s\n.\n" ), csPath );
+		csOutput += csMessage;
+		FailFile( task, csOutput, _T( "Unable to read image" ), dwError, csDate );
+		return;
+	}
+
+	// the original date property item which lives on the stack
+	// since GDI+ copies the value
+	Gdiplus::PropertyItem originalDateItem;
+	originalDateItem.id = PropertyTagExifDTOrig;
+	originalDateItem.type = PropertyTagTypeASCII;
+	originalDateItem.length = csDate.GetLength() + 1;
+	originalDateItem.value = csDate.GetBuffer( originalDateItem.length );
+
+	// the digitized date property item
+	Gdiplus::PropertyItem digitizedDateItem;
+	digitizedDateItem.id = PropertyTagExifDTDigitized;
+	digitizedDateItem.type = PropertyTagTypeASCII;
+	digitizedDateItem.length = csDate.GetLength() + 1;
+	digitizedDateItem.value = csDate.GetBuffer( digitizedDateItem.length );
+
+	// if these properties exist they will be replaced
+	// if these properties do not exist they will be created
+	Gdiplus::Status eOriginal =
+		pImage->SetPropertyItem( &originalDateItem );
+	Gdiplus::Status eDigitized =
+		pImage->SetPropertyItem( &digitizedDateItem );
+
+	// save the image to the new path
+	::SetLastError( ERROR_SUCCESS );
+	Status eSave = Ok;
+	bWritten = Save( csCorrectedPath, pImage.get(), clsid, &eSave );
+	const DWORD dwError = bWritten ? ERROR_SUCCESS : GetGdiplusError( eSave, nullptr );
+
+	// release the date buffer
+	csDate.ReleaseBuffer();
+
+	if ( !bWritten )
+	{
+		csMessage.Format
+		(
+			_T( "Unable to write image:\n\t%s\n.\n" ), csCorrectedPath
+		);
+		csOutput += csMessage;
+		FailFile( task, csOutput, _T( "Unable to write image" ), dwError, csDate );
+		return;
+	}
+
+	// GDI+ only knows about the EXIF dates, so bring the dates
+	// in the embedded XMP packet in line with them
+	if ( bWritten && bJpeg && bXmpDate )
+	{
+		eXmp = CJpegPatcher::PatchXmpFile( csCorrectedPath, szXmpDate );
+	}
+
+	// GDI+ encodes the image data again, so only the dates are verified
+	check.Reset();
+	if ( !CheckXmpResult( task, csOutput, csCorrectedPath, eXmp, csDate ) ||
+		!VerifyFile( task, csOutput, csCorrectedPath, csDate, pcszXmpDate, check ) )
+	{
+		return;
+	}
+
+	claim.Complete( csCorrectedPath );
+	WriteFileOutput( task, csOutput );
+	RecordResult( pJob, true, csPath, csDate );
+
+} // ProcessFile
+
+/////////////////////////////////////////////////////////////////////////////
+// report the planned change of one image during a dry run, which runs on a
+// worker thread. The current dates are read from the file header and the
+// new date follows the same rules as ProcessFile, but nothing is written.
+// Each image is one tab separated line with the pathname, the current Date
+// Taken (or "-"), the source of the time and the new date.
+void PlanFile( const FILE_TASK& task )
+{
+	CJob* pJob = task.m_pJob;
+	const CString csPath = task.m_csPath;
+
+	CDate date;
+	const CString csDateTaken = GetCurrentDateTaken( csPath, date );
+	const CString csSource = GetNewDate( csPath, pJob, csDateTaken, date );
+
+	COleDateTime oDT = date.DateAndTime;
+	const bool bValid = oDT.GetStatus() == COleDateTime::valid;
+	const CString csDate = bValid ? date.Date : CString( _T( "invalid" ) );
+
+	CString csLine;
+	csLine.Format
+	(
+		_T( "%s\t%s\t%s\t%s" ), csPath,
+		csDateTaken.IsEmpty() ? _T( "-" ) : (LPCTSTR)csDateTaken,
+		csSource, csDate
+	);
+
+	WriteFileOutput( task, csLine + _T( "\n" ) );
+
+	RecordResult( pJob, bValid, csPath, bValid ? csDate : CString() );
+
+} // PlanFile
+
+/////////////////////////////////////////////////////////////////////////////
+// collect the date properties of one image for the export, which runs on
+// a worker thread and only reads the file header
+void ExportFile( const FILE_TASK& task )
+{
+	CString csOriginal;
+	CString csDigitized;
+	CString csDateTime;
+	GetDateProperties( task.m_csPath, csOriginal, csDigitized, csDateTime );
+
+	m_Export.Add
+	(
+		task.m_csFolder, task.m_csDataName, csOriginal, csDigitized,
+		csDateTime
+	);
+	task.m_pJob->AddWritten();
+
+} // ExportFile
+
+/////////////////////////////////////////////////////////////////////////////
+// return the path relative to the given root folder (without a trailing
+// backslash), or the path itself if it is not below the root
+CString GetRelativePath( LPCTSTR pcszPath, const CString& csRoot )
+{
+	const CString csPath( pcszPath );
+	const int nRoot = csRoot.GetLength();
+	if
+	(
+		csPath.GetLength() > nRoot &&
+		csPath[ nRoot ] == _T( '\\' ) &&
+		0 == csPath.Left( nRoot ).CompareNoCase( csRoot )
+	)
+	{
+		return csPath.Mid( nRoot + 1 );
+	}
+
+	return csPath;
+} // GetRelativePath
+
+/////////////////////////////////////////////////////////////////////////////
+// a stable 64 bit FNV-1a hash of a relative path which ignores case and
+// the kind of slash, so every host computes the same shards
+ULONGLONG GetShardHash( const CString& csRelative )
+{
+	ULONGLONG value = 14695981039346656037ULL;
+	const int nLength = csRelative.GetLength();
+	for ( int nChar = 0; nChar < nLength; nChar++ )
+	{
+		TCHAR cChar = (TCHAR)_totlower( (_TUCHAR)csRelative[ nChar ] );
+		if ( cChar == _T( '\\' ) )
+		{
+			cChar = _T( '/' );
+		}
+
+		value ^= (BYTE)cChar;
+		value *= 1099511628211ULL;
+	}
+
+	return value;
+} // GetShardHash
+
+/////////////////////////////////////////////////////////////////////////////
+// return true if the given relative path belongs to this process's shard,
+// which is decided by the whole path or by its top level folder
+bool IsInShard( const CString& csRelative )
+{
+	if ( m_nShards <= 1 )
+	{
+		return true;
+	}
+
+	CString csKey = csRelative;
+	if ( m_bShardByFolder )
+	{
+		const int nSeparator = csRelative.FindOneOf( _T( "\\/" ) );
+		if ( nSeparator != -1 )
+		{
+			csKey = csRelative.Left( nSeparator );
+		}
+	}
+
+	const ULONGLONG ullShard = GetShardHash( csKey ) % (ULONGLONG)m_nShards;
+	return (int)ullShard == m_nShard - 1;
+} // IsInShard
+
+/////////////////////////////////////////////////////////////////////////////
+// return true if the given image is another name (a hard link or a link
+// through a symbolic link) of an image the crawl has already found. Every
+// image is recorded, even one with a single name, because a symbolic link
+// to it may be crawled after it, so the result does not depend on the
+// order of the crawl.
+bool IsDuplicateName( LPCTSTR pcszPath, CJob& job )
+{
+	FILE_ID id;
+	DWORD dwLinks = 0;
+	if ( !CFileIdMap<FILE_VISIT>::GetFileId( pcszPath, id, dwLinks ) )
+	{
+		return false;
+	}
+
+	FILE_VISIT visit = { pcszPath, &job };
+	FILE_VISIT first;
+	if ( m_mapFiles.Visit( id, visit, first ) )
+	{
+		return false;
+	}
+
+	CString csMessage;
+	csMessage.Format
+	(
+		_T( "%s\n.\nAnother name of:\n\t%s\n.\n" ), pcszPath, first.m_csPath
+	);
+	WriteOutput( csMessage );
+
+	if ( m_bLinkDuplicates )
+	{
+		DUPLICATE_NAME duplicate = { first, visit };
+		CSingleLock lock( &m_DuplicateLock, TRUE );
+		m_arrDuplicates.push_back( duplicate );
+	}
+
+	return true;
+} // IsDuplicateName
+
+/////////////////////////////////////////////////////////////////////////////
+// return the output pathname of the given image
+CString GetOutputPath( const FILE_VISIT& visit )
+{
+	const CPathParts parts( visit.m_csPath );
+
+	CString csOutput;
+	if ( !m_FolderCache.Prepare( visit.m_pJob->Root, parts.Parent.ToString(), csOutput ) )
+	{
+		return CString();
+	}
+
+	csOutput += _T( "\\" );
+	csOutput.Append( parts.DataName.Data, parts.DataName.Length );
+	return csOutput;
+} // GetOutputPath
+
+/////////////////////////////////////////////////////////////////////////////
+// once the images are written, hard link the output of each other name of
+// an image to the output of its first name, or copy it if the link fails
+// such as across volumes
+void LinkDuplicates()
+{
+	CString csMessage;
+	for ( const DUPLICATE_NAME& duplicate : m_arrDuplicates )
+	{
+		const CString csFirst = GetOutputPath( duplicate.m_First );
+		const CString csOther = GetOutputPath( duplicate.m_Duplicate );
+		if ( csFirst.IsEmpty() || csOther.IsEmpty() || !::PathFileExists( csFirst ) )
+		{
+			continue;
+		}
+
+		if ( ::PathFileExists( csOther ) )
+		{
+			continue;
+		}
+
+		if
+		(
+			!::CreateHardLink( csOther, csFirst, NULL ) &&
+			!CopyFileThrottled( csFirst, csOther, TRUE )
+		)
+		{
+			csMessage.Format( _T( "Unable to link:\n\t%s\n.\n" ), csOther );
+			WriteOutput( csMessage );
+		}
+	}
+
+	m_arrDuplicates.clear();
+} // LinkDuplicates
+
+/////////////////////////////////////////////////////////////////////////////
+// hand the given image file to the worker threads on behalf of the given
+// job if it has a supported extension. The folder is given without a
+// trailing backslash and the data name is the filename and extension.
+void QueueFile
+(
+	LPCTSTR pcszPath, LPCTSTR pcszFolder, LPCTSTR pcszDataName, CJob& job,
+	bool bCheckLinks = false
+)
+{
+	// valid file extensions
+	static const LPCTSTR ValidExtensions[] =
+	{
+		_T( ".jpg" ), _T( ".jpeg" ), _T( ".png" ), _T( ".gif" ),
+		_T( ".bmp" ), _T( ".tif" ), _T( ".tiff" )
+	};
+
+	// the extension is compared in place without copying the path
+	const CPathView extension = CPathParts( pcszPath ).Extension;
+	LPCTSTR pcszExt = nullptr;
+	for ( LPCTSTR pcszValid : ValidExtensions )
+	{
+		if ( extension.EqualsNoCase( pcszValid ) )
+		{
+			pcszExt = pcszValid;
+			break;
+		}
+	}
+	if ( pcszExt == nullptr )
+	{
+		return;
+	}
+
+	// the include and exclude patterns and the shard select by the
+	// relative path
+	const CString csRelative = GetRelativePath( pcszPath, job.Root );
+	if ( !m_Filter.IsSelectedFile( csRelative ) || !IsInShard( csRelative ) )
+	{
+		return;
+	}
+
+	// another name of an image already found is not processed again
+	if ( bCheckLinks && IsDuplicateName( pcszPath, job ) )
+	{
+		job.AddDuplicate();
+		return;
+	}
+
+	// a file found by an earlier job is left to that job
+	if ( !ClaimFile( pcszPath ) )
+	{
+		job.AddDuplicate();
+		return;
+	}
+
+	job.AddFile();
+
+	FILE_TASK task;
+	task.m_csPath = pcszPath;
+	task.m_csFolder = pcszFolder;
+	task.m_csDataName = pcszDataName;
+	task.m_csExtension = pcszExt;
+	task.m_pJob = &job;
+	task.m_llSequence = InterlockedIncrement64( &m_llSequence ) - 1;
+
+	// the pool blocks here when the workers fall behind
+	if ( m_bExport )
+	{
+		m_Pool.Submit( [ task ]() { ExportFile( task ); } );
+
+	} else if ( m_bDryRun )
+	{
+		m_Pool.Submit( [ task ]() { PlanFile( task ); } );
+
+	} else
+	{
+		m_Pool.Submit( [ task ]() { ProcessFile( task ); } );
+	}
+
+} // QueueFile
+
+/////////////////////////////////////////////////////////////////////////////
+// walk the directory tree looking for supported image extensions and hand
+// each image to the worker threads on behalf of the given job. The wild
+// cards, if any, select the files in every folder of the tree and the
+// folders excluded by the filter are never opened. The walk pulls one file
+// at a time, so it runs no further ahead than the workers allow, and a walk
+// stopped by Ctrl+C saves its position to the resume cursor, if any.
+void WalkPath( LPCTSTR path, CJob& job )
+{
+	// the folder without any wild card data, and the wild card data
+	// which is empty if the path is a folder
+	const CPathParts parts( path );
+	CString csPathname = parts.Parent;
+	if ( csPathname.IsEmpty() )
+	{
+		csPathname = _T( "." );
+	}
+	const CString csData = parts.DataName;
+
+	// a folder reached again through a junction or symbolic link is
+	// refused, which also stops a link loop
+	const auto Visit = [ & ]( LPCTSTR pcszFolder ) -> bool
+	{
+		if ( job.VisitFolder( CString( pcszFolder ) + _T( "\\" ) ) )
+		{
+			return true;
+		}
+
+		CString csMessage;
+		csMessage.Format
+		(
+			_T( "Folder already visited (link loop or duplicate link):\n\t%s\n.\n" ),
+			pcszFolder
+		);
+		WriteOutput( csMessage );
+		return false;
+	};
+
+	// do not descend into excluded folders such as the corrected folders
+	// or into the folders of another shard
+	const CTreeWalker::DESCEND Descend = [ & ]( LPCTSTR pcszFolder ) -> bool
+	{
+		const CString csRelative = GetRelativePath( pcszFolder, job.Root );
+		if ( m_Filter.IsPrunedFolder( csRelative ) )
+		{
+			return false;
+		}
+
+		if ( m_bShardByFolder && !IsInShard( csRelative ) )
+		{
+			return false;
+		}
+
+		return Visit( pcszFolder );
+	};
+
+	CTreeWalker walker;
+	const bool bResume = !m_csResumeFile.IsEmpty();
+	if
+	(
+		bResume &&
+		walker.Load( m_csResumeFile, csPathname, csData, Descend )
+	)
+	{
+		CString csMessage;
+		csMessage.Format( _T( "Resuming from:\n\t%s\n.\n" ), m_csResumeFile );
+		WriteOutput( csMessage );
+
+		// the root was listed before the walk was stopped, but a link
+		// back to it must still be refused
+		Visit( csPathname );
+
+	} else
+	{
+		if ( !Visit( csPathname ) )
+		{
+			return;
+		}
+		walker.Start( csPathname, csData, Descend );
+	}
+
+	WALK_ENTRY entry;
+	while ( !m_bStopRequested && walker.Next( entry ) )
+	{
+		m_lFoldersPending = walker.Pending;
+		QueueFile( entry.m_csPath, entry.m_csFolder, entry.m_csName, job, true );
+	}
+	m_lFoldersPending = 0;
+
+	if ( !bResume )
+	{
+		return;
+	}
+
+	// the cursor is kept only while the walk is unfinished
+	if ( m_bStopRequested )
+	{
+		CString csMessage;
+		if ( walker.Save( m_csResumeFile ) )
+		{
+			csMessage.Format
+			(
+				_T( "Stopped, resume with:\n\t--resume \"%s\"\n.\n" ),
+				m_csResumeFile
+			);
+
+		} else
+		{
+			csMessage.Format
+			(
+				_T( "Unable to save the resume cursor:\n\t%s\n.\n" ),
+				m_csResumeFile
+			);
+		}
+		WriteOutput( csMessage );
+
+	} else
+	{
+		::DeleteFile( m_csResumeFile );
+	}
+
+} // WalkPath
+
+/////////////////////////////////////////////////////////////////////////////
+// queue one pathname read from standard input, which is made fully
+// qualified so it can be mirrored below the output root
+void QueuePathName( CString csPath, CJob& job )
+{
+	csPath.Trim( _T( "\r\n\"" ) );
+	if ( csPath.IsEmpty() )
+	{
+		return;
+	}
+
+	TCHAR szPath[ _MAX_PATH ] = { 0 };
+	if ( _tfullpath( szPath, csPath, _MAX_PATH ) != nullptr )
+	{
+		csPath = szPath;
+	}
+
+	// there is no directory listing to prove the file exists
+	const DWORD dwAttributes = ::GetFileAttributes( csPath );
+	if
+	(
+		dwAttributes == INVALID_FILE_ATTRIBUTES ||
+		( dwAttributes & FILE_ATTRIBUTE_DIRECTORY ) != 0
+	)
+	{
+		CString csMessage;
+		csMessage.Format( _T( "File not found:\n\t%s\n.\n" ), csPath );
+		WriteOutput( csMessage );
+
+		// the file was never claimed, so another name of it that is in
+		// flight keeps its claim
+		job.AddFailed();
+		m_Log.Write( _T( "failed" ), csPath, _T( "" ) );
+		return;
+	}
+
+	const CPathParts parts( csPath );
+	QueueFile( csPath, parts.Parent.ToString(), parts.DataName.Data, job );
+
+} // QueuePathName
+
+/////////////////////////////////////////////////////////////////////////////
+// read the pathnames of the images from standard input, one per line or
+// separated by NUL characters, instead of crawling a folder. Each image is
+// queued as soon as its pathname arrives, so the work starts before the
+// list ends.
+void ReadPathList( CJob& job, bool bNullDelimited )
+{
+	// binary mode keeps the NUL characters intact
+	const int nStdin = _fileno( stdin );
+	_setmode( nStdin, _O_BINARY );
+
+	const char cDelimiter = bNullDelimited ? '\0' : '\n';
+	vector<char> buffer( 64 * 1024 );
+	CString csPath;
+
+	// _read returns whatever the pipe holds instead of waiting for a
+	// full buffer
+	int nRead = 0;
+	while ( ( nRead = _read( nStdin, buffer.data(), (UINT)buffer.size() ) ) > 0 )
+	{
+		const char* pStart = buffer.data();
+		const char* pEnd = pStart + nRead;
+		while ( pStart < pEnd )
+		{
+			const char* pFound =
+				(const char*)memchr( pStart, cDelimiter, pEnd - pStart );
+			if ( pFound == nullptr )
+			{
+				// the rest of the pathname is in the next block
+				csPath.Append( pStart, (int)( pEnd - pStart ) );
+				break;
+			}
+
+			csPath.Append( pStart, (int)( pFound - pStart ) );
+			QueuePathName( csPath, job );
+			csPath.Empty();
+			pStart = pFound + 1;
+		}
+	}
+
+	// the last pathname may not be terminated
+	QueuePathName( csPath, job );
+
+} // ReadPathList
+
+/////////////////////////////////////////////////////////////////////////////
+// stop the walk or the watch when the user presses Ctrl+C so the queued
+// images are finished before the program ends
+BOOL WINAPI OnConsoleControl( DWORD dwCtrlType )
+{
+	if ( dwCtrlType == CTRL_C_EVENT || dwCtrlType == CTRL_BREAK_EVENT )
+	{
+		m_bStopRequested = true;
+		m_Watcher.Stop();
+		return TRUE;
+	}
+
+	return FALSE;
+} // OnConsoleControl
+
+/////////////////////////////////////////////////////////////////////////////
+// crawl the tree of the given job and then keep dating the images that are
+// created or changed in the tree until the user presses Ctrl+C. Returns
+// false if the folder cannot be watched.
+bool WatchPath( CJob& job )
+{
+	const CString csPath = job.Path;
+
+	// the folder to watch and the wild card data, if any
+	const CPathParts parts( csPath );
+	CString csFolder = parts.Parent;
+	const CString csData = parts.DataName;
+	const bool bWildCards = !csData.IsEmpty();
+	if ( csFolder.IsEmpty() )
+	{
+		csFolder = _T( "." );
+	}
+
+	// the changes are collected during the initial crawl so no image
+	// that lands in the meantime is missed
+	if ( !m_Watcher.Open( csFolder ) )
+	{
+		return false;
+	}
+
+	// Ctrl+C during the initial crawl stops the crawl and the watch
+	::SetConsoleCtrlHandler( OnConsoleControl, TRUE );
+
+	WalkPath( csPath, job );
+
+	if ( !m_bStopRequested )
+	{
+		WriteOutput( _T( "Watching for new images (Ctrl+C to stop)\n.\n" ) );
+	}
+
+	// a quarter second without changes ends a burst of writes which
+	// keeps the time from arrival to output under a second
+	const DWORD dwDebounce = 250;
+
+	m_Watcher.Run
+	(
+		dwDebounce,
+		[ & ]( LPCTSTR pcszReady )
+		{
+			const CString csReady( pcszReady );
+
+			// a folder moved or copied into the tree does not report its
+			// files, so its entries wait to be quiet with the pending
+			// files, where a file that reports itself as well is only
+			// kept once. The excluded folders such as the corrected
+			// folders and a folder already crawled are ignored.
+			const DWORD dwAttributes = ::GetFileAttributes( csReady );
+			if
+			(
+				dwAttributes != INVALID_FILE_ATTRIBUTES &&
+				( dwAttributes & FILE_ATTRIBUTE_DIRECTORY ) != 0
+			)
+			{
+				if
+				(
+					!m_Filter.IsPrunedFolder( GetRelativePath( csReady, job.Root ) ) &&
+					job.VisitFolder( csReady + _T( "\\" ) )
+				)
+				{
+					m_Watcher.AddFolder( csReady );
+				}
+				return;
+			}
+
+			// the data name ends the pathname so it needs no copy
+			const CPathParts ready( csReady );
+			const LPCTSTR pcszDataName = ready.DataName.Data;
+			if ( bWildCards && !::PathMatchSpec( pcszDataName, csData ) )
+			{
+				return;
+			}
+
+			QueueFile( csReady, ready.Parent.ToString(), pcszDataName, job );
+		},
+		[ & ]()
+		{
+			// the changes were lost, so crawl the whole tree again
+			job.ClearFolders();
+			m_mapFiles.Clear();
+			WalkPath( csPath, job );
+		}
+	);
+
+	::SetConsoleCtrlHandler( OnConsoleControl, FALSE );
+	m_Watcher.Close();
+	return true;
+
+} // WatchPath
+
+/////////////////////////////////////////////////////////////////////////////
+// populate the mime type map from the GDI+ encoders the first time it is
+// referenced (the caller holds the lock)
+void CExtension::LoadMimeTypes()
+{
+	if ( m_mapMimeTypes.Count != 0 )
+	{
+		return;
+	}
+
+	// the encoders are only known once GDI+ is running
+	if ( !InitGdiplus() )
+	{
+		return;
+	}
+
+	UINT num = 0;
+	UINT size = 0;
+
+	// gets the number of available image encoders and
+	// the total size of the array
+	Gdiplus::GetImageEncodersSize( &num, &size );
+	if ( size == 0 )
+	{
+		return;
+	}
+
+	// create a smart pointer to the image codex information
+	unique_ptr<ImageCodecInfo> pImageCodecInfo =
+		unique_ptr<ImageCodecInfo>
+		(
+			(ImageCodecInfo*)malloc( size )
+		);
+	if ( pImageCodecInfo == nullptr )
+	{
+		return;
+	}
+
+	// Returns an array of ImageCodecInfo objects that contain
+	// information about the image encoders built into GDI+.
+	Gdiplus::GetImageEncoders( num, size, pImageCodecInfo.get() );
+
+	// populate the map of mime types the first time it is
+	// needed
+	for ( UINT nIndex = 0; nIndex < num; ++nIndex )
+	{
+		CString csKey;
+		csKey = CW2A( pImageCodecInfo.get()[ nIndex ].MimeType );
+		CLSID classID = pImageCodecInfo.get()[ nIndex ].Clsid;
+		m_mapMimeTypes.add( csKey, new CLSID( classID ) );
+	}
+} // CExtension::LoadMimeTypes
+
+/////////////////////////////////////////////////////////////////////////////
+// look up the mime type and class ID of the given file extension without
+// changing the current properties which makes it safe to call from
+// concurrent workers. Returns false if the extension is not supported.
+bool CExtension::Lookup
+(
+	LPCTSTR pcszExtension, CString& csMimeType, CLSID& clsid
+)
+{
+	CSingleLock lock( &m_Lock, TRUE );
+
+	csMimeType.Empty();
+	clsid = CLSID_NULL;
+
+	const CString csExtension( pcszExtension );
+	CString* pMimeType = m_mapExtensions.find( csExtension );
+	if ( pMimeType == nullptr )
+	{
+		return false;
+	}
+
+	csMimeType = *pMimeType;
+
+	LoadMimeTypes();
+	CLSID* pClassID = m_mapMimeTypes.find( csMimeType );
+	if ( pClassID == nullptr )
+	{
+		return false;
+	}
+
+	clsid = *pClassID;
+	return true;
+} // CExtension::Lookup
+
+/////////////////////////////////////////////////////////////////////////////
+// look up the mime type of the given file extension without starting GDI+
+// for the class IDs. Returns false if the extension is not supported.
+bool CExtension::FindMimeType( LPCTSTR pcszExtension, CString& csMimeType )
+{
+	CSingleLock lock( &m_Lock, TRUE );
+
+	csMimeType.Empty();
+
+	const CString csExtension( pcszExtension );
+	CString* pMimeType = m_mapExtensions.find( csExtension );
+	if ( pMimeType == nullptr )
+	{
+		return false;
+	}
+
+	csMimeType = *pMimeType;
+	return true;
+} // CExtension::FindMimeType
+
+/////////////////////////////////////////////////////////////////////////////
+// set the current file extension which will automatically lookup the
+// related mime type and class ID and set their respective properties
+void CExtension::SetFileExtension( CString value )
+{
+	m_csFileExtension = value;
+
+	CString csMimeType;
+	CLSID clsid;
+	Lookup( value, csMimeType, clsid );
+	MimeType = csMimeType;
+	ClassID = clsid;
+
+} // CExtension::SetFileExtension
+
+/////////////////////////////////////////////////////////////////////////////
+// the number of processors this process may use, which is the number in
+// its affinity mask limited by a hard CPU rate cap of its job object
+int GetAvailableProcessors()
+{
+	int value = max( (int)thread::hardware_concurrency(), 1 );
+
+	DWORD_PTR dwProcess = 0;
+	DWORD_PTR dwSystem = 0;
+	if ( ::GetProcessAffinityMask( ::GetCurrentProcess(), &dwProcess, &dwSystem ) )
+	{
+		int nAffinity = 0;
+		for ( ; dwProcess != 0; dwProcess &= dwProcess - 1 )
+		{
+			nAffinity++;
+		}
+		value = max( min( value, nAffinity ), 1 );
+	}
+
+	// the rate of a job is in hundredths of a percent of all of the
+	// processors of the system
+	JOBOBJECT_CPU_RATE_CONTROL_INFORMATION rate = { 0 };
+	if ( ::QueryInformationJobObject
+	(
+		NULL, JobObjectCpuRateControlInformation, &rate, sizeof( rate ), NULL
+	) && ( rate.ControlFlags & JOB_OBJECT_CPU_RATE_CONTROL_ENABLE ) )
+	{
+		DWORD dwRate = 0;
+		if ( rate.ControlFlags & JOB_OBJECT_CPU_RATE_CONTROL_HARD_CAP )
+		{
+			dwRate = rate.CpuRate;
+
+		} else if ( rate.ControlFlags & JOB_OBJECT_CPU_RATE_CONTROL_MIN_MAX_RATE )
+		{
+			dwRate = rate.MaxRate;
+		}
+
+		if ( dwRate != 0 )
+		{
+			const int nSystem = max( (int)thread::hardware_concurrency(), 1 );
+			const int nRate = (int)( ( (ULONGLONG)nSystem * dwRate + 9999 ) / 10000 );
+			value = max( min( value, nRate ), 1 );
+		}
+	}
+
+	return value;
+} // GetAvailableProcessors
+
+/////////////////////////////////////////////////////////////////////////////
+// remove the optional switches (arguments starting with "--") from the
+// command line and record their settings. The remaining arguments are
+// moved down so the positional arguments keep their original order.
+// Returns false if an unknown switch is found.
+bool ParseOptions( int& argc, TCHAR* argv[] )
+{
+	CStdioFile fOut( stdout );
+	CString csMessage;
+	int nArg = 1;
+
+	for ( int arg = 1; arg < argc; arg++ )
+	{
+		const CString csArg( argv[ arg ] );
+
+		// the NUL delimiter uses the short form known from find -print0
+		// and xargs -0
+		if ( csArg == _T( "-0" ) )
+		{
+			m_bNullDelimited = true;
+			continue;
+		}
+
+		if ( csArg.Left( 2 ) != _T( "--" ) )
+		{
+			argv[ nArg++ ] = argv[ arg ];
+			continue;
+		}
+
+		const CString csOption = csArg.Mid( 2 ).MakeLower();
+		if ( csOption == _T( "sidecar" ) )
+		{
+			m_bSidecar = true;
+
+		} else if ( csOption == _T( "output-root" ) && arg + 1 < argc )
+		{
+			m_csOutputRoot = argv[ ++arg ];
+			m_csOutputRoot.TrimRight( _T( "\"\\" ) );
+
+		} else if ( csOption == _T( "jobs" ) && arg + 1 < argc )
+		{
+			const CString csJobs( argv[ ++arg ] );
+			m_bAdaptiveJobs = csJobs.CompareNoCase( _T( "auto" ) ) == 0;
+			m_nThreads = m_bAdaptiveJobs ? 0 : _tstol( csJobs );
+
+		} else if ( csOption == _T( "jobs-file" ) && arg + 1 < argc )
+		{
+			m_csJobsFile = argv[ ++arg ];
+
+		} else if ( csOption == _T( "from-stdin" ) )
+		{
+			m_bFromStdin = true;
+
+		} else if ( csOption == _T( "watch" ) )
+		{
+			m_bWatch = true;
+
+		} else if ( csOption == _T( "include" ) && arg + 1 < argc )
+		{
+			m_Filter.AddInclude( argv[ ++arg ] );
+
+		} else if ( csOption == _T( "exclude" ) && arg + 1 < argc )
+		{
+			m_Filter.AddExclude( argv[ ++arg ] );
+
+		} else if ( csOption == _T( "shard" ) && arg + 1 < argc )
+		{
+			const CString csShard( argv[ ++arg ] );
+			const int nFields =
+				_stscanf_s( csShard, _T( "%d/%d" ), &m_nShard, &m_nShards );
+			if ( nFields != 2 || m_nShards < 1 || m_nShard < 1 || m_nShard > m_nShards )
+			{
+				csMessage.Format( _T( "Invalid shard: %s\n" ), csShard );
+				fOut.WriteString( _T( ".\n" ) );
+				fOut.WriteString( csMessage );
+				return false;
+			}
+
+		} else if ( csOption == _T( "shard-by" ) && arg + 1 < argc )
+		{
+			const CString csShardBy = CString( argv[ ++arg ] ).MakeLower();
+			if ( csShardBy != _T( "path" ) && csShardBy != _T( "folder" ) )
+			{
+				csMessage.Format( _T( "Invalid shard-by: %s\n" ), csShardBy );
+				fOut.WriteString( _T( ".\n" ) );
+				fOut.WriteString( csMessage );
+				return false;
+			}
+			m_bShardByFolder = csShardBy == _T( "folder" );
+
+		} else if ( csOption == _T( "link-duplicates" ) )
+		{
+			m_bLinkDuplicates = true;
+
+		} else if ( csOption == _T( "dedupe" ) )
+		{
+			m_bDedupe = true;
+
+		} else if ( csOption == _T( "dedupe-memory" ) && arg + 1 < argc )
+		{
+			m_bDedupe = true;
+			m_ContentIndex.MaxBytes =
+				(size_t)max( _tstol( argv[ ++arg ] ), 1L ) * 1024 * 1024;
+
+		} else if ( csOption == _T( "resume" ) && arg + 1 < argc )
+		{
+			m_csResumeFile = argv[ ++arg ];
+
+		} else if ( csOption == _T( "dry-run" ) )
+		{
+			m_bDryRun = true;
+
+		} else if ( csOption == _T( "plan" ) && arg + 1 < argc )
+		{
+			m_bDryRun = true;
+			m_csPlanFile = argv[ ++arg ];
+
+		} else if ( csOption == _T( "export" ) && arg + 1 < argc )
+		{
+			m_bExport = true;
+			m_csExportFile = argv[ ++arg ];
+
+		} else if ( csOption == _T( "export-format" ) && arg + 1 < argc )
+		{
+			const CString csFormat = CString( argv[ ++arg ] ).MakeLower();
+			if ( csFormat != _T( "columnar" ) && csFormat != _T( "csv" ) )
+			{
+				csMessage.Format( _T( "Invalid export format: %s\n" ), csFormat );
+				fOut.WriteString( _T( ".\n" ) );
+				fOut.WriteString( csMessage );
+				return false;
+			}
+			m_eExportFormat = csFormat == _T( "csv" ) ?
+				CMetadataExport::efCsv : CMetadataExport::efColumnar;
+
+		} else if ( csOption == _T( "large-pages" ) )
+		{
+			m_bLargePages = true;
+
+		} else if ( csOption == _T( "stats" ) )
+		{
+			m_bStats = true;
+
+		} else if ( csOption == _T( "ordered-output" ) )
+		{
+			m_bOrderedOutput = true;
+
+		} else if ( csOption == _T( "order-window" ) && arg + 1 < argc )
+		{
+			m_bOrderedOutput = true;
+			m_Ordered.Window = (size_t)max( _tstol( argv[ ++arg ] ), 1L );
+
+		} else if ( csOption == _T( "progress" ) )
+		{
+			m_bProgress = true;
+
+		} else if ( csOption == _T( "status-file" ) && arg + 1 < argc )
+		{
+			m_csStatusFile = argv[ ++arg ];
+
+		} else if ( csOption == _T( "verify" ) )
+		{
+			m_bVerify = true;
+#ifdef _DEBUG
+		} else if ( csOption == _T( "self-test" ) )
+		{
+			m_bSelfTest = true;
+#endif
+
+		} else if ( csOption == _T( "retries" ) && arg + 1 < argc )
+		{
+			m_Retry.MaxAttempts = _tstol( argv[ ++arg ] ) + 1;
+
+		} else if ( csOption == _T( "failure-report" ) && arg + 1 < argc )
+		{
+			m_csFailureFile = argv[ ++arg ];
+
+		} else if ( csOption == _T( "max-memory" ) && arg + 1 < argc )
+		{
+			m_MemoryBudget.Budget =
+				(ULONGLONG)max( _tstol( argv[ ++arg ] ), 0L ) * 1024 * 1024;
+
+		} else if ( csOption == _T( "max-read-mbps" ) && arg + 1 < argc )
+		{
+			m_dMaxReadMbps = max( _tstof( argv[ ++arg ] ), 0.0 );
+
+		} else if ( csOption == _T( "max-write-mbps" ) && arg + 1 < argc )
+		{
+			m_dMaxWriteMbps = max( _tstof( argv[ ++arg ] ), 0.0 );
+
+		} else if ( csOption == _T( "max-iops" ) && arg + 1 < argc )
+		{
+			m_dMaxIops = max( _tstof( argv[ ++arg ] ), 0.0 );
+
+		} else if ( csOption == _T( "throttle-file" ) && arg + 1 < argc )
+		{
+			m_csThrottleFile = argv[ ++arg ];
+
+		} else if ( csOption == _T( "log" ) && arg + 1 < argc )
+		{
+			m_csLogFile = argv[ ++arg ];
+
+		} else if ( csOption == _T( "merge-logs" ) && arg + 1 < argc )
+		{
+			m_csMergeFile = argv[ ++arg ];
+
+		} else
+		{
+			csMessage.Format( _T( "Unknown option: %s\n" ), csArg );
+			fOut.WriteString( _T( ".\n" ) );
+			fOut.WriteString( csMessage );
+			return false;
+		}
+	}
+
+	argc = nArg;
+	return true;
+} // ParseOptions
+
+/////////////////////////////////////////////////////////////////////////////
+// validate a job and resolve its root folder. Returns zero if the job can
+// be run, otherwise the program's error code with a message.
+int PrepareJob( CJob& job, CString& csError )
+{
+	// retrieve the pathname which may include wild cards
+	CString csPath = job.Path;
+
+	// trim off any wild card data
+	const CString csFolder = CHelper::GetFolder( csPath );
+
+	// test for current folder character (a period)
+	bool bExists = csPath == _T( "." );
+
+	// if it is a period, add a wild card of *.* to retrieve
+	// all folders and files
+	if ( bExists )
+	{
+		csPath = _T( ".\\*.*" );
+
+		// if it is not a period, test to see if the folder exists
+	} else
+	{
+		if ( ::PathFileExists( csFolder ) )
+		{
+			bExists = true;
+		}
+	}
+
+	if ( !bExists )
+	{
+		csError.Format( _T( "Invalid pathname:\n\t%s\n" ), csPath );
+		return 4;
+	}
+
+	// If all of the date information is present, the Okay status
+	// of the date class will be set to true.
+	CDate date;
+	date.Year = job.Year;
+	date.Month = job.Month;
+	date.Day = job.Day;
+	if ( !m_bExport && date.Okay == false )
+	{
+		csError.Format
+		(
+			_T( "Invalid date parameter(s) Year:" )
+			_T( " %d, Month: %d, Day: %d\n" ),
+			job.Year, job.Month, job.Day
+		);
+		return 5;
+	}
+
+	// the root of the tree without a trailing backslash
+	CString csRoot = csFolder;
+	csRoot.TrimRight( _T( "\\" ) );
+	if ( csRoot.IsEmpty() )
+	{
+		csRoot = _T( "." );
+	}
+
+	// the pathnames from standard input are fully qualified, so the
+	// root they are mirrored from must be as well
+	if ( m_bFromStdin )
+	{
+		TCHAR szRoot[ _MAX_PATH ] = { 0 };
+		_tfullpath( szRoot, csRoot, _MAX_PATH );
+		csRoot = szRoot;
+		csRoot.TrimRight( _T( "\\" ) );
+	}
+
+	// compare the full paths to keep the output root outside of the
+	// tree being scanned which would otherwise be scanned as well,
+	// which does not apply when no tree is scanned
+	if ( !m_csOutputRoot.IsEmpty() && !m_bFromStdin )
+	{
+		TCHAR szSource[ _MAX_PATH ] = { 0 };
+		_tfullpath
+		(
+			szSource, csFolder.IsEmpty() ? csRoot : csFolder, _MAX_PATH
+		);
+		CString csSource( szSource );
+		csSource.TrimRight( _T( "\\" ) );
+		csSource += _T( "\\" );
+		const CString csOutput = m_csOutputRoot + _T( "\\" );
+
+		if ( 0 == csOutput.Left( csSource.GetLength() ).CompareNoCase( csSource ) )
+		{
+			csError.Format
+			(
+				_T( "The output root must not be inside the scanned tree:\n\t%s\n" ),
+				m_csOutputRoot
+			);
+			return 4;
+		}
+	}
+
+	job.Path = csPath;
+	job.Root = csRoot;
+	job.Valid = true;
+	return 0;
+} // PrepareJob
+
+/////////////////////////////////////////////////////////////////////////////
+// read the jobs file where each line holds a path and a date with an
+// optional time policy, either as comma separated values or as a JSON
+// object. Blank lines, lines starting with # and a header line whose
+// first field is "path" are ignored. Returns false if the file cannot be read.
+bool LoadJobs( LPCTSTR pcszFile, vector<unique_ptr<CJob>>& jobs )
+{
+	CStdioFile fOut( stdout );
+	CStdioFile fJobs;
+	if ( !fJobs.Open( pcszFile, CFile::modeRead | CFile::shareDenyWrite ) )
+	{
+		return false;
+	}
+
+	CString csLine;
+	CString csMessage;
+	int nLine = 0;
+	while ( fJobs.ReadString( csLine ) )
+	{
+		nLine++;
+		csLine.Trim();
+		if ( csLine.IsEmpty() || csLine.Left( 1 ) == _T( "#" ) )
+		{
+			continue;
+		}
+
+		if ( CJob::IsHeader( csLine ) )
+		{
+			continue;
+		}
+
+		unique_ptr<CJob> pJob = unique_ptr<CJob>( new CJob );
+		CString csError;
+		if ( !pJob->Parse( csLine, csError ) )
+		{
+			csMessage.Format
+			(
+				_T( "Jobs file line %d skipped: %s\n" ), nLine, csError
+			);
+			fOut.WriteString( csMessage );
+			continue;
+		}
+
+		jobs.push_back( move( pJob ) );
+	}
+
+	fJobs.Close();
+	return true;
+} // LoadJobs
+
+/////////////////////////////////////////////////////////////////////////////
+// report the results of each job once all of them have finished
+void ReportJobs( vector<unique_ptr<CJob>>& jobs )
+{
+	CStdioFile fOut( stdout );
+	CString csMessage;
+
+	fOut.WriteString( _T( ".\n" ) );
+	fOut.WriteString( _T( "Job results:\n" ) );
+	fOut.WriteString( _T( ".\n" ) );
+
+	int nJob = 0;
+	for ( unique_ptr<CJob>& pJob : jobs )
+	{
+		nJob++;
+		csMessage.Format
+		(
+			_T( "Job %d: %s %s\n" ), nJob, pJob->Path, pJob->GetDateText()
+		);
+		fOut.WriteString( csMessage );
+
+		if ( !pJob->Valid )
+		{
+			fOut.WriteString( _T( "\tnot run\n" ) );
+			continue;
+		}
+
+		csMessage.Format
+		(
+			_T( "\tfiles: %d, %s: %d, failed: %d, duplicates: %d\n" ),
+			pJob->Files, m_bDryRun ? _T( "planned" ) : _T( "written" ),
+			pJob->Written, pJob->Failed, pJob->Duplicates
+		);
+		fOut.WriteString( csMessage );
+	}
+
+	fOut.WriteString( _T( ".\n" ) );
+} // ReportJobs
+
+/////////////////////////////////////////////////////////////////////////////
+// report the images that could not be written on the console and, when a
+// failure report is given, as tab separated lines of the pathname, the
+// system error, the number of attempts, whether the failure may pass and
+// the reason. Returns false if the failure report cannot be written.
+bool ReportFailures()
+{
+	CStdioFile fOut( stdout );
+	CString csMessage;
+
+	CResultLog report;
+	if ( !m_csFailureFile.IsEmpty() )
+	{
+		if ( !report.Create( m_csFailureFile ) )
+		{
+			return false;
+		}
+		report.WriteLine( _T( "path\terror\tattempts\tkind\treason" ) );
+	}
+
+	CSingleLock lock( &m_FailureLock, TRUE );
+	if ( m_arrFailures.empty() )
+	{
+		report.Close();
+		return true;
+	}
+
+	sort
+	(
+		m_arrFailures.begin(), m_arrFailures.end(),
+		[]( const FILE_FAILURE& left, const FILE_FAILURE& right )
+		{
+			return left.m_csPath.CompareNoCase( right.m_csPath ) < 0;
+		}
+	);
+
+	csMessage.Format( _T( "Failed images: %d\n" ), (int)m_arrFailures.size() );
+	fOut.WriteString( csMessage );
+	for ( const FILE_FAILURE& failure : m_arrFailures )
+	{
+		const LPCTSTR pcszKind =
+			failure.m_bTransient ? _T( "transient" ) : _T( "permanent" );
+		csMessage.Format
+		(
+			_T( "\t%s\n\t\t%s, error %u, %s, %d attempt(s)\n" ),
+			failure.m_csPath, failure.m_csReason, failure.m_dwError,
+			pcszKind, failure.m_nAttempts
+		);
+		fOut.WriteString( csMessage );
+
+		if ( !m_csFailureFile.IsEmpty() )
+		{
+			csMessage.Format
+			(
+				_T( "%s\t%u\t%d\t%s\t%s" ), failure.m_csPath,
+				failure.m_dwError, failure.m_nAttempts, pcszKind,
+				failure.m_csReason
+			);
+			report.WriteLine( csMessage );
+		}
+	}
+	fOut.WriteString( _T( ".\n" ) );
+
+	report.Close();
+	return true;
+} // ReportFailures
+
+/////////////////////////////////////////////////////////////////////////////
+// merge the result logs of the shards of a run into the given log and
+// report the totals as a single run would. The shard headers are checked
+// so a missing or repeated shard is reported. Returns zero on success,
+// otherwise the program's error code.
+int MergeLogs( const vector<CString>& logs, LPCTSTR pcszMerged )
+{
+	CStdioFile fOut( stdout );
+	CString csMessage;
+
+	vector<CString> headers;
+	vector<CString> results;
+	vector<int> counts;
+	CString csError;
+	if ( !CResultLog::Merge( logs, pcszMerged, headers, results, counts, csError ) )
+	{
+		fOut.WriteString( _T( ".\n" ) );
+		fOut.WriteString( csError );
+		fOut.WriteString( _T( ".\n" ) );
+		return 6;
+	}
+
+	// every shard of the run should appear exactly once
+	int nShards = 0;
+	vector<int> found;
+	for ( const CString& csHeader : headers )
+	{
+		int nShard = 0;
+		int nOf = 0;
+		if ( 2 != _stscanf_s( csHeader, _T( "shard %d/%d" ), &nShard, &nOf ) )
+		{
+			continue;
+		}
+
+		if ( nShards == 0 )
+		{
+			nShards = nOf;
+			found.assign( nShards + 1, 0 );
+		}
+
+		if ( nOf != nShards || nShard < 1 || nShard > nShards )
+		{
+			csMessage.Format( _T( "Log of another run: %s\n" ), csHeader );
+			fOut.WriteString( csMessage );
+			continue;
+		}
+
+		found[ nShard ]++;
+	}
+
+	for ( int nShard = 1; nShard <= nShards; nShard++ )
+	{
+		if ( found[ nShard ] != 1 )
+		{
+			csMessage.Format
+			(
+				_T( "Shard %d/%d appears %d times\n" ),
+				nShard, nShards, found[ nShard ]
+			);
+			fOut.WriteString( csMessage );
+		}
+	}
+
+	fOut.WriteString( _T( ".\n" ) );
+	csMessage.Format( _T( "Merged log:\n\t%s\n" ), pcszMerged );
+	fOut.WriteString( csMessage );
+	fOut.WriteString( _T( ".\n" ) );
+
+	int nFiles = 0;
+	for ( size_t nResult = 0; nResult < results.size(); nResult++ )
+	{
+		nFiles += counts[ nResult ];
+	}
+
+	csMessage.Format( _T( "files: %d" ), nFiles );
+	for ( size_t nResult = 0; nResult < results.size(); nResult++ )
+	{
+		CString csCount;
+		csCount.Format( _T( ", %s: %d" ), results[ nResult ], counts[ nResult ] );
+		csMessage += csCount;
+	}
+	fOut.WriteString( csMessage + _T( "\n.\n" ) );
+
+	return 0;
+} // MergeLogs
+
+/////////////////////////////////////////////////////////////////////////////
+// a console application that can crawl through the file
+// system and troll for image metadata properties
+int _tmain( int argc, TCHAR* argv[], TCHAR* envp[] )
+{
+	HMODULE hModule = ::GetModuleHandle( NULL );
+	if ( hModule == NULL )
+	{
+		_tprintf( _T( "Fatal Error: GetModuleHandle failed\n" ) );
+		return 1;
+	}
+
+	// initialize MFC and error on failure
+	if ( !AfxWinInit( hModule, NULL, ::GetCommandLine(), 0 ) )
+	{
+		_tprintf( _T( "Fatal Error: MFC initialization failed\n " ) );
+		return 2;
+	}
+
+	// pull the optional switches out of the command line so only
+	// the positional arguments remain
+	const bool bOptions = ParseOptions( argc, argv );
+
+#ifdef _DEBUG
+	// a debug build checks its pattern matching and its adaptive limit
+	// when asked to and does nothing else
+	if ( m_bSelfTest )
+	{
+		const int nFailed = CGlobFilter::SelfTest() + CAdaptiveLimit::SelfTest();
+		_tprintf( _T( "Self test: %d checks failed\n" ), nFailed );
+		return nFailed == 0 ? 0 : 7;
+	}
+#endif
+
+	// do some common command line argument corrections
+	vector<CString> arrArgs = CHelper::CorrectedCommandLine( argc, argv );
+	size_t nArgs = arrArgs.size();
+
+	CStdioFile fOut( stdout );
+	CString csMessage;
+
+	// display the number of arguments if not 1 to help the user
+	// understand what went wrong if there is an error in the
+	// command line syntax
+	if ( nArgs != 1 )
+	{
+		fOut.WriteString( _T( ".\n" ) );
+		csMessage.Format( _T( "The number of parameters are %d\n.\n" ), nArgs - 1 );
+		fOut.WriteString( csMessage );
+
+		// display the arguments
+		for ( int i = 1; i < nArgs; i++ )
+		{
+			csMessage.Format( _T( "Parameter %d is %s\n.\n" ), i, arrArgs[ i ] );
+			fOut.WriteString( csMessage );
+		}
+	}
+
+	// five arguments are expected unless the jobs come from a file, the
+	// pathnames come from standard input or the dates are exported
+	const bool bJobsFile = !m_csJobsFile.IsEmpty();
+	const bool bMerge = !m_csMergeFile.IsEmpty();
+	const size_t nExpected =
+		bJobsFile ? 1 : m_bExport ? 2 : m_bFromStdin ? 4 : 5;
+	const bool bConflict =
+		( bJobsFile && m_bFromStdin ) ||
+		( m_bWatch && ( bJobsFile || m_bFromStdin ) ) ||
+		( bMerge && ( bJobsFile || m_bFromStdin || m_bWatch ) ) ||
+		( !m_csResumeFile.IsEmpty() && ( bJobsFile || m_bFromStdin || m_bWatch ) ) ||
+		( m_bExport && ( bJobsFile || m_bFromStdin || m_bWatch || bMerge || m_bDryRun ) );
+	const bool bArgs = bMerge ? nArgs >= 2 : nArgs == nExpected;
+	if ( !bOptions || bConflict || !bArgs )
+	{
+		fOut.WriteString( _T( ".\n" ) );
+		fOut.WriteString
+		(
+			_T( "SetDateTaken, Copyright (c) 2020, " )
+			_T( "by W. T. Block.\n" )
+		);
+
+		fOut.WriteString
+		(
+			_T( ".\n" )
+			_T( "A Windows command line program to set the image(s)\n" )
+			_T( "  Date Taken metadata given a base folder and a date\n" )
+			_T( "  and by default will also process sub-directories.\n" )
+			_T( ".\n" )
+			_T( "The time portion of the date comes from the Date\n" )
+			_T( "  Taken if available, otherwise the modification\n" )
+			_T( "  time is used. \n" )
+			_T( "Also a \"Corrected\" folder will be created with the\n" )
+			_T( "  same filenames, but these files will have their \n" )
+			_T( "  Date Taken metadata set. The original files\n" )
+			_T( "  will remain unmodified.\n" )
+			_T( ".\n" )
+		);
+
+		fOut.WriteString
+		(
+			_T( ".\n" )
+			_T( "Usage:\n" )
+			_T( ".\n" )
+			_T( ".  SetDateTaken [options] pathname year month day\n" )
+			_T( ".  SetDateTaken [options] --jobs-file filename\n" )
+			_T( ".  SetDateTaken [options] --from-stdin [-0] year month day\n" )
+			_T( ".  SetDateTaken --merge-logs merged shard-log [shard-log...]\n" )
+			_T( ".  SetDateTaken [options] --export filename pathname\n" )
+			_T( ".\n" )
+			_T( "Where:\n" )
+			_T( ".\n" )
+		);
+
+		fOut.WriteString
+		(
+			_T( ".  pathname is the root of the tree to be scanned, but\n" )
 			_T( ".  may contain wild cards like the following:\n" )
 			_T( ".    \"c:\\Picture\\DisneyWorldMary2 *.JPG\"\n" )
 			_T( ".  will process all files with that pattern, or\n" )
 			_T( ".    \"c:\\Picture\\DisneyWorldMary2 231.JPG\"\n" )
 			_T( ".  will process a single defined image file.\n" )
-			_T( ".  (NOTE: using wild cards will prevent recursion\n" )
-			_T( ".    into sub-directories because the folders will likely\n" )
-			_T( ".    not fall into the same pattern and therefore\n" )
-			_T( ".    sub-folders will not be found by the search).\n" )
+			_T( ".  (NOTE: the wild cards select the files in the\n" )
+			_T( ".    folder and in all of its sub-directories).\n" )
 		);
 
 		fOut.WriteString
@@ -582,110 +2720,531 @@ int _tmain( int argc, TCHAR* argv[], TCHAR* envp[] )
 			_T( ".  day 29 of February in a non-leap year.\n" )
 			_T( ".\n" )
 		);
+
+		fOut.WriteString
+		(
+			_T( ".  options:\n" )
+			_T( ".    --sidecar writes the date into an XMP sidecar\n" )
+			_T( ".      file next to each image (image.jpg.xmp)\n" )
+			_T( ".      instead of creating a corrected copy of the\n" )
+			_T( ".      image. An existing sidecar is replaced.\n" )
+			_T( ".    --output-root folder writes the output into a\n" )
+			_T( ".      tree below the given folder that mirrors the\n" )
+			_T( ".      scanned tree instead of \"Corrected\" folders.\n" )
+			_T( ".      The folder may be on another drive or share, but\n" )
+			_T( ".      must not be inside the scanned tree. A folder\n" )
+			_T( ".      outside the scanned tree, such as a listed\n" )
+			_T( ".      image elsewhere, is mirrored by its full path.\n" )
+			_T( ".    --jobs count sets the number of worker threads\n" )
+			_T( ".      (defaults to one, or to the number of\n" )
+			_T( ".      processors with a jobs file).\n" )
+			_T( ".      --jobs auto tunes the number of images in\n" )
+			_T( ".      flight to the throughput of the storage, from one\n" )
+			_T( ".      to four per processor the process may use.\n" )
+			_T( ".    --jobs-file filename runs every job in the file\n" )
+			_T( ".      in one process. Each line is either\n" )
+			_T( ".        pathname,YYYY-MM-DD[,time]\n" )
+			_T( ".      or a JSON object such as\n" )
+			_T( ".        {\"path\": \"c:\\\\Pictures\", \"date\": \"1980-09-06\"}\n" )
+			_T( ".      where time is taken (the default), modified or\n" )
+			_T( ".      midnight. A file found by more than one job is\n" )
+			_T( ".      processed by the first job only and the results\n" )
+			_T( ".      of each job are reported at the end.\n" )
+			_T( ".    --from-stdin reads the pathnames of the images\n" )
+			_T( ".      from standard input, one per line, instead of\n" )
+			_T( ".      crawling a folder. With -0 the pathnames are\n" )
+			_T( ".      separated by NUL characters (find -print0).\n" )
+			_T( ".      An output root mirrors the pathnames relative\n" )
+			_T( ".      to the current folder.\n" )
+			_T( ".    --watch crawls the tree and then keeps running,\n" )
+			_T( ".      dating each image that is created or changed\n" )
+			_T( ".      in the tree once its writer has finished, until\n" )
+			_T( ".      Ctrl+C is pressed.\n" )
+			_T( ".    --include pattern processes only the files whose\n" )
+			_T( ".      path relative to the pathname matches one of the\n" )
+			_T( ".      include patterns. May be given more than once.\n" )
+			_T( ".    --exclude pattern skips the files and folders\n" )
+			_T( ".      that match, so \"@eaDir\" or \"**/thumbs/**\"\n" )
+			_T( ".      prunes those folders without opening them.\n" )
+			_T( ".      May be given more than once. In a pattern * and\n" )
+			_T( ".      ? match within a name, ** matches any number of\n" )
+			_T( ".      folders, and a name alone matches at any depth.\n" )
+			_T( ".    --link-duplicates hard links the output of each\n" )
+			_T( ".      other name of an image (hard links, junctions\n" )
+			_T( ".      and symbolic links) to the output of the first\n" )
+			_T( ".      name found, which is the only one processed.\n" )
+			_T( ".    --dedupe writes identical inputs with the same new\n" )
+			_T( ".      date once, linking or copying the first output\n" )
+			_T( ".      for the others. Inputs are matched by the start\n" )
+			_T( ".      of the file and its size, then compared in full.\n" )
+			_T( ".    --dedupe-memory MB bounds the memory used to\n" )
+			_T( ".      remember the inputs (64 MB by default).\n" )
+			_T( ".    --dry-run reads the current dates from the file\n" )
+			_T( ".      headers and prints the plan of each image as one\n" )
+			_T( ".      tab separated line (pathname, current date or\n" )
+			_T( ".      -, source of the time and new date) without\n" )
+			_T( ".      writing any image or folder.\n" )
+			_T( ".    --plan filename exports the plan of a dry run to\n" )
+			_T( ".      the given file instead of the console.\n" )
+			_T( ".    --export filename reads the DateTimeOriginal,\n" )
+			_T( ".      DateTimeDigitized and DateTime of every image\n" )
+			_T( ".      in the tree from the file headers and writes\n" )
+			_T( ".      them sorted by pathname to the given file,\n" )
+			_T( ".      without writing any image. No date is given.\n" )
+			_T( ".    --export-format columnar|csv selects a columnar\n" )
+			_T( ".      file with a folder dictionary and fixed width\n" )
+			_T( ".      date columns (the default) or a CSV file.\n" )
+			_T( ".    --large-pages backs the read and write buffers\n" )
+			_T( ".      of the workers with large pages, which needs\n" )
+			_T( ".      the lock pages in memory privilege.\n" )
+			_T( ".    --stats reports the pooled read and write buffers\n" )
+			_T( ".      that were allocated, which stops growing once\n" )
+			_T( ".      the workers reuse their buffers. Other heap\n" )
+			_T( ".      allocations are not counted.\n" )
+			_T( ".    --ordered-output writes the output of the images\n" )
+			_T( ".      in the order they were found, so two runs over\n" )
+			_T( ".      the same tree can be compared line by line.\n" )
+			_T( ".    --order-window count sets the most outputs that\n" )
+			_T( ".      wait for a slow image (1024 by default), after\n" )
+			_T( ".      which the output of the slow image is written\n" )
+			_T( ".      out of order when it is done.\n" )
+			_T( ".    --progress draws a status line on standard error\n" )
+			_T( ".      with the images done, found, failed and skipped,\n" )
+			_T( ".      the folders still to list, the rates and the\n" )
+			_T( ".      time remaining for the images found so far.\n" )
+			_T( ".    --status-file filename writes the same numbers\n" )
+			_T( ".      as a JSON object to the given file a few times\n" )
+			_T( ".      a second for monitoring.\n" )
+			_T( ".    --verify reads back the EXIF and XMP dates of\n" )
+			_T( ".      each image that is written and, when its image\n" )
+			_T( ".      data was copied instead of encoded again, reads\n" )
+			_T( ".      the image data back from the finished output and\n" )
+			_T( ".      compares it with the image data of the input.\n" )
+			_T( ".      This catches a date stamped over the image data,\n" )
+			_T( ".      a block written at the wrong offset or a short\n" )
+			_T( ".      write. A wrong output is removed and listed with\n" )
+			_T( ".      the failed images.\n" )
+			_T( ".    --retries count tries an image that failed for a\n" )
+			_T( ".      reason that may pass, such as a dropped network\n" )
+			_T( ".      connection or a file in use, again up to the\n" )
+			_T( ".      given number of times (3 by default) with a\n" )
+			_T( ".      growing random delay. Other failures are not\n" )
+			_T( ".      tried again. The failed images are listed at\n" )
+			_T( ".      the end of the run.\n" )
+			_T( ".    --failure-report filename also writes the failed\n" )
+			_T( ".      images to the given file as tab separated lines.\n" )
+			_T( ".    --max-memory MB bounds the memory of the images\n" )
+			_T( ".      decoded at the same time. An image is decoded\n" )
+			_T( ".      once its estimated memory fits the budget, and\n" )
+			_T( ".      a JPEG or TIFF image larger than its share of\n" )
+			_T( ".      the budget that already has its dates is copied\n" )
+			_T( ".      with the dates overwritten in place instead.\n" )
+			_T( ".      Any other image larger than the whole budget\n" )
+			_T( ".      fails as too large.\n" )
+			_T( ".    --max-read-mbps MB and --max-write-mbps MB bound\n" )
+			_T( ".      the megabytes read and written per second by\n" )
+			_T( ".      all of the workers together.\n" )
+			_T( ".    --max-iops count bounds the reads and writes per\n" )
+			_T( ".      second of all of the workers together.\n" )
+			_T( ".    --throttle-file filename changes the limits while\n" )
+			_T( ".      running. Lines of the file such as\n" )
+			_T( ".        max-read-mbps=20\n" )
+			_T( ".      set the limit of the same name where 0 removes\n" )
+			_T( ".      it. The file is checked once a second.\n" )
+			_T( ".    --log filename writes the result, pathname and\n" )
+			_T( ".      new date of each image to the given file.\n" )
+			_T( ".    --shard K/N processes the K-th of N shards of the\n" )
+			_T( ".      tree (1 <= K <= N) so N processes on any number\n" )
+			_T( ".      of hosts can share a tree without coordination.\n" )
+			_T( ".      Each writes its own log, which defaults to\n" )
+			_T( ".      SetDateTaken-shard-K-of-N.log.\n" )
+			_T( ".    --shard-by path|folder assigns each file by a\n" )
+			_T( ".      hash of its relative path (the default) or each\n" )
+			_T( ".      top level folder as a whole for locality.\n" )
+			_T( ".    --resume filename saves the position of a walk\n" )
+			_T( ".      stopped by Ctrl+C in the given cursor file, after\n" )
+			_T( ".      the queued images are finished, and resumes the\n" )
+			_T( ".      walk from it on the next run. The cursor is\n" )
+			_T( ".      deleted when the walk completes.\n" )
+			_T( ".    --merge-logs merged combines the logs of the shards\n" )
+			_T( ".      into one log sorted by pathname and reports the\n" )
+			_T( ".      totals as if the tree were processed by one run.\n" )
+			_T( ".\n" )
+		);
 		return 3;
 	}
 
-	// display the executable path
-	//csMessage.Format( _T( "Executable pathname: %s\n" ), arrArgs[ 0 ] );
-	//fOut.WriteString( _T( ".\n" ) );
-	//fOut.WriteString( csMessage );
-	//fOut.WriteString( _T( ".\n" ) );
+	// combine the logs of a sharded run without processing any images
+	if ( bMerge )
+	{
+		const vector<CString> logs( arrArgs.begin() + 1, arrArgs.end() );
+		return MergeLogs( logs, m_csMergeFile );
+	}
 
-	// retrieve the pathname which may include wild cards
-	CString csPath = arrArgs[ 1 ];
+	// the jobs to be run
+	vector<unique_ptr<CJob>> jobs;
 
-	// trim off any wild card data
-	const CString csFolder = CHelper::GetFolder( csPath );
+	if ( bJobsFile )
+	{
+		if ( !LoadJobs( m_csJobsFile, jobs ) )
+		{
+			csMessage.Format( _T( "Unable to read jobs file:\n\t%s\n" ), m_csJobsFile );
+			fOut.WriteString( _T( ".\n" ) );
+			fOut.WriteString( csMessage );
+			fOut.WriteString( _T( ".\n" ) );
+			return 6;
+		}
 
-	// test for current folder character (a period)
-	bool bExists = csPath == _T( "." );
+	} else
+	{
+		unique_ptr<CJob> pJob = unique_ptr<CJob>( new CJob );
 
-	// if it is a period, add a wild card of *.* to retrieve
-	// all folders and files
-	if ( bExists )
+		// retrieve the pathname which may include wild cards, where
+		// the pathnames from standard input are relative to the
+		// current folder
+		const int nDate = m_bFromStdin ? 1 : 2;
+		pJob->Path = m_bFromStdin ? CString( _T( "." ) ) : arrArgs[ 1 ];
+
+		// an export has no date parameters
+		if ( !m_bExport )
+		{
+			// 4 digit year command line parameter
+			m_nYear = _tstol( arrArgs[ nDate ] );
+
+			// month of the year command line parameter (1..12)
+			m_nMonth = _tstol( arrArgs[ nDate + 1 ] );
+
+			// day of the month command line parameter (0..31)
+			m_nDay = _tstol( arrArgs[ nDate + 2 ] );
+		}
+
+		pJob->Year = m_nYear;
+		pJob->Month = m_nMonth;
+		pJob->Day = m_nDay;
+		jobs.push_back( move( pJob ) );
+	}
+
+	// the output tree mirrors each scanned tree below the output root,
+	// and both the tree comparison and the folder creation require a
+	// fully qualified path
+	if ( !m_csOutputRoot.IsEmpty() )
 	{
-		csPath = _T( ".\\*.*" );
+		TCHAR szOutput[ _MAX_PATH ] = { 0 };
+		_tfullpath( szOutput, m_csOutputRoot, _MAX_PATH );
+		m_csOutputRoot = szOutput;
+		m_csOutputRoot.TrimRight( _T( "\\" ) );
+	}
 
-		// if it is not a period, test to see if the folder exists
-	} else
+	// validate the jobs where a single job from the command line
+	// errors out and a bad job from a file is reported and skipped
+	for ( unique_ptr<CJob>& pJob : jobs )
 	{
-		if ( ::PathFileExists( csFolder ) )
+		CString csError;
+		const int nError = PrepareJob( *pJob, csError );
+		if ( nError != 0 )
 		{
-			bExists = true;
+			fOut.WriteString( _T( ".\n" ) );
+			fOut.WriteString( csError );
+			fOut.WriteString( _T( ".\n" ) );
+			if ( !bJobsFile )
+			{
+				return nError;
+			}
 		}
 	}
 
-	if ( !bExists )
+	// create the output root once for all of the jobs, which a dry
+	// run or an export leaves alone
+	if ( !m_csOutputRoot.IsEmpty() && !m_bDryRun && !m_bExport )
+	{
+		if ( !CreatePath( m_csOutputRoot ) )
+		{
+			csMessage.Format
+			(
+				_T( "Unable to create the output root:\n\t%s\n" ),
+				m_csOutputRoot
+			);
+			fOut.WriteString( _T( ".\n" ) );
+			fOut.WriteString( csMessage );
+			fOut.WriteString( _T( ".\n" ) );
+			return 4;
+		}
+
+		m_FolderCache.SetOutputRoot( m_csOutputRoot );
+	}
+
+	// without an output root the corrected folders are inside the tree,
+	// so they are excluded from the crawl
+	if ( m_csOutputRoot.IsEmpty() )
+	{
+		m_Filter.AddExclude( GetCorrectedFolder() );
+	}
+
+	if ( !bJobsFile )
 	{
-		csMessage.Format( _T( "Invalid pathname:\n\t%s\n" ), csPath );
+		if ( m_bFromStdin )
+		{
+			csMessage = _T( "Given pathnames from standard input\n" );
+
+		} else
+		{
+			csMessage.Format( _T( "Given pathname:\n\t%s\n" ), jobs[ 0 ]->Path );
+		}
 		fOut.WriteString( _T( ".\n" ) );
 		fOut.WriteString( csMessage );
+	}
+
+	if ( !bJobsFile && !m_bExport )
+	{
+		// record the given date
+		m_Date.Year = m_nYear;
+		m_Date.Month = m_nMonth;
+		m_Date.Day = m_nDay;
+		csMessage.Format
+		(
+			_T( "The date parameters yielded: %s\n" ),
+			m_Date.Date
+		);
+		fOut.WriteString( csMessage );
 		fOut.WriteString( _T( ".\n" ) );
-		return 4;
+	}
+
+	// each shard writes its own log which names the shard
+	CString csShard;
+	if ( m_nShards > 1 )
+	{
+		csShard.Format
+		(
+			_T( "shard %d/%d by %s" ), m_nShard, m_nShards,
+			m_bShardByFolder ? _T( "folder" ) : _T( "path" )
+		);
+
+		if ( m_csLogFile.IsEmpty() )
+		{
+			m_csLogFile.Format
+			(
+				_T( "SetDateTaken-shard-%d-of-%d.log" ), m_nShard, m_nShards
+			);
+		}
+	}
+
+	if ( !m_csLogFile.IsEmpty() )
+	{
+		if ( !m_Log.Create( m_csLogFile, csShard.IsEmpty() ? nullptr : (LPCTSTR)csShard ) )
+		{
+			csMessage.Format( _T( "Unable to write log:\n\t%s\n" ), m_csLogFile );
+			fOut.WriteString( _T( ".\n" ) );
+			fOut.WriteString( csMessage );
+			fOut.WriteString( _T( ".\n" ) );
+			return 6;
+		}
+	}
+
+	// the plan of a dry run starts with the names of its columns
+	if ( !m_csPlanFile.IsEmpty() )
+	{
+		if ( !m_Plan.Create( m_csPlanFile ) )
+		{
+			csMessage.Format( _T( "Unable to write plan:\n\t%s\n" ), m_csPlanFile );
+			fOut.WriteString( _T( ".\n" ) );
+			fOut.WriteString( csMessage );
+			fOut.WriteString( _T( ".\n" ) );
+			return 6;
+		}
+		m_Plan.WriteLine( _T( "path\told date\tsource\tnew date" ) );
+	}
+
+	// the buffers of the workers are allocated as they start
+	if ( m_bLargePages && !CBufferPool::EnableLargePages() )
+	{
+		fOut.WriteString
+		(
+			_T( "Large pages are not available, using normal pages\n.\n" )
+		);
+	}
+
+	// COM and GDI+ are started by the first file that needs them, so a
+	// run that only reads EXIF data or patches JPEG files never loads them
+
+	// the limits of shared storage apply to every worker
+	CIoThrottle::SetLimits( m_dMaxReadMbps, m_dMaxWriteMbps, m_dMaxIops );
+	if ( !m_csThrottleFile.IsEmpty() )
+	{
+		CIoThrottle::SetControlFile( m_csThrottleFile );
+	}
+
+	// the output of the images is written in the order they are found
+	if ( m_bOrderedOutput )
+	{
+		m_Ordered.Start( EmitFileOutput );
+	}
+
+	// the progress is a sample of the counters of the jobs, which the
+	// workers keep anyway, and of the bytes read and written
+	m_bWalking = true;
+	m_Progress.Start
+	(
+		[ &jobs ]( PROGRESS_SAMPLE& sample )
+		{
+			for ( unique_ptr<CJob>& pJob : jobs )
+			{
+				sample.m_llFound += pJob->Files;
+				sample.m_llProcessed += pJob->Written + pJob->Failed;
+				sample.m_llFailed += pJob->Failed;
+				sample.m_llSkipped += pJob->Duplicates;
+			}
+			sample.m_llFoldersPending = m_lFoldersPending;
+			sample.m_ullRead = CIoThrottle::GetBytesRead();
+			sample.m_ullWritten = CIoThrottle::GetBytesWritten();
+			sample.m_bWalking = m_bWalking;
+		},
+		m_bProgress, m_csStatusFile
+	);
+
+	// start the workers. A single pathname runs one image at a time as it
+	// always has, while a jobs file defaults to one worker per processor
+	// this process may use. Adaptive workers start with one image in
+	// flight and may grow to several per processor, since an image mostly
+	// waits for the storage.
+	const int nProcessors = GetAvailableProcessors();
+	if ( m_bAdaptiveJobs )
+	{
+		const int nMaximum = nProcessors * GetAdaptiveFactor();
+		m_Pool.StartAdaptive( 1, nMaximum, nMaximum * 64 );
 
 	} else
 	{
-		csMessage.Format( _T( "Given pathname:\n\t%s\n" ), csPath );
-		fOut.WriteString( _T( ".\n" ) );
-		fOut.WriteString( csMessage );
+		const int nThreads =
+			m_nThreads > 0 ? m_nThreads : m_csJobsFile.IsEmpty() ? 1 : nProcessors;
+		m_Pool.Start( nThreads, nThreads * 64 );
 	}
 
-	// 4 digit year command line parameter
-	m_nYear = _tstol( arrArgs[ 2 ] );
+	// overlapping jobs and repeated pathnames process each file once, and
+	// a watched file that changes again while it is in flight is skipped
+	m_bClaimFiles = jobs.size() > 1 || m_bFromStdin || m_bWatch;
+	m_bReleaseClaims = m_bFromStdin || m_bWatch;
+
+	if ( m_bFromStdin )
+	{
+		// the images are already known, so no folder is crawled
+		ReadPathList( *jobs[ 0 ], m_bNullDelimited );
+
+	} else if ( m_bWatch )
+	{
+		if ( !WatchPath( *jobs[ 0 ] ) )
+		{
+			csMessage.Format
+			(
+				_T( "Unable to watch folder:\n\t%s\n" ), jobs[ 0 ]->Path
+			);
+			WriteOutput( _T( ".\n" ) + csMessage + _T( ".\n" ) );
+		}
+
+	} else
+	{
+		// Ctrl+C stops the walk at a point it can resume from
+		if ( !m_csResumeFile.IsEmpty() )
+		{
+			::SetConsoleCtrlHandler( OnConsoleControl, TRUE );
+		}
 
-	// month of the year command line parameter (1..12)
-	m_nMonth = _tstol( arrArgs[ 3 ] );
+		// walk the directory tree defined by each job
+		// trolling for supported image files
+		for ( unique_ptr<CJob>& pJob : jobs )
+		{
+			if ( pJob->Valid )
+			{
+				WalkPath( pJob->Path, *pJob );
+			}
+		}
+	}
 
-	// day of the month command line parameter (0..31)
-	m_nDay = _tstol( arrArgs[ 4 ] );
+	// every image has been found
+	m_bWalking = false;
 
-	// record the given year
-	m_Date.Year = m_nYear;
+	// wait for the workers to finish, including the images that are
+	// tried again after a delay, which may fail and wait again
+	do
+	{
+		m_Pool.Wait();
+
+	} while ( m_Retry.WaitForPending() );
+	m_Retry.Stop();
+	m_Pool.Stop();
+	m_Ordered.Flush();
+	m_Progress.Stop();
+	m_Log.Close();
+	m_Plan.Close();
+
+	// the dates are saved once every image has been read
+	if ( m_bExport )
+	{
+		if ( m_Export.Save( m_csExportFile, m_eExportFormat ) )
+		{
+			csMessage.Format
+			(
+				_T( "Exported the dates of %d images to:\n\t%s\n.\n" ),
+				m_Export.Count, m_csExportFile
+			);
 
-	// record the given month of the year
-	m_Date.Month = m_nMonth;
+		} else
+		{
+			csMessage.Format
+			(
+				_T( "Unable to write export:\n\t%s\n.\n" ), m_csExportFile
+			);
+		}
+		fOut.WriteString( csMessage );
+	}
 
-	// record the given day of the month
-	m_Date.Day = m_nDay;
+	// the output of the first names exists now
+	if ( m_bLinkDuplicates && !m_bSidecar && !m_bDryRun && !m_bExport )
+	{
+		LinkDuplicates();
+	}
 
-	// If all of the date and time information is present,
-	// the Okay status of the date class will be set to true.
-	if ( m_Date.Okay == false )
+	if ( m_bDedupe && !m_bSidecar && !m_bDryRun && !m_bExport )
 	{
-		// let the user know the parameters did not make
-		// a valid date and error out
 		csMessage.Format
 		(
-			_T( "Invalid date parameter(s) Year:" )
-			_T( " %d, Month: %d, Day: %d\n" ),
-			m_Date.Year, m_Date.Month, m_Date.Day
+			_T( "Identical content: %d copies reused, %I64d bytes saved\n.\n" ),
+			m_ContentIndex.Duplicates, m_ContentIndex.Saved
 		);
-		fOut.WriteString( _T( ".\n" ) );
 		fOut.WriteString( csMessage );
-		fOut.WriteString( _T( ".\n" ) );
-		return 5;
+	}
 
-	} else // the given parameters worked
+	if ( m_bVerify && !m_bSidecar && !m_bDryRun && !m_bExport )
 	{
 		csMessage.Format
 		(
-			_T( "The date parameters yielded: %s\n" ),
-			m_Date.Date
+			_T( "Verified: %d outputs, %d in a format not read back\n.\n" ),
+			m_lVerified, m_lUnverified
 		);
 		fOut.WriteString( csMessage );
-		fOut.WriteString( _T( ".\n" ) );
 	}
 
-	// start up COM
-	AfxOleInit();
-	::CoInitialize( NULL );
+	if ( m_bStats )
+	{
+		csMessage.Format
+		(
+			_T( "I/O buffers allocated: %d\n.\n" ), CBufferPool::GetAllocations()
+		);
+		fOut.WriteString( csMessage );
+	}
 
-	// create a reference to GDI+
-	InitGdiplus();
+	if ( bJobsFile )
+	{
+		ReportJobs( jobs );
+	}
 
-	// crawl through directory tree defined by the command line
-	// parameter trolling for supported image files
-	RecursePath( csPath );
+	if ( !ReportFailures() )
+	{
+		csMessage.Format
+		(
+			_T( "Unable to write failure report:\n\t%s\n.\n" ), m_csFailureFile
+		);
+		fOut.WriteString( csMessage );
+	}
 
 	// clean up references to GDI+
 	TerminateGdiplus();
@@ -5,9 +5,28 @@
 
 #include "resource.h"
 #include "KeyedCollection.h"
+#include "WorkerPool.h"
+#include "Job.h"
+#include "DirectoryWatcher.h"
+#include "GlobFilter.h"
+#include "ResultLog.h"
+#include "BufferPool.h"
+#include "IoThrottle.h"
+#include "MemoryBudget.h"
+#include "RetryQueue.h"
+#include "OrderedOutput.h"
+#include "ProgressReporter.h"
+#include "ContentHash.h"
+#include "ContentIndex.h"
+#include "TreeWalker.h"
+#include "MetadataExport.h"
+#include <atomic>
 #include <vector>
 #include <map>
 #include <memory>
+#include <set>
+#include <io.h>
+#include <fcntl.h>
 #include <gdiplus.h>
 
 // we need to link to the GDI+ library
@@ -361,6 +380,9 @@ protected:
 	// cross reference of mime types to class IDs
 	CKeyedCollection<CString, CLSID> m_mapMimeTypes;
 
+	// guards the cross references for concurrent lookups
+	CCriticalSection m_Lock;
+
 	// public properties
 public:
 	// current file extension
@@ -404,9 +426,22 @@ public:
 
 	// public methods
 public:
+	// look up the mime type and class ID of the given file extension
+	// without changing the current properties which makes it safe to
+	// call from concurrent workers. Returns false if the extension is
+	// not supported.
+	bool Lookup( LPCTSTR pcszExtension, CString& csMimeType, CLSID& clsid );
+
+	// look up the mime type of the given file extension without starting
+	// GDI+ for the class IDs. Returns false if the extension is not
+	// supported.
+	bool FindMimeType( LPCTSTR pcszExtension, CString& csMimeType );
 
 	// protected methods
 protected:
+	// populate the mime type map from the GDI+ encoders the first time
+	// it is referenced
+	void LoadMimeTypes();
 
 	// public virtual methods
 public:
@@ -453,10 +488,168 @@ public:
 	}
 };
 
+/////////////////////////////////////////////////////////////////////////////
+// this class remembers the output folders that are known to exist keyed
+// by the source folder of the images, so each output folder is checked
+// and created once no matter how many images are written into it. The
+// cache is guarded so concurrent writers do not race on the creation.
+// The output folder is either the "Corrected" folder below the source
+// folder, or when an output root is given, the folder that mirrors the
+// source folder below the output root.
+class CFolderCache
+{
+	// protected data
+protected:
+	// cross reference of source folders to existing output folders
+	CKeyedCollection<CString, CString> m_mapFolders;
+
+	// guards the cross reference
+	CCriticalSection m_Lock;
+
+	// root of the mirrored output tree (empty if not in use)
+	CString m_csOutputRoot;
+
+	// public properties
+public:
+	// root of the mirrored output tree (empty if not in use)
+	inline CString GetOutputRoot()
+	{
+		return m_csOutputRoot;
+	}
+	// root of the mirrored output tree (empty if not in use)
+	__declspec( property( get = GetOutputRoot ) )
+		CString OutputRoot;
+
+	// public methods
+public:
+	// given the root of the tree being scanned and a source folder,
+	// usually below it (neither with a trailing backslash), return the
+	// output folder for the source folder, creating the output folder the
+	// first time it is requested. A source folder outside the root is
+	// mirrored by its full path. Returns false if the folder cannot be
+	// created.
+	bool Prepare( LPCTSTR pcszRoot, LPCTSTR pcszSource, CString& csFolder );
+
+	// mirror each scanned tree into the given output root (without a
+	// trailing backslash) instead of using "Corrected" folders
+	void SetOutputRoot( LPCTSTR pcszOutputRoot )
+	{
+		CSingleLock lock( &m_Lock, TRUE );
+		m_csOutputRoot = pcszOutputRoot;
+		m_mapFolders.clear();
+	}
+
+	// forget all of the folders
+	void Clear()
+	{
+		CSingleLock lock( &m_Lock, TRUE );
+		m_mapFolders.clear();
+	}
+
+	// public construction
+public:
+	CFolderCache()
+	{
+	}
+};
+
+/////////////////////////////////////////////////////////////////////////////
+// an image file found by the crawl which is handed to a worker thread
+typedef struct tagFileTask
+{
+	// pathname of the image
+	CString m_csPath;
+
+	// folder of the image without a trailing backslash
+	CString m_csFolder;
+
+	// filename and extension of the image
+	CString m_csDataName;
+
+	// lower case extension of the image
+	CString m_csExtension;
+
+	// the job the image belongs to
+	CJob* m_pJob;
+
+	// number of times the image has been tried before
+	int m_nAttempt;
+
+	// the order the image was found in
+	LONGLONG m_llSequence;
+
+	// the output of the earlier attempts which waits for the image to be
+	// done when the output is ordered
+	CString m_csEarlier;
+
+	tagFileTask()
+	{
+		m_pJob = nullptr;
+		m_nAttempt = 0;
+		m_llSequence = 0;
+	}
+
+} FILE_TASK;
+
+/////////////////////////////////////////////////////////////////////////////
+// an image that could not be written, for the failure report
+typedef struct tagFileFailure
+{
+	// pathname of the image
+	CString m_csPath;
+
+	// what could not be done
+	CString m_csReason;
+
+	// the system error code, or zero for a problem with the image itself
+	DWORD m_dwError;
+
+	// number of times the image was tried
+	int m_nAttempts;
+
+	// the failure may have passed if tried again later
+	bool m_bTransient;
+
+} FILE_FAILURE;
+
+/////////////////////////////////////////////////////////////////////////////
+// the first name found for an image that has more than one name
+typedef struct tagFileVisit
+{
+	// pathname of the image
+	CString m_csPath;
+
+	// the job that found the image
+	CJob* m_pJob;
+
+} FILE_VISIT;
+
+/////////////////////////////////////////////////////////////////////////////
+// another name of an image which is linked to the output of the first
+// name once the images are written
+typedef struct tagDuplicateName
+{
+	// the first name found
+	FILE_VISIT m_First;
+
+	// the other name
+	FILE_VISIT m_Duplicate;
+
+} DUPLICATE_NAME;
+
 /////////////////////////////////////////////////////////////////////////////
 // used for gdiplus library
 ULONG_PTR m_gdiplusToken;
 
+/////////////////////////////////////////////////////////////////////////////
+// GDI+ has been started, which is published with release semantics so a
+// thread that sees it set also sees the token
+atomic<bool> m_bGdiplus;
+
+/////////////////////////////////////////////////////////////////////////////
+// guards the start of GDI+
+CCriticalSection m_GdiplusLock;
+
 /////////////////////////////////////////////////////////////////////////////
 // this class records the date and time information in each image file 
 // referenced
@@ -467,6 +660,38 @@ CDate m_Date;
 // defined by GDI+ for common file extensions
 CExtension m_Extension;
 
+/////////////////////////////////////////////////////////////////////////////
+// output folders that are known to exist
+CFolderCache m_FolderCache;
+
+/////////////////////////////////////////////////////////////////////////////
+// the worker threads that process the image files
+CWorkerPool m_Pool;
+
+/////////////////////////////////////////////////////////////////////////////
+// guards the console so the output of each file is written as one block
+CCriticalSection m_ConsoleLock;
+
+/////////////////////////////////////////////////////////////////////////////
+// the full pathnames (in lower case) of the files claimed by a job when
+// more than one job is run or the images are read from standard input, so
+// overlapping jobs or a name listed twice process a file once
+set<CString> m_setClaimed;
+
+/////////////////////////////////////////////////////////////////////////////
+// guards the claimed files
+CCriticalSection m_ClaimLock;
+
+/////////////////////////////////////////////////////////////////////////////
+// files are claimed by the first job that finds them
+bool m_bClaimFiles;
+
+/////////////////////////////////////////////////////////////////////////////
+// a claim is released once its file is done, so the claims of a long list
+// read from standard input or of a watched tree do not pile up. A name
+// listed or changed again while the file is still in flight is skipped.
+bool m_bReleaseClaims;
+
 /////////////////////////////////////////////////////////////////////////////
 // 4 digit year command line parameter
 int m_nYear;
@@ -479,6 +704,263 @@ int m_nMonth;
 // day of the month command line parameter (0..31)
 int m_nDay;
 
+/////////////////////////////////////////////////////////////////////////////
+// command line option "--sidecar" writes an XMP sidecar file next to each
+// image instead of a corrected copy of the image
+bool m_bSidecar;
+
+/////////////////////////////////////////////////////////////////////////////
+// command line option "--output-root" gives the root of a tree that
+// mirrors the source tree and receives the output instead of the
+// "Corrected" folders
+CString m_csOutputRoot;
+
+/////////////////////////////////////////////////////////////////////////////
+// command line option "--jobs" gives the number of worker threads which
+// defaults to one, or to the number of processors with a jobs file
+int m_nThreads;
+
+/////////////////////////////////////////////////////////////////////////////
+// command line option "--jobs auto" tunes the number of images in flight
+// to the throughput of the storage
+bool m_bAdaptiveJobs;
+
+/////////////////////////////////////////////////////////////////////////////
+// command line option "--jobs-file" gives a file of path and date pairs
+// that are all processed by this one run
+CString m_csJobsFile;
+
+/////////////////////////////////////////////////////////////////////////////
+// command line option "--from-stdin" reads the pathnames of the images
+// from standard input instead of crawling a folder
+bool m_bFromStdin;
+
+/////////////////////////////////////////////////////////////////////////////
+// command line option "-0" separates the pathnames read from standard
+// input with NUL characters instead of line breaks
+bool m_bNullDelimited;
+
+/////////////////////////////////////////////////////////////////////////////
+// command line option "--watch" keeps running after the initial crawl and
+// dates the images that are created or changed in the tree
+bool m_bWatch;
+
+/////////////////////////////////////////////////////////////////////////////
+// watches the tree in watch mode
+CDirectoryWatcher m_Watcher;
+
+/////////////////////////////////////////////////////////////////////////////
+// command line options "--include" and "--exclude" select the files and
+// folders of the tree by their relative paths
+CGlobFilter m_Filter;
+
+/////////////////////////////////////////////////////////////////////////////
+// command line option "--shard K/N" processes only the K-th of N shards
+// of the tree (1 <= K <= N) where zero shards means the whole tree
+int m_nShard;
+int m_nShards;
+
+/////////////////////////////////////////////////////////////////////////////
+// command line option "--shard-by folder" assigns whole top level folders
+// to the shards instead of single files
+bool m_bShardByFolder;
+
+/////////////////////////////////////////////////////////////////////////////
+// command line option "--log" gives the pathname of the result log
+CString m_csLogFile;
+
+/////////////////////////////////////////////////////////////////////////////
+// records the result of each image
+CResultLog m_Log;
+
+/////////////////////////////////////////////////////////////////////////////
+// command line option "--merge-logs" gives the pathname of the log that
+// the result logs given on the command line are merged into
+CString m_csMergeFile;
+
+/////////////////////////////////////////////////////////////////////////////
+// the first name of each image found by the crawl so an image with more
+// than one name (hard links or symbolic links) is processed once
+CFileIdMap<FILE_VISIT> m_mapFiles;
+
+/////////////////////////////////////////////////////////////////////////////
+// the other names of the images found by the crawl
+vector<DUPLICATE_NAME> m_arrDuplicates;
+
+/////////////////////////////////////////////////////////////////////////////
+// guards the other names
+CCriticalSection m_DuplicateLock;
+
+/////////////////////////////////////////////////////////////////////////////
+// command line option "--link-duplicates" hard links the output of the
+// other names of an image to the output of its first name
+bool m_bLinkDuplicates;
+
+/////////////////////////////////////////////////////////////////////////////
+// command line option "--dedupe" writes identical inputs with the same
+// new date once and reuses the first output for the others
+bool m_bDedupe;
+
+/////////////////////////////////////////////////////////////////////////////
+// the outputs written for each content key and new date
+CContentIndex m_ContentIndex;
+
+/////////////////////////////////////////////////////////////////////////////
+// command line option "--resume" names the cursor file where a walk
+// stopped by Ctrl+C saves its position and resumes from on the next run
+CString m_csResumeFile;
+
+/////////////////////////////////////////////////////////////////////////////
+// command line option "--dry-run" reports the new date of each image
+// without writing anything
+bool m_bDryRun;
+
+/////////////////////////////////////////////////////////////////////////////
+// command line option "--plan" names the file the plan of a dry run is
+// exported to instead of the console
+CString m_csPlanFile;
+
+/////////////////////////////////////////////////////////////////////////////
+// the plan of a dry run
+CResultLog m_Plan;
+
+/////////////////////////////////////////////////////////////////////////////
+// command line option "--export" writes the date properties of every image
+// to a file without writing any image
+bool m_bExport;
+
+/////////////////////////////////////////////////////////////////////////////
+// the file the date properties are exported to
+CString m_csExportFile;
+
+/////////////////////////////////////////////////////////////////////////////
+// command line option "--export-format" selects a columnar (the default)
+// or CSV export file
+CMetadataExport::EXPORT_FORMAT m_eExportFormat;
+
+/////////////////////////////////////////////////////////////////////////////
+// the date properties collected for the export
+CMetadataExport m_Export;
+
+/////////////////////////////////////////////////////////////////////////////
+// command line option "--large-pages" backs the buffers of the workers
+// with large pages
+bool m_bLargePages;
+
+/////////////////////////////////////////////////////////////////////////////
+// command line option "--stats" reports the pooled I/O buffers allocated
+// by the workers at the end of the run
+bool m_bStats;
+
+/////////////////////////////////////////////////////////////////////////////
+// command line option "--ordered-output" writes the output of the images
+// in the order they were found
+bool m_bOrderedOutput;
+
+/////////////////////////////////////////////////////////////////////////////
+// the reorder buffer of the ordered output
+COrderedOutput m_Ordered;
+
+/////////////////////////////////////////////////////////////////////////////
+// the sequence number of the next image found
+volatile LONGLONG m_llSequence;
+
+/////////////////////////////////////////////////////////////////////////////
+// command line option "--progress" draws a status line with the rate and
+// the time remaining on standard error
+bool m_bProgress;
+
+/////////////////////////////////////////////////////////////////////////////
+// command line option "--status-file" names the file the progress is
+// written to for monitoring
+CString m_csStatusFile;
+
+/////////////////////////////////////////////////////////////////////////////
+// reports the progress of the run
+CProgressReporter m_Progress;
+
+/////////////////////////////////////////////////////////////////////////////
+// folders found by the walk that are not listed yet
+volatile LONG m_lFoldersPending;
+
+/////////////////////////////////////////////////////////////////////////////
+// the tree is still being walked
+volatile bool m_bWalking;
+
+/////////////////////////////////////////////////////////////////////////////
+// command line option "--verify" reads back the dates of each image
+// written and compares the image data read back from its output with the
+// image data of the input
+bool m_bVerify;
+
+#ifdef _DEBUG
+/////////////////////////////////////////////////////////////////////////////
+// command line option "--self-test" of a debug build runs the checks of
+// the pattern matching and the adaptive limit instead of processing images
+bool m_bSelfTest;
+#endif
+
+/////////////////////////////////////////////////////////////////////////////
+// images whose output was verified
+volatile LONG m_lVerified;
+
+/////////////////////////////////////////////////////////////////////////////
+// images written in a format whose dates cannot be read back without
+// decoding the image, which are not verified
+volatile LONG m_lUnverified;
+
+/////////////////////////////////////////////////////////////////////////////
+// the images that failed for a reason that may pass are tried again after
+// a delay
+CRetryQueue m_Retry;
+
+/////////////////////////////////////////////////////////////////////////////
+// the images that could not be written
+vector<FILE_FAILURE> m_arrFailures;
+
+/////////////////////////////////////////////////////////////////////////////
+// guards the failures
+CCriticalSection m_FailureLock;
+
+/////////////////////////////////////////////////////////////////////////////
+// command line option "--failure-report" names the file the failures are
+// written to at the end of the run
+CString m_csFailureFile;
+
+/////////////////////////////////////////////////////////////////////////////
+// command line option "--max-memory" bounds the memory of the images that
+// are decoded at the same time
+CMemoryBudget m_MemoryBudget;
+
+/////////////////////////////////////////////////////////////////////////////
+// command line options "--max-read-mbps" and "--max-write-mbps" bound the
+// megabytes read and written per second by all of the workers, where zero
+// is no limit
+double m_dMaxReadMbps;
+double m_dMaxWriteMbps;
+
+/////////////////////////////////////////////////////////////////////////////
+// command line option "--max-iops" bounds the reads and writes per second
+// of all of the workers, where zero is no limit
+double m_dMaxIops;
+
+/////////////////////////////////////////////////////////////////////////////
+// command line option "--throttle-file" names the file the limits are
+// changed through while running
+CString m_csThrottleFile;
+
+/////////////////////////////////////////////////////////////////////////////
+// the user pressed Ctrl+C to stop the walk, which is set by the console
+// control thread and read by the walk
+atomic<bool> m_bStopRequested;
+
+/////////////////////////////////////////////////////////////////////////////
+// adaptive workers may grow to this many images in flight per processor
+static inline int GetAdaptiveFactor()
+{
+	return 4;
+}
+
 /////////////////////////////////////////////////////////////////////////////
 // the new folder under the image folder to contain the corrected images
 static inline CString GetCorrectedFolder()
@@ -502,7 +984,8 @@ static inline int GetCorrectedFolderLength()
 // returns true if the path is created or already exists
 bool CreatePath( LPCTSTR pszPath )
 {
-	if ( ERROR_SUCCESS == SHCreateDirectoryEx( NULL, pszPath, NULL ) )
+	const int nError = SHCreateDirectoryEx( NULL, pszPath, NULL );
+	if ( ERROR_SUCCESS == nError || ERROR_ALREADY_EXISTS == nError )
 	{
 		return true;
 	}
@@ -511,25 +994,72 @@ bool CreatePath( LPCTSTR pszPath )
 } // CreatePath
 
 /////////////////////////////////////////////////////////////////////////////
-// initialize GDI+
+// this class initializes COM for the calling thread and releases it when
+// the thread ends. The thread joins a single threaded apartment as it did
+// with AfxOleInit, since the codecs of GDI+ and the shell expect one.
+class CThreadCom
+{
+	// protected data
+protected:
+	// COM was initialized by this object
+	bool m_bInitialized;
+
+	// public construction / destruction
+public:
+	CThreadCom()
+	{
+		m_bInitialized = SUCCEEDED( ::CoInitializeEx( NULL, COINIT_APARTMENTTHREADED ) );
+	}
+	~CThreadCom()
+	{
+		if ( m_bInitialized )
+		{
+			::CoUninitialize();
+		}
+	}
+};
+
+/////////////////////////////////////////////////////////////////////////////
+// initialize GDI+ the first time any thread needs it, along with COM for
+// the calling thread, so the runs and files that never reach GDI+ never
+// pay for starting it. Returns false if GDI+ cannot be started.
 bool InitGdiplus()
 {
-	GdiplusStartupInput gdiplusStartupInput;
-	Status status = GdiplusStartup
-	(
-		&m_gdiplusToken,
-		&gdiplusStartupInput,
-		NULL
-	);
-	return ( Ok == status );
+	// the codecs of GDI+ may use COM on the calling thread
+	static thread_local CThreadCom com;
+
+	if ( m_bGdiplus.load( memory_order_acquire ) )
+	{
+		return true;
+	}
+
+	CSingleLock lock( &m_GdiplusLock, TRUE );
+	if ( !m_bGdiplus.load( memory_order_relaxed ) )
+	{
+		GdiplusStartupInput gdiplusStartupInput;
+		Status status = GdiplusStartup
+		(
+			&m_gdiplusToken,
+			&gdiplusStartupInput,
+			NULL
+		);
+		m_bGdiplus.store( Ok == status, memory_order_release );
+	}
+
+	return m_bGdiplus.load( memory_order_relaxed );
 } // InitGdiplus
 
 /////////////////////////////////////////////////////////////////////////////
-// remove reference to GDI+
+// remove reference to GDI+ if it was started
 void TerminateGdiplus()
 {
-	GdiplusShutdown( m_gdiplusToken );
-	m_gdiplusToken = NULL;
+	CSingleLock lock( &m_GdiplusLock, TRUE );
+	if ( m_bGdiplus.load( memory_order_relaxed ) )
+	{
+		m_bGdiplus.store( false, memory_order_release );
+		GdiplusShutdown( m_gdiplusToken );
+		m_gdiplusToken = NULL;
+	}
 
 }// TerminateGdiplus
 
@@ -0,0 +1,378 @@
+/////////////////////////////////////////////////////////////////////////////
+// Copyright  by W. T. Block, all rights reserved
+/////////////////////////////////////////////////////////////////////////////
+#pragma once
+#include "stdafx.h"
+#include <functional>
+#include <vector>
+
+using namespace std;
+
+/////////////////////////////////////////////////////////////////////////////
+// a file found by the tree walker
+typedef struct tagWalkEntry
+{
+	// pathname of the file
+	CString m_csPath;
+
+	// folder of the file without a trailing backslash
+	CString m_csFolder;
+
+	// filename and extension of the file
+	CString m_csName;
+
+} WALK_ENTRY;
+
+/////////////////////////////////////////////////////////////////////////////
+// this class walks a folder tree without recursion and hands out one file
+// at a time, so the consumer pulls the files at its own pace. The folders
+// waiting to be listed are kept on an explicit stack and only the folder
+// being listed has an open find handle. The position of the walk (the
+// folder being listed, the last name taken from it and the folders still
+// waiting) can be saved to a cursor file and loaded to resume the walk.
+// NTFS lists a folder in the order of its upper case names, which is how
+// a resumed folder that lost the name it was stopped at finds its place.
+class CTreeWalker
+{
+	// public definitions
+public:
+	// called with each folder found and returns false to skip the folder
+	typedef function<bool( LPCTSTR )> DESCEND;
+
+	// protected data
+protected:
+	// the folder at the root of the walk without a trailing backslash
+	CString m_csRoot;
+
+	// wild card data the file names must match (empty for all files)
+	CString m_csSpec;
+
+	// decides whether a folder is walked
+	DESCEND m_fnDescend;
+
+	// the folders waiting to be listed where the last is listed next
+	vector<CString> m_arrPending;
+
+	// the folder being listed
+	CString m_csFolder;
+
+	// the last name taken from the folder being listed
+	CString m_csAfter;
+
+	// a resumed walk skips the names up to and including this one
+	CString m_csSkipTo;
+
+	// a resumed folder that no longer has the name it was stopped at is
+	// listed again, skipping the names that sort up to this one
+	CString m_csSkipBelow;
+
+	// the find handle of the folder being listed
+	HANDLE m_hFind;
+
+	// the entry found by the find handle
+	WIN32_FIND_DATA m_FindData;
+
+	// the entry found by FindFirstFile has not been taken yet
+	bool m_bFirst;
+
+	// protected methods
+protected:
+	// compare two names in the order NTFS lists them
+	static int CompareNames( CString csLeft, CString csRight )
+	{
+		return csLeft.MakeUpper().Compare( csRight.MakeUpper() );
+	}
+
+	// return true if the given folder is waiting to be listed
+	bool IsPending( const CString& csFolder )
+	{
+		for ( const CString& csPending : m_arrPending )
+		{
+			if ( csPending.CompareNoCase( csFolder ) == 0 )
+			{
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+	// open the find handle of the given folder
+	bool List( const CString& csFolder )
+	{
+		m_csFolder = csFolder;
+		m_csAfter.Empty();
+		m_hFind = ::FindFirstFile( csFolder + _T( "\\*.*" ), &m_FindData );
+		m_bFirst = m_hFind != INVALID_HANDLE_VALUE;
+		return m_bFirst;
+	}
+
+	// close the find handle of the folder being listed
+	void EndList()
+	{
+		if ( m_hFind != INVALID_HANDLE_VALUE )
+		{
+			::FindClose( m_hFind );
+			m_hFind = INVALID_HANDLE_VALUE;
+		}
+		m_csFolder.Empty();
+		m_csAfter.Empty();
+		m_csSkipBelow.Empty();
+	}
+
+	// public properties
+public:
+	// the folder at the root of the walk without a trailing backslash
+	inline CString GetRoot()
+	{
+		return m_csRoot;
+	}
+	// the folder at the root of the walk without a trailing backslash
+	__declspec( property( get = GetRoot ) )
+		CString Root;
+
+	// number of folders waiting to be listed
+	inline int GetPending()
+	{
+		return (int)m_arrPending.size();
+	}
+	// number of folders waiting to be listed
+	__declspec( property( get = GetPending ) )
+		int Pending;
+
+	// public methods
+public:
+	// start a walk of the given folder (without a trailing backslash)
+	// for the files matching the given wild card data
+	void Start( LPCTSTR pcszRoot, LPCTSTR pcszSpec, DESCEND fnDescend )
+	{
+		Close();
+		m_csRoot = pcszRoot;
+		m_csSpec = pcszSpec;
+		m_fnDescend = fnDescend;
+		m_arrPending.push_back( m_csRoot );
+	}
+
+	// return the next file of the walk and false when the walk is over
+	bool Next( WALK_ENTRY& entry )
+	{
+		do
+		{
+			if ( m_hFind == INVALID_HANDLE_VALUE )
+			{
+				if ( m_arrPending.empty() )
+				{
+					return false;
+				}
+
+				const CString csFolder = m_arrPending.back();
+				m_arrPending.pop_back();
+				List( csFolder );
+				continue;
+			}
+
+			if ( m_bFirst )
+			{
+				m_bFirst = false;
+
+			} else if ( !::FindNextFile( m_hFind, &m_FindData ) )
+			{
+				// a resumed folder that no longer has the name it was
+				// stopped at is listed again past where that name was
+				const CString csFolder = m_csFolder;
+				const CString csSkipTo = m_csSkipTo;
+				EndList();
+				if ( !csSkipTo.IsEmpty() )
+				{
+					m_csSkipTo.Empty();
+					List( csFolder );
+					m_csSkipBelow = csSkipTo;
+					m_csAfter = csSkipTo;
+				}
+				continue;
+			}
+
+			const CString csName = m_FindData.cFileName;
+			if ( csName == _T( "." ) || csName == _T( ".." ) )
+			{
+				continue;
+			}
+
+			// skip the names taken before the walk was stopped
+			if ( !m_csSkipTo.IsEmpty() )
+			{
+				if ( csName == m_csSkipTo )
+				{
+					m_csSkipTo.Empty();
+					m_csAfter = csName;
+				}
+				continue;
+			}
+
+			if ( !m_csSkipBelow.IsEmpty() && CompareNames( csName, m_csSkipBelow ) <= 0 )
+			{
+				continue;
+			}
+
+			m_csAfter = csName;
+			const CString csPath = m_csFolder + _T( "\\" ) + csName;
+
+			// folders are stacked to be listed after this one, and a
+			// folder listed again does not stack a folder twice
+			if ( ( m_FindData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY ) != 0 )
+			{
+				if ( !m_csSkipBelow.IsEmpty() && IsPending( csPath ) )
+				{
+					continue;
+				}
+
+				if ( !m_fnDescend || m_fnDescend( csPath ) )
+				{
+					m_arrPending.push_back( csPath );
+				}
+				continue;
+			}
+
+			if ( !m_csSpec.IsEmpty() && !::PathMatchSpec( csName, m_csSpec ) )
+			{
+				continue;
+			}
+
+			entry.m_csPath = csPath;
+			entry.m_csFolder = m_csFolder;
+			entry.m_csName = csName;
+			return true;
+
+		} while ( true );
+	}
+
+	// write the position of the walk to the given cursor file
+	bool Save( LPCTSTR pcszCursor )
+	{
+		CStdioFile file;
+		const UINT uFlags = CFile::modeCreate | CFile::modeWrite;
+		if ( !file.Open( pcszCursor, uFlags ) )
+		{
+			return false;
+		}
+
+		file.WriteString( _T( "root=" ) + m_csRoot + _T( "\n" ) );
+		file.WriteString( _T( "spec=" ) + m_csSpec + _T( "\n" ) );
+		file.WriteString( _T( "folder=" ) + m_csFolder + _T( "\n" ) );
+		file.WriteString( _T( "after=" ) + m_csAfter + _T( "\n" ) );
+		for ( const CString& csPending : m_arrPending )
+		{
+			file.WriteString( _T( "pending=" ) + csPending + _T( "\n" ) );
+		}
+
+		file.Close();
+		return true;
+	}
+
+	// resume the walk of the given folder and wild card data from the
+	// given cursor file. Returns false if there is no cursor or the
+	// cursor belongs to another walk.
+	bool Load
+	(
+		LPCTSTR pcszCursor, LPCTSTR pcszRoot, LPCTSTR pcszSpec,
+		DESCEND fnDescend
+	)
+	{
+		CStdioFile file;
+		if ( !file.Open( pcszCursor, CFile::modeRead | CFile::shareDenyWrite ) )
+		{
+			return false;
+		}
+
+		CString csRoot;
+		CString csSpec;
+		CString csFolder;
+		CString csAfter;
+		vector<CString> pending;
+		CString csLine;
+		while ( file.ReadString( csLine ) )
+		{
+			const int nEqual = csLine.Find( _T( '=' ) );
+			if ( nEqual == -1 )
+			{
+				continue;
+			}
+
+			const CString csKey = csLine.Left( nEqual );
+			const CString csValue = csLine.Mid( nEqual + 1 );
+			if ( csKey == _T( "root" ) )
+			{
+				csRoot = csValue;
+
+			} else if ( csKey == _T( "spec" ) )
+			{
+				csSpec = csValue;
+
+			} else if ( csKey == _T( "folder" ) )
+			{
+				csFolder = csValue;
+
+			} else if ( csKey == _T( "after" ) )
+			{
+				csAfter = csValue;
+
+			} else if ( csKey == _T( "pending" ) )
+			{
+				pending.push_back( csValue );
+			}
+		}
+		file.Close();
+
+		if ( csRoot.CompareNoCase( pcszRoot ) != 0 || csSpec.CompareNoCase( pcszSpec ) != 0 )
+		{
+			return false;
+		}
+
+		Close();
+		m_csRoot = csRoot;
+		m_csSpec = csSpec;
+		m_fnDescend = fnDescend;
+
+		// the waiting folders are passed to the descend function again,
+		// so this run knows them when a link leads back to one of them
+		for ( const CString& csPending : pending )
+		{
+			if ( !m_fnDescend || m_fnDescend( csPending ) )
+			{
+				m_arrPending.push_back( csPending );
+			}
+		}
+
+		// the folder being listed is listed again next, skipping the
+		// names already taken
+		if ( !csFolder.IsEmpty() && ( !m_fnDescend || m_fnDescend( csFolder ) ) )
+		{
+			m_arrPending.push_back( csFolder );
+			m_csSkipTo = csAfter;
+		}
+
+		return true;
+	}
+
+	// end the walk
+	void Close()
+	{
+		EndList();
+		m_arrPending.clear();
+		m_csSkipTo.Empty();
+		m_bFirst = false;
+	}
+
+	// public construction / destruction
+public:
+	CTreeWalker()
+	{
+		m_hFind = INVALID_HANDLE_VALUE;
+		m_bFirst = false;
+	}
+	~CTreeWalker()
+	{
+		Close();
+	}
+};
+
@@ -0,0 +1,251 @@
+/////////////////////////////////////////////////////////////////////////////
+// Copyright  by W. T. Block, all rights reserved
+/////////////////////////////////////////////////////////////////////////////
+#pragma once
+#include "stdafx.h"
+#include "AdaptiveLimit.h"
+#include "IoThrottle.h"
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+/////////////////////////////////////////////////////////////////////////////
+// this class runs tasks on a fixed number of worker threads. The queue of
+// waiting tasks is bounded, so a producer that walks a large tree blocks
+// instead of queuing the whole tree in memory. An adaptive pool starts its
+// most workers but lets only as many run a task at a time as still raise
+// the throughput of the tasks, which is the bytes the finished tasks read
+// and wrote per second.
+class CWorkerPool
+{
+	// public definitions
+public:
+	// a unit of work
+	typedef function<void()> TASK;
+
+	// protected data
+protected:
+	// the worker threads
+	vector<thread> m_Threads;
+
+	// tasks waiting for a worker
+	deque<TASK> m_Queue;
+
+	// guards the queue and the counters
+	mutex m_Mutex;
+
+	// signaled when a task is queued or the pool is stopping
+	condition_variable m_cvWork;
+
+	// signaled when a task leaves the queue
+	condition_variable m_cvSpace;
+
+	// signaled when a worker finishes a task
+	condition_variable m_cvIdle;
+
+	// maximum number of waiting tasks
+	size_t m_nMaxQueue;
+
+	// number of tasks being run by the workers
+	int m_nBusy;
+
+	// number of tasks the workers may run at a time
+	int m_nLimit;
+
+	// the limit follows the latency of the tasks
+	bool m_bAdaptive;
+
+	// tunes the limit of an adaptive pool
+	CAdaptiveLimit m_Adaptive;
+
+	// the workers exit when this is set and the queue is empty
+	bool m_bStop;
+
+	// protected methods
+protected:
+	// seconds since an arbitrary start
+	static double GetSeconds()
+	{
+		return chrono::duration<double>
+		(
+			chrono::steady_clock::now().time_since_epoch()
+		).count();
+	}
+
+	// the worker thread loop
+	void Run()
+	{
+		do
+		{
+			TASK task;
+			{
+				unique_lock<mutex> lock( m_Mutex );
+				m_cvWork.wait
+				(
+					lock, [ this ]
+					{
+						return
+							( m_bStop && m_Queue.empty() ) ||
+							( !m_Queue.empty() && m_nBusy < m_nLimit );
+					}
+				);
+				if ( m_Queue.empty() )
+				{
+					break;
+				}
+
+				task = move( m_Queue.front() );
+				m_Queue.pop_front();
+				m_nBusy++;
+			}
+			m_cvSpace.notify_one();
+
+			CIoThrottle::ResetTally();
+			task();
+			const double dEnd = GetSeconds();
+
+			// a task that moved no data tells nothing about the storage
+			const ULONGLONG ullBytes = CIoThrottle::GetTallyBytes();
+
+			{
+				lock_guard<mutex> lock( m_Mutex );
+				m_nBusy--;
+				if ( m_bAdaptive && ullBytes != 0 && m_Adaptive.Add( ullBytes, dEnd ) )
+				{
+					m_nLimit = m_Adaptive.Limit;
+				}
+			}
+			m_cvIdle.notify_all();
+
+			// a finished task frees a slot for a waiting worker
+			m_cvWork.notify_all();
+
+		} while ( true );
+	}
+
+	// public properties
+public:
+	// number of worker threads
+	inline int GetThreads()
+	{
+		return (int)m_Threads.size();
+	}
+	// number of worker threads
+	__declspec( property( get = GetThreads ) )
+		int Threads;
+
+	// number of tasks the workers may run at a time
+	inline int GetLimit()
+	{
+		lock_guard<mutex> lock( m_Mutex );
+		return m_nLimit;
+	}
+	// number of tasks the workers may run at a time
+	__declspec( property( get = GetLimit ) )
+		int Limit;
+
+	// public methods
+public:
+	// start the given number of workers with a queue that holds up to
+	// the given number of waiting tasks
+	void Start( int nThreads, size_t nMaxQueue )
+	{
+		Stop();
+
+		m_nMaxQueue = max( nMaxQueue, (size_t)1 );
+		m_nLimit = max( nThreads, 1 );
+		m_bAdaptive = false;
+		m_bStop = false;
+		for ( int nThread = 0; nThread < max( nThreads, 1 ); nThread++ )
+		{
+			m_Threads.push_back( thread( &CWorkerPool::Run, this ) );
+		}
+	}
+
+	// start the most workers with a queue that holds up to the given
+	// number of waiting tasks, where the number of tasks run at a time
+	// starts at the fewest and follows the throughput of the tasks
+	void StartAdaptive( int nMinimum, int nMaximum, size_t nMaxQueue )
+	{
+		Start( max( nMinimum, nMaximum ), nMaxQueue );
+
+		lock_guard<mutex> lock( m_Mutex );
+		m_Adaptive.Reset( nMinimum, nMaximum, GetSeconds() );
+		m_nLimit = m_Adaptive.Limit;
+		m_bAdaptive = true;
+	}
+
+	// queue a task and block while the queue is full
+	void Submit( TASK task )
+	{
+		{
+			unique_lock<mutex> lock( m_Mutex );
+			m_cvSpace.wait
+			(
+				lock, [ this ] { return m_Queue.size() < m_nMaxQueue; }
+			);
+			m_Queue.push_back( move( task ) );
+		}
+		m_cvWork.notify_one();
+	}
+
+	// queue a task from a worker without waiting for space, which lets a
+	// task that was put aside come back even when the queue is full of
+	// tasks that no other worker can run while this one is blocked
+	void Requeue( TASK task )
+	{
+		{
+			lock_guard<mutex> lock( m_Mutex );
+			m_Queue.push_back( move( task ) );
+		}
+		m_cvWork.notify_one();
+	}
+
+	// wait until every queued task has finished
+	void Wait()
+	{
+		unique_lock<mutex> lock( m_Mutex );
+		m_cvIdle.wait
+		(
+			lock, [ this ] { return m_Queue.empty() && m_nBusy == 0; }
+		);
+	}
+
+	// finish the queued tasks and end the worker threads
+	void Stop()
+	{
+		{
+			lock_guard<mutex> lock( m_Mutex );
+			m_bStop = true;
+		}
+		m_cvWork.notify_all();
+
+		for ( thread& worker : m_Threads )
+		{
+			worker.join();
+		}
+		m_Threads.clear();
+	}
+
+	// public construction / destruction
+public:
+	CWorkerPool()
+	{
+		m_nMaxQueue = 1;
+		m_nBusy = 0;
+		m_nLimit = 1;
+		m_bAdaptive = false;
+		m_bStop = false;
+	}
+	~CWorkerPool()
+	{
+		Stop();
+	}
+};
+
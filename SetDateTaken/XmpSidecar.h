@@ -0,0 +1,169 @@
+/////////////////////////////////////////////////////////////////////////////
+// Copyright  by W. T. Block, all rights reserved
+/////////////////////////////////////////////////////////////////////////////
+#pragma once
+#include "stdafx.h"
+#include "CHelper.h"
+#include "IoThrottle.h"
+
+/////////////////////////////////////////////////////////////////////////////
+// this class writes a minimal XMP sidecar file next to an image so the
+// Date Taken can be recorded without rewriting the image data. The XMP
+// text is a fixed template with date slots that are stamped in place, so
+// no XML document object model is needed.
+class CXmpSidecar
+{
+	// protected definitions
+protected:
+	// the place holder for each date in the template which is exactly
+	// the width of an XMP date "YYYY-MM-DDTHH:MM:SS"
+	static inline LPCSTR GetPlaceHolder()
+	{
+		return "0000-00-00T00:00:00";
+	}
+
+	// the width of the XMP date
+	static inline int GetDateLength()
+	{
+		return 19;
+	}
+
+	// the sidecar template with three date slots
+	static inline LPCSTR GetTemplate()
+	{
+		return
+			"<x:xmpmeta xmlns:x=\"adobe:ns:meta/\">\n"
+			" <rdf:RDF xmlns:rdf=\"http://www.w3.org/1999/02/22-rdf-syntax-ns#\">\n"
+			"  <rdf:Description rdf:about=\"\"\n"
+			"    xmlns:exif=\"http://ns.adobe.com/exif/1.0/\"\n"
+			"    xmlns:xmp=\"http://ns.adobe.com/xap/1.0/\"\n"
+			"   exif:DateTimeOriginal=\"0000-00-00T00:00:00\"\n"
+			"   exif:DateTimeDigitized=\"0000-00-00T00:00:00\"\n"
+			"   xmp:CreateDate=\"0000-00-00T00:00:00\"/>\n"
+			" </rdf:RDF>\n"
+			"</x:xmpmeta>\n";
+	}
+
+	// public methods
+public:
+	/////////////////////////////////////////////////////////////////////////
+	// convert a Date Taken formatted string "YYYY:MM:DD HH:MM:SS" into
+	// an XMP formatted date "YYYY-MM-DDTHH:MM:SS" and return false if the
+	// given date is not in the expected format
+	static bool ToXmpDate( LPCTSTR pcszDate, char* pDate )
+	{
+		const int nLength = GetDateLength();
+		if ( (int)_tcslen( pcszDate ) != nLength )
+		{
+			return false;
+		}
+
+		for ( int nChar = 0; nChar < nLength; nChar++ )
+		{
+			pDate[ nChar ] = (char)pcszDate[ nChar ];
+		}
+
+		// the date separators become dashes and the separator between
+		// the date and time becomes the letter T
+		pDate[ 4 ] = '-';
+		pDate[ 7 ] = '-';
+		pDate[ 10 ] = 'T';
+
+		return true;
+	}
+
+	/////////////////////////////////////////////////////////////////////////
+	// the sidecar is named for the whole filename of the image with
+	// ".xmp" added ("IMG.jpg.xmp"), so images that differ only by their
+	// extension get sidecars of their own. It lives in the same folder as
+	// the image, or in the given folder (without a trailing backslash) of
+	// a mirrored tree.
+	static CString GetSidecarPath
+	(
+		LPCTSTR pcszImagePath, LPCTSTR pcszFolder = nullptr
+	)
+	{
+		const CPathParts parts( pcszImagePath );
+		CString value;
+		if ( pcszFolder != nullptr && *pcszFolder != 0 )
+		{
+			value = CString( pcszFolder ) + _T( "\\" );
+
+		} else
+		{
+			value = parts.Folder;
+		}
+
+		value.Append( parts.DataName.Data, parts.DataName.Length );
+		value += _T( ".xmp" );
+		return value;
+	}
+
+	/////////////////////////////////////////////////////////////////////////
+	// write the sidecar for the given image and Date Taken formatted
+	// date, optionally into the given folder. The sidecar is created with
+	// a single CreateFile and WriteFile, replacing any existing sidecar so
+	// running again corrects a wrong date, and a failed write removes the
+	// part of the sidecar that was written.
+	static bool Write
+	(
+		LPCTSTR pcszImagePath, LPCTSTR pcszDate, LPCTSTR pcszFolder = nullptr
+	)
+	{
+		char szDate[ 20 ] = { 0 };
+		if ( !ToXmpDate( pcszDate, szDate ) )
+		{
+			return false;
+		}
+
+		// copy the template and stamp the date into each slot
+		CStringA csText( GetTemplate() );
+		const LPCSTR pcszPlaceHolder = GetPlaceHolder();
+		const int nLength = GetDateLength();
+		char* pText = csText.GetBuffer();
+		char* pSlot = strstr( pText, pcszPlaceHolder );
+		while ( pSlot != nullptr )
+		{
+			memcpy( pSlot, szDate, nLength );
+			pSlot = strstr( pSlot + nLength, pcszPlaceHolder );
+		}
+		csText.ReleaseBuffer();
+
+		const CString csPath = GetSidecarPath( pcszImagePath, pcszFolder );
+		HANDLE hFile = ::CreateFile
+		(
+			csPath, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS,
+			FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL
+		);
+		if ( hFile == INVALID_HANDLE_VALUE )
+		{
+			return false;
+		}
+
+		DWORD dwWritten = 0;
+		const DWORD dwSize = (DWORD)csText.GetLength();
+		CIoThrottle::Write( dwSize );
+		const BOOL bWritten =
+			::WriteFile( hFile, (LPCSTR)csText, dwSize, &dwWritten, NULL );
+		::CloseHandle( hFile );
+
+		if ( !bWritten || dwWritten != dwSize )
+		{
+			// keep the error of the failure for the caller
+			const DWORD dwError = bWritten ? ERROR_HANDLE_DISK_FULL : ::GetLastError();
+			::DeleteFile( csPath );
+			::SetLastError( dwError );
+			return false;
+		}
+
+		return true;
+	}
+
+	CXmpSidecar()
+	{
+	}
+	~CXmpSidecar()
+	{
+	}
+};
+